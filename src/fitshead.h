@@ -151,6 +151,10 @@ extern "C" {
         const int lhead);       /* Allocated length of FITS header */
     int gethlength(             /* Get length of current FITS header */
         char* header);          /* FITS header */
+    int hmaxlength(             /* Get allocated length left in FITS header */
+        const char* hstring);   /* Position in FITS header */
+    int hsetsimd(               /* Set SIMD level used by header searches */
+        int level);             /* 0=none, 1=SSE4.2, 2=AVX2, -1=best */
 
     double str2ra(              /* Return RA in degrees from string */
         const char* in);        /* Character string (hh:mm:ss.sss or dd.dddd) */
@@ -363,6 +367,12 @@ extern int hlength();
 /* Get length of current FITS header */
 extern int gethlength();
 
+/* Get allocated length left in FITS header registered with hlength() */
+extern int hmaxlength();
+
+/* Set SIMD level used by ksearch(), blsearch() and strnsrch() */
+extern int hsetsimd();
+
 /* Subroutines in iget.c */
 #if 0 
 extern int mgetstr();   /* Previously allocated string from multiline keyword */
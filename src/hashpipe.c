@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -18,14 +19,92 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include <sys/resource.h> 
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <fcntl.h>
 
 #include "hashpipe.h"
+#include "hashpipe_auxshm.h"
+#include "hashpipe_config.h"
+#include "hashpipe_history.h"
+#include "hashpipe_latency.h"
 #include "hashpipe_thread_args.h"
+#include "hashpipe_trace.h"
+#include "hashpipe_probes.h"
 
 // Functions defined in hashpipe_thread.c, but not declared/exposed in public
 // hashpipe_thread.h.
 void set_run_threads();
 void clear_run_threads();
+void wait_stop_request(int fd);
+void reset_stop_fd();
+void set_thread_args(hashpipe_thread_args_t *args);
+
+// Codes for long options that have no short option equivalent
+enum {
+  OPT_HISTORY = 256,
+  OPT_HISTORY_INTERVAL,
+  OPT_HISTORY_SAMPLES,
+  OPT_METRICS,
+  OPT_STATUS_SIZE,
+  OPT_STATUS_SHARDS,
+  OPT_START_TIMEOUT,
+  OPT_PARALLEL_START,
+  OPT_SCHED,
+  OPT_NICE,
+  OPT_CONFIG,
+  OPT_STOP_TIMEOUT,
+  OPT_DRAIN,
+  OPT_WATCHDOG,
+  OPT_WATCHDOG_LOG,
+  OPT_THREAD_STATS,
+  OPT_LATENCY,
+  OPT_TRACE,
+  OPT_FORK,
+  OPT_HOT_RESTART,
+  OPT_OVERFLOW
+};
+
+// Default time (in seconds) to wait for a thread to become ready
+#define DEFAULT_START_TIMEOUT 30.0
+// Default time (in seconds) to wait for threads to stop before cancelling
+#define DEFAULT_STOP_TIMEOUT 5.0
+// Default time (in seconds) allowed for draining the pipeline
+#define DEFAULT_DRAIN_TIMEOUT 30.0
+// Default time (in seconds) without progress after which the watchdog
+// considers a thread stalled
+#define DEFAULT_STALL_TIME 5.0
+// Default interval (in seconds) at which thread statistics are updated
+#define DEFAULT_STATS_INTERVAL 1.0
+// Default interval (in seconds) at which block latency summaries are updated
+#define DEFAULT_LATENCY_INTERVAL 1.0
+// Interval (in seconds) at which the hot restart status key is checked
+#define HOT_RESTART_INTERVAL 0.5
+// Status key naming threads to restart
+#define HOT_RESTART_KEY "RESTART"
+// Time (in seconds) to wait before restarting a crashed group process
+#define GROUP_RESTART_DELAY 1.0
+// Time (in seconds) beyond the stop timeout that a group process is given to
+// exit before it is killed
+#define GROUP_STOP_MARGIN 2.0
+
+// Exit status of a group process whose threads failed to start, and of one
+// in which a thread returned an error
+#define GROUP_EXIT_START_FAILED 1
+#define GROUP_EXIT_THREAD_ERROR 2
+
+// Time allowed for draining the pipeline on shutdown, or 0 to stop all
+// threads at once.  A drain is requested by writing to drain_fd.
+static double drain_timeout = 0;
+static int drain_fd = -1;
+static volatile sig_atomic_t drain_requested = 0;
+
+// Interval (in seconds) at which status shards are merged, or 0 if threads
+// do not use status shards.
+static double status_shard_interval = 0;
 
 void usage(const char *argv0) {
     fprintf(stderr,
@@ -33,22 +112,114 @@ void usage(const char *argv0) {
       "\n"
       "Options:\n"
       "  -h,   --help          Show this message\n"
+      "        --config=FILE     Read options and threads from config FILE\n"
+      "                          (as if given in place of this option)\n"
       "  -l,   --list          List all known threads\n"
       "  -I N, --instance=N    Set instance ID of this pipeline\n"
-      "  -c N, --cpu=N         Set CPU number for subsequent threads\n"
+      "  -c L, --cpu=L         Set CPU list (e.g. 0-3,64) for subsequent threads\n"
       "  -m N, --mask=N        Set CPU mask for subsequent threads\n"
+      "        --sched=P[:N]     Set scheduling policy P (other, fifo, rr,\n"
+      "                          batch or idle) and priority N for\n"
+      "                          subsequent threads\n"
+      "        --nice=N          Set nice level N for subsequent threads\n"
       "  -o K=V, --option=K=V  Store K=V in status buffer\n"
       "  -p P, --plugin=P      Load plugin P\n"
       "  -V,   --version       Show version\n"
-//    "  -b N, --buffer=N        Jump to input buffer B, output buffer B+1\n"
-      , argv0
+      "  -n N, --replicas=N    Run next thread as a pool of N replicas\n"
+      "                          sharing its databufs (and spread over its\n"
+      "                          CPUs, if any)\n"
+      "        --fork            Run subsequent threads (up to the next --fork)\n"
+      "                          in a process of their own, which is\n"
+      "                          restarted if it crashes (threads before the\n"
+      "                          first --fork get a process of their own too)\n"
+      "        --hot-restart     Restart (and re-initialize) threads named in\n"
+      "                          status key RESTART without stopping the rest\n"
+      "                          of the pipeline.  The key is cleared once\n"
+      "                          they are running again.  Only threads that\n"
+      "                          can resume where they left off (those that\n"
+      "                          can also be run with -n) are restarted.\n"
+      "        --overflow=ID:P[,ID:P...]\n"
+      "                          Set overflow policy P of databuf ID, i.e.\n"
+      "                          what its writer does when no block is free:\n"
+      "                          block (wait), drop-newest (discard new data)\n"
+      "                          or discard-unread (discard ALL filled\n"
+      "                          blocks that are not being read and continue\n"
+      "                          writing at the oldest of them)\n"
+      "  -b N, --buffer=N      Use input databuf N and output databuf N+1 for\n"
+      "                          next thread (and number subsequent threads'\n"
+      "                          databufs from there)\n"
+      "  -b I1[,I2...]:O1[,O2...]\n"
+      "                        Wire next thread to input databufs I1,I2,...\n"
+      "                          and output databufs O1,O2,... (either list\n"
+      "                          may be empty)\n"
+      "        --history=K1,K2   Record history of status keys K1,K2,...\n"
+      "        --history-interval=S\n"
+      "                          Sample history keys every S seconds [%g]\n"
+      "        --history-samples=N\n"
+      "                          Keep N samples of each history key [%d]\n"
+      "        --metrics=ADDR    Serve Prometheus metrics on ADDR, which is\n"
+      "                          a PORT (on localhost), HOST:PORT, or unix\n"
+      "                          socket path\n"
+      "        --status-size=N   Create (or grow) status buffer to hold N\n"
+      "                          bytes of status records (must precede any\n"
+      "                          -o options)\n"
+      "        --start-timeout=S Wait up to S seconds for each thread to\n"
+      "                          become ready [%g]\n"
+      "        --parallel-start  Start all threads at once rather than\n"
+      "                          waiting for each to become ready before\n"
+      "                          starting the next\n"
+      "        --stop-timeout=S  Wait up to S seconds for threads to stop\n"
+      "                          before cancelling them [%g]\n"
+      "        --drain[=S]       On shutdown, stop threads in pipeline order\n"
+      "                          once their input databufs are empty, for\n"
+      "                          up to S seconds [%g]\n"
+      "        --watchdog[=S]    Report threads that make no progress for\n"
+      "                          S seconds in status buffer [%g]\n"
+      "        --watchdog-log    Also log stalled threads\n"
+      "        --thread-stats[=S]\n"
+      "                          Store CPU usage and performance counters\n"
+      "                          of threads in status buffer every S\n"
+      "                          seconds [%g]\n"
+      "        --latency[=S]     Trace block latency through databufs and\n"
+      "                          store summary in status buffer every S\n"
+      "                          seconds [%g] (see hashpipe_dump_latency)\n"
+      "        --trace[=N]       Record databuf and status lock events of\n"
+      "                          each thread in a ring of N records [%d]\n"
+      "                          (see hashpipe_dump_trace)\n"
+      "        --status-shards[=S]\n"
+      "                          Give each thread its own status buffer\n"
+      "                          shard, merged every S seconds [%g]\n"
+      , argv0, HASHPIPE_HISTORY_DEFAULT_INTERVAL,
+      HASHPIPE_HISTORY_DEFAULT_SAMPLES, DEFAULT_START_TIMEOUT,
+      DEFAULT_STOP_TIMEOUT, DEFAULT_DRAIN_TIMEOUT, DEFAULT_STALL_TIME,
+      DEFAULT_STATS_INTERVAL, DEFAULT_LATENCY_INTERVAL,
+      HASHPIPE_TRACE_DEFAULT_RECORDS,
+      HASHPIPE_STATUS_SHARD_SYNC_INTERVAL
     );
 }
 
+// Stop the pipeline, by draining it if so configured.  A second request
+// while draining stops all threads at once.  Async-signal-safe.
+static void request_stop()
+{
+    uint64_t one = 1;
+    int saved_errno = errno;
+
+    if(drain_timeout > 0 && drain_fd != -1 && !drain_requested) {
+        drain_requested = 1;
+        if(write(drain_fd, &one, sizeof(one)) == -1) {
+            clear_run_threads();
+        }
+    } else {
+        clear_run_threads();
+    }
+    errno = saved_errno;
+}
+
 // Control-C handler
 static void cc(int sig)
 {
-    clear_run_threads();
+    request_stop();
 }
 
 /* Exit handler that updates status buffer */
@@ -62,21 +233,12 @@ inline void set_exit_status(hashpipe_thread_args_t *args) {
 
 // Function to set cpu affinity
 int
-set_cpu_affinity(unsigned int mask)
+set_cpu_affinity(const cpu_set_t *cpuset)
 {
-    int i, rv;
+    int rv;
 
-    if(mask != 0) {
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        // Only handle 32 cores (for now)
-        for(i=0; i<32; i++) {
-            if(mask&1) {
-              CPU_SET(i, &cpuset);
-            }
-            mask >>= 1;
-        }
-        rv = sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
+    if(CPU_COUNT(cpuset) != 0) {
+        rv = sched_setaffinity(0, sizeof(cpu_set_t), cpuset);
         if (rv<0) {
             hashpipe_error(__FUNCTION__, "Error setting cpu affinity.");
             return rv;
@@ -85,14 +247,237 @@ set_cpu_affinity(unsigned int mask)
     return 0;
 }
 
-// General init function called for all threads.
+// Raise soft (and, if needed, hard) limit of resource to at least value
+static void
+raise_rlimit(int resource, rlim_t value)
+{
+    struct rlimit rlim;
+    getrlimit(resource, &rlim);
+    if(rlim.rlim_cur != RLIM_INFINITY && rlim.rlim_cur < value) {
+        rlim.rlim_cur = value;
+        if(rlim.rlim_max != RLIM_INFINITY && rlim.rlim_max < value) {
+            rlim.rlim_max = value;
+        }
+        // Ignore errors, the thread will complain if it can't get what it
+        // asked for (and privileged threads do not need the limit anyway).
+        setrlimit(resource, &rlim);
+    }
+}
+
+// Names of scheduling policies accepted by --sched
+static const struct {
+    const char *name;
+    int policy;
+} sched_policies[] = {
+    {"other", SCHED_OTHER},
+    {"fifo",  SCHED_FIFO},
+    {"rr",    SCHED_RR},
+    {"batch", SCHED_BATCH},
+    {"idle",  SCHED_IDLE},
+    {NULL, 0}
+};
+
+// Parse "POLICY[:PRIO]" into args.  Returns 0 on success, -1 on error.
 static int
-hashpipe_thread_init(hashpipe_thread_args_t *args)
+parse_sched(const char *spec, hashpipe_thread_args_t *args)
 {
-    int rv = 1;
-    args->ibuf = NULL;
+    const char *colon = strchr(spec, ':');
+    size_t len = colon ? colon - spec : strlen(spec);
+    char *end;
+    int i, min, max;
+
+    for(i=0; sched_policies[i].name; i++) {
+        if(strlen(sched_policies[i].name) == len
+        && !strncasecmp(spec, sched_policies[i].name, len)) {
+            break;
+        }
+    }
+    if(!sched_policies[i].name) {
+        return -1;
+    }
+    args->sched_policy = sched_policies[i].policy;
+    min = sched_get_priority_min(args->sched_policy);
+    max = sched_get_priority_max(args->sched_policy);
+    args->sched_priority = min;
+    if(colon) {
+        args->sched_priority = strtol(colon+1, &end, 0);
+        if(end == colon+1 || *end) {
+            return -1;
+        }
+    }
+    if(args->sched_priority < min || args->sched_priority > max) {
+        fprintf(stderr, "Priority for %s must be from %d to %d\n",
+            sched_policies[i].name, min, max);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to set scheduling policy, priority and nice level
+static int
+set_sched_params(hashpipe_thread_args_t *args)
+{
+    struct sched_param param;
+    int rv;
+
+    if(args->sched_policy >= 0) {
+        param.sched_priority = args->sched_priority;
+        rv = pthread_setschedparam(pthread_self(), args->sched_policy, &param);
+        if(rv) {
+            errno = rv;
+            hashpipe_error(__FUNCTION__,
+                "Error setting scheduling policy %d priority %d.",
+                args->sched_policy, args->sched_priority);
+            return -1;
+        }
+    }
+    // Linux threads have their own nice level
+    if(args->set_nice) {
+        if(setpriority(PRIO_PROCESS, syscall(SYS_gettid), args->nice)) {
+            hashpipe_error(__FUNCTION__, "Error setting nice level %d.",
+                args->nice);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Store calling thread's effective CPU affinity in the status buffer
+static void
+report_cpu_affinity(hashpipe_thread_args_t *args)
+{
+    cpu_set_t cpuset;
+    char key[9];
+    char cpulist[HASHPIPE_STATUS_RECORD_SIZE];
+
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &cpuset)) {
+        hashpipe_error(__FUNCTION__, "Error getting cpu affinity.");
+        return;
+    }
+    hashpipe_format_cpulist(&cpuset, cpulist, sizeof(cpulist)-10);
+    hashpipe_thread_status_key(args, "CPUS", key);
+    hashpipe_status_lock_safe(&args->st);
+    hputs(args->st.buf, key, cpulist);
+    hashpipe_status_unlock_safe(&args->st);
+}
+
+// Returns non-zero if thread reads from input databufs.  Threads that have
+// neither an input nor an output databuf create function (e.g.
+// null_output_thread) attach to their input databuf themselves.
+static int
+thread_has_input(hashpipe_thread_args_t *args)
+{
+    return args->thread_desc->ibuf_desc.create
+        || !args->thread_desc->obuf_desc.create;
+}
+
+// Returns non-zero if thread writes to output databufs
+static int
+thread_has_output(hashpipe_thread_args_t *args)
+{
+    return args->thread_desc->obuf_desc.create != NULL;
+}
+
+// Replicas of a thread take turns at the blocks of its databufs (see
+// hashpipe_thread_next_block()), which only gives each replica exclusive
+// use of its blocks if the number of blocks is a multiple of the number of
+// replicas.  Returns non-zero (after logging an error) if it is not.
+static int
+check_replica_blocks(hashpipe_thread_args_t *args, hashpipe_databuf_t *db,
+        int databuf_id)
+{
+    if(db->n_block % args->num_replicas) {
+        errno = 0;
+        hashpipe_error(__FUNCTION__,
+                "databuf %d has %d blocks, which is not a multiple of the "
+                "%d replicas of %s", databuf_id, db->n_block,
+                args->num_replicas, args->thread_desc->name);
+        return 1;
+    }
+    return 0;
+}
+
+// Create (if create is non-zero) or attach to all of a thread's databufs for
+// which it has a create function.  Returns non-zero on error.
+static int
+attach_databufs(hashpipe_thread_args_t *args, int create)
+{
+    const hashpipe_thread_desc_t *desc = args->thread_desc;
+    const char *action = create ? "creating/attaching to" : "attaching to";
+    int i, rv = 0;
+
+    if(desc->ibuf_desc.create) {
+        for(i=0; i<args->num_inputs; i++) {
+            args->ibufs[i] = create
+                ? desc->ibuf_desc.create(args->instance_id, args->input_buffers[i])
+                : hashpipe_databuf_attach(args->instance_id, args->input_buffers[i]);
+            if(!args->ibufs[i]) {
+                hashpipe_error(__FUNCTION__,
+                        "Error %s databuf %d for %s input", action,
+                        args->input_buffers[i], desc->name);
+                rv = 1;
+            } else if(check_replica_blocks(args, args->ibufs[i],
+                        args->input_buffers[i])) {
+                rv = 1;
+            }
+        }
+        args->ibuf = args->ibufs[0];
+    }
+    if(desc->obuf_desc.create) {
+        for(i=0; i<args->num_outputs; i++) {
+            args->obufs[i] = create
+                ? desc->obuf_desc.create(args->instance_id, args->output_buffers[i])
+                : hashpipe_databuf_attach(args->instance_id, args->output_buffers[i]);
+            if(!args->obufs[i]) {
+                hashpipe_error(__FUNCTION__,
+                        "Error %s databuf %d for %s output", action,
+                        args->output_buffers[i], desc->name);
+                rv = 1;
+            } else if(check_replica_blocks(args, args->obufs[i],
+                        args->output_buffers[i])) {
+                rv = 1;
+            }
+        }
+        args->obuf = args->obufs[0];
+    }
+    return rv;
+}
+
+// Detach from all of a thread's databufs.  Returns non-zero on error.
+static int
+detach_databufs(hashpipe_thread_args_t *args)
+{
+    int i, rv = 0;
+
+    for(i=0; i<args->num_outputs; i++) {
+        if(hashpipe_databuf_detach(args->obufs[i])) {
+            hashpipe_error(__FUNCTION__,
+                    "Error detaching from output databuf %d.",
+                    args->output_buffers[i]);
+            rv = 1;
+        }
+        args->obufs[i] = NULL;
+    }
+    for(i=0; i<args->num_inputs; i++) {
+        if(hashpipe_databuf_detach(args->ibufs[i])) {
+            hashpipe_error(__FUNCTION__,
+                    "Error detaching from input databuf %d.",
+                    args->input_buffers[i]);
+            rv = 1;
+        }
+        args->ibufs[i] = NULL;
+    }
     args->obuf = NULL;
+    args->ibuf = NULL;
+    return rv;
+}
 
+// General init function called for all threads.  Databufs are created if
+// create is non-zero, otherwise (when restarting a thread) only attached to.
+static int
+hashpipe_thread_init(hashpipe_thread_args_t *args, int create)
+{
+    int rv = 1;
     // Attach to status buffer
     rv = hashpipe_status_attach(args->instance_id, &args->st);
     if (rv != HASHPIPE_OK) {
@@ -108,23 +493,9 @@ hashpipe_thread_init(hashpipe_thread_args_t *args)
     }
 
     // Create databufs
-    if(args->thread_desc->ibuf_desc.create) {
-        args->ibuf = args->thread_desc->ibuf_desc.create(args->instance_id, args->input_buffer);
-        if(!args->ibuf) {
-            hashpipe_error(__FUNCTION__,
-                    "Error creating/attaching to databuf %d for %s input",
-                    args->input_buffer, args->thread_desc->name);
-            goto ibuf_error;
-        }
-    }
-    if(args->thread_desc->obuf_desc.create) {
-        args->obuf = args->thread_desc->obuf_desc.create(args->instance_id, args->output_buffer);
-        if(!args->obuf) {
-            hashpipe_error(__FUNCTION__,
-                    "Error creating/attaching to databuf %d for %s output",
-                    args->output_buffer, args->thread_desc->name);
-            goto obuf_error;
-        }
+    if(attach_databufs(args, create)) {
+        rv = 1;
+        goto databuf_error;
     }
 
     // Call user init function, if it exists
@@ -132,23 +503,12 @@ hashpipe_thread_init(hashpipe_thread_args_t *args)
         rv = args->thread_desc->init(args);
     }
 
-    // Detach from output buffer
-    if(hashpipe_databuf_detach(args->obuf)) {
-        hashpipe_error(__FUNCTION__, "Error detaching from output databuf.");
-        if(!rv) rv = 1;
-    }
-    args->obuf = NULL;
-
-obuf_error:
+databuf_error:
 
-    // Detach from input buffer
-    if(hashpipe_databuf_detach(args->ibuf)) {
-        hashpipe_error(__FUNCTION__, "Error detaching from input databuf.");
+    // Detach from databufs
+    if(detach_databufs(args)) {
         if(!rv) rv = 1;
     }
-    args->ibuf = NULL;
-
-ibuf_error:
 
     // Detach from status buffer
     if(hashpipe_status_detach(&args->st)) {
@@ -168,90 +528,1045 @@ hashpipe_thread_run(void *vp_args)
     hashpipe_thread_args_t *args = (hashpipe_thread_args_t *)vp_args;
     void * rv = THREAD_OK;
 
+    // Let framework threads find (and measure) this thread.  The tid is set
+    // last, since a new tid tells them that the thread has been restarted.
+    pthread_getcpuclockid(pthread_self(), &args->cpu_clock);
+    __atomic_store_n(&args->tid, syscall(SYS_gettid), __ATOMIC_RELEASE);
+
+    // Use the thread's event trace ring (if tracing)
+    if(args->num_replicas > 1) {
+      char name[HASHPIPE_TRACE_NAME_SIZE];
+      snprintf(name, sizeof(name), "%s[%d]",
+          args->thread_desc->name, args->replica);
+      hashpipe_trace_thread_start(name, args->trace_ring);
+    } else {
+      hashpipe_trace_thread_start(args->thread_desc->name, args->trace_ring);
+    }
+    HASHPIPE_PROBE2(thread_start, args->thread_desc->name, args->tid);
+
     // Set CPU affinity
-    if(set_cpu_affinity(args->cpu_mask) < 0) {
+    if(set_cpu_affinity(&args->cpu_set) < 0) {
         perror("set_cpu_affinity");
         rv = THREAD_ERROR;
         goto done;
     }
 
-    // Attach to status buffer
-    if(hashpipe_status_attach(args->instance_id, &args->st) != HASHPIPE_OK) {
+    // Attach to status buffer (or to a shard of it)
+    if(status_shard_interval > 0) {
+        rv = hashpipe_status_shard_attach(args->instance_id, &args->st)
+            == HASHPIPE_OK ? THREAD_OK : THREAD_ERROR;
+    } else {
+        rv = hashpipe_status_attach(args->instance_id, &args->st)
+            == HASHPIPE_OK ? THREAD_OK : THREAD_ERROR;
+    }
+    if(rv != THREAD_OK) {
         hashpipe_error(__FUNCTION__,
                 "Error attaching to status shared memory.");
         rv = THREAD_ERROR;
         goto done;
     }
 
+    // Report CPUs that thread may run on
+    report_cpu_affinity(args);
+
+    // Set scheduling parameters (after attaching to the status buffer so
+    // that real-time threads do not compete with others while attaching)
+    if(set_sched_params(args) < 0) {
+        rv = THREAD_ERROR;
+        hashpipe_status_detach(&args->st);
+        goto done;
+    }
+
     // No more goto statements now that we're using pthread_cleanup_push!
     pthread_cleanup_push((void (*)(void *))hashpipe_status_detach, &args->st);
     pthread_cleanup_push((void (*)(void *))set_exit_status, &args->st);
 
     // Attach to data buffers
-    if(args->thread_desc->ibuf_desc.create) {
-        args->ibuf = hashpipe_databuf_attach(args->instance_id, args->input_buffer);
-        if (args->ibuf==NULL) {
-            hashpipe_error(__FUNCTION__,
-                    "Error attaching to databuf %d for %s input",
-                    args->input_buffer, args->thread_desc->name);
-            rv = THREAD_ERROR;
+    if(attach_databufs(args, 0)) {
+        rv = THREAD_ERROR;
+    }
+    pthread_cleanup_push((void (*)(void *))detach_databufs, args);
+
+    // Let run_threads() and databuf functions find this thread's args
+    set_thread_args(args);
+
+    // Sets up call to set state to finished on thread exit
+    pthread_cleanup_push((void (*)(void *))hashpipe_thread_set_finished, args);
+
+    // Call user run function
+    if(rv == THREAD_OK) {
+        // Let launcher know that we are up and attached to our buffers
+        hashpipe_thread_set_ready(args);
+        rv = args->thread_desc->run(args);
+    }
+
+    // Set thread state to finished
+    hashpipe_thread_set_finished(args);
+    pthread_cleanup_pop(0);
+
+    // User thread returned (or was not run), stop other threads unless this
+    // thread was stopped on its own while draining.  Threads that return
+    // normally (e.g. at end of input) may let the rest of the pipeline drain.
+    if(__atomic_load_n(&args->run, __ATOMIC_ACQUIRE)) {
+        if(rv == THREAD_OK) {
+            request_stop();
+        } else {
+            clear_run_threads();
+        }
+    }
+
+    // Detach from data buffers
+    if(detach_databufs(args)) {
+        rv = THREAD_ERROR;
+    }
+    pthread_cleanup_pop(0); // detach databufs
+
+    // Set exit status
+    set_exit_status(args);
+    pthread_cleanup_pop(0); // set exit status
+
+    // Detach from status buffer
+    hashpipe_status_detach(&args->st);
+    pthread_cleanup_pop(0); // detach status
+
+done:
+
+    HASHPIPE_PROBE3(thread_stop, args->thread_desc->name, args->tid, rv);
+
+    // Make sure launcher does not wait for us to become ready
+    hashpipe_thread_set_finished(args);
+
+    return rv;
+}
+
+// Current time of monotonic clock in seconds
+static double
+monotonic_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Wait for thread to become ready.  Returns 1 if it did, otherwise prints an
+// error message and returns 0.
+static int
+wait_thread_ready(hashpipe_thread_args_t *args, double timeout_sec)
+{
+    int rv = hashpipe_thread_wait_ready(args, timeout_sec);
+    if(rv == 0) {
+        fprintf(stderr,
+            "Thread '%s' did not become ready within %g seconds.\n",
+            args->thread_desc->name, timeout_sec);
+    } else if(rv < 0) {
+        fprintf(stderr, "Thread '%s' exited during startup.\n",
+            args->thread_desc->name);
+    }
+    return rv > 0;
+}
+
+// Parse comma separated list of databuf ids into ids.  Returns number of ids
+// or -1 on error.
+static int
+parse_databuf_list(const char *list, int *ids)
+{
+    int n = 0;
+    long id;
+    char *end;
+
+    while(*list) {
+        id = strtol(list, &end, 0);
+        if(end == list || (*end && *end != ',')
+        || id < 0 || id > HASHPIPE_MAX_DATABUFS) {
+            return -1;
+        }
+        if(n == HASHPIPE_MAX_THREAD_DATABUFS) {
+            return -1;
+        }
+        ids[n++] = id;
+        list = *end ? end + 1 : end;
+    }
+    return n;
+}
+
+// Returns 0 if all databuf ids of thread are valid, otherwise prints an error
+// message and returns -1.  Implicitly numbered databufs (see "-b N") can run
+// past the highest id when many threads follow each other.
+static int
+check_databuf_ids(hashpipe_thread_args_t *args)
+{
+    int i, id;
+
+    for(i=0; i<args->num_inputs + args->num_outputs; i++) {
+        id = i < args->num_inputs ? args->input_buffers[i]
+                                  : args->output_buffers[i - args->num_inputs];
+        if(id < 0 || id > HASHPIPE_MAX_DATABUFS) {
+            fprintf(stderr, "Thread '%s' would use databuf %d "
+                "(ids must be 0 to %d).\n", args->thread_desc->name, id,
+                HASHPIPE_MAX_DATABUFS);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Format list of n databuf ids into buf ("-" if n is 0)
+static const char *
+format_databuf_list(const int *ids, int n, char *buf, size_t len)
+{
+    int i, l = 0;
+
+    strcpy(buf, "-");
+    for(i=0; i<n && l<len; i++) {
+        l += snprintf(buf+l, len-l, "%s%d", i ? "," : "", ids[i]);
+    }
+    return buf;
+}
+
+// Print databufs of thread
+static void
+print_thread_databufs(const char *verb, hashpipe_thread_args_t *args)
+{
+    char in[64], out[64];
+
+    char name[80];
+
+    if(args->num_replicas > 1) {
+        snprintf(name, sizeof(name), "%s[%d]",
+            args->thread_desc->name, args->replica);
+    } else {
+        snprintf(name, sizeof(name), "%s", args->thread_desc->name);
+    }
+    printf("%s thread '%s' with databufs %s and %s\n", verb, name,
+        format_databuf_list(args->input_buffers, args->num_inputs,
+          in, sizeof(in)),
+        format_databuf_list(args->output_buffers, args->num_outputs,
+          out, sizeof(out)));
+}
+
+// Initialize dst as another replica of the thread described by src
+static void
+clone_thread_args(hashpipe_thread_args_t *dst, hashpipe_thread_args_t *src)
+{
+    hashpipe_thread_args_init(dst);
+    dst->thread_desc = src->thread_desc;
+    dst->instance_id = src->instance_id;
+    dst->input_buffer = src->input_buffer;
+    dst->output_buffer = src->output_buffer;
+    dst->cpu_set = src->cpu_set;
+    dst->sched_policy = src->sched_policy;
+    dst->sched_priority = src->sched_priority;
+    dst->nice = src->nice;
+    dst->set_nice = src->set_nice;
+    dst->num_inputs = src->num_inputs;
+    dst->num_outputs = src->num_outputs;
+    memcpy(dst->input_buffers, src->input_buffers, sizeof(dst->input_buffers));
+    memcpy(dst->output_buffers, src->output_buffers,
+        sizeof(dst->output_buffers));
+    dst->num_replicas = src->num_replicas;
+}
+
+// Spread the num_replicas replicas in args over the CPUs of replica 0 (if it
+// has any): with k CPUs, replica r gets the r-th of num_replicas equal runs
+// of them, or shares a CPU with other replicas if k < num_replicas.
+static void
+spread_replica_cpus(hashpipe_thread_args_t *args, int num_replicas)
+{
+    cpu_set_t cpus = args[0].cpu_set;
+    int k = CPU_COUNT(&cpus);
+    int r, i, cpu, first, last;
+
+    if(k == 0) {
+        return;
+    }
+    for(r=0; r<num_replicas; r++) {
+        first = r * k / num_replicas;
+        last = (r + 1) * k / num_replicas;
+        if(last == first) {
+            last = first + 1;
+        }
+        CPU_ZERO(&args[r].cpu_set);
+        for(cpu=0, i=0; cpu<CPU_SETSIZE && i<last; cpu++) {
+            if(CPU_ISSET(cpu, &cpus)) {
+                if(i >= first) {
+                    CPU_SET(cpu, &args[r].cpu_set);
+                }
+                i++;
+            }
+        }
+    }
+}
+
+// Check that the databufs of the num_threads threads in args are wired into
+// a valid graph: every databuf has at most one writer and at most one reader
+// and every databuf that is used is created by one of the threads that use
+// it.  Returns 0 if so, otherwise prints error message(s) and returns 1.
+static int
+validate_databufs(hashpipe_thread_args_t *args, int num_threads)
+{
+    int i, j, id, rv = 0;
+    const char *writer[HASHPIPE_MAX_DATABUFS+1] = {0};
+    const char *reader[HASHPIPE_MAX_DATABUFS+1] = {0};
+    int created[HASHPIPE_MAX_DATABUFS+1] = {0};
+
+    for(i=0; i<num_threads; i++) {
+        const hashpipe_thread_desc_t *desc = args[i].thread_desc;
+        // Replicas share the databufs of replica 0
+        if(args[i].replica > 0) {
+            continue;
+        }
+        for(j=0; j<args[i].num_inputs; j++) {
+            id = args[i].input_buffers[j];
+            if(reader[id]) {
+                fprintf(stderr, "Databuf %d is read by both '%s' and '%s'.\n",
+                    id, reader[id], desc->name);
+                rv = 1;
+            }
+            reader[id] = desc->name;
+            if(desc->ibuf_desc.create) {
+                created[id] = 1;
+            }
+        }
+        for(j=0; j<args[i].num_outputs; j++) {
+            id = args[i].output_buffers[j];
+            if(writer[id]) {
+                fprintf(stderr,
+                    "Databuf %d is written by both '%s' and '%s'.\n",
+                    id, writer[id], desc->name);
+                rv = 1;
+            }
+            writer[id] = desc->name;
+            created[id] = 1;
+        }
+    }
+
+    for(id=0; id<=HASHPIPE_MAX_DATABUFS; id++) {
+        if(!reader[id] && !writer[id]) {
+            continue;
+        }
+        if(!created[id]) {
+            fprintf(stderr,
+                "Databuf %d (read by '%s') is not created by any thread.\n",
+                id, reader[id]);
+            rv = 1;
+        } else if(!reader[id]) {
+            fprintf(stderr, "warning: databuf %d (written by '%s') has no "
+                "reader\n", id, writer[id]);
+        } else if(!writer[id]) {
+            fprintf(stderr, "warning: databuf %d (read by '%s') has no "
+                "writer\n", id, reader[id]);
+        }
+    }
+
+    return rv;
+}
+
+// Returns non-zero if thread writes to databuf id
+static int
+writes_databuf(hashpipe_thread_args_t *args, int id)
+{
+    int i;
+    for(i=0; i<args->num_outputs; i++) {
+        if(args->output_buffers[i] == id) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Names of databuf overflow policies accepted by --overflow
+static const struct {
+    const char *name;
+    int policy;
+} overflow_policies[] = {
+    {"block",            HASHPIPE_OVERFLOW_BLOCK},
+    {"drop-newest",      HASHPIPE_OVERFLOW_DROP},
+    {"discard-unread",   HASHPIPE_OVERFLOW_FLUSH},
+    {NULL, 0}
+};
+
+// Parse comma separated list of "ID:POLICY" into policies (indexed by
+// databuf id).  Returns 0 on success, -1 on error.
+static int
+parse_overflow(const char *list, int *policies)
+{
+    const char *colon;
+    size_t len;
+    long id;
+    char *end;
+    int i;
+
+    while(*list) {
+        id = strtol(list, &end, 0);
+        if(end == list || *end != ':' || id < 1 || id > HASHPIPE_MAX_DATABUFS) {
+            return -1;
+        }
+        colon = end;
+        len = strcspn(colon+1, ",");
+        for(i=0; overflow_policies[i].name; i++) {
+            if(strlen(overflow_policies[i].name) == len
+            && !strncasecmp(colon+1, overflow_policies[i].name, len)) {
+                break;
+            }
+        }
+        if(!overflow_policies[i].name) {
+            return -1;
+        }
+        policies[id] = overflow_policies[i].policy;
+        list = colon + 1 + len;
+        if(*list) {
+            list++;
+        }
+    }
+    return 0;
+}
+
+// Set the overflow policy of every databuf written by the pipeline (block
+// unless given by --overflow) and reset its drop counters.  Databufs that
+// may be flushed must have a single writer, which hands out blocks in
+// order.  Returns 0 on success, -1 on error.
+static int
+set_overflow_policies(hashpipe_thread_args_t *args, int num_threads,
+        const int *policies)
+{
+    hashpipe_databuf_t *db;
+    int i, id, writers;
+
+    for(id=1; id<=HASHPIPE_MAX_DATABUFS; id++) {
+        writers = 0;
+        for(i=0; i<num_threads; i++) {
+            writers += writes_databuf(&args[i], id);
+        }
+        if(policies[id] == HASHPIPE_OVERFLOW_FLUSH && writers > 1) {
+            fprintf(stderr, "Databuf %d has %d writers, but discard-unread "
+                "needs a single one\n", id, writers);
+            return -1;
+        }
+        if(writers == 0 && policies[id] == HASHPIPE_OVERFLOW_BLOCK) {
+            continue;
+        }
+        db = hashpipe_databuf_attach(args[0].instance_id, id);
+        if(!db) {
+            if(policies[id] != HASHPIPE_OVERFLOW_BLOCK) {
+                fprintf(stderr, "No databuf %d for overflow policy\n", id);
+                return -1;
+            }
+            continue;
+        }
+        hashpipe_databuf_set_overflow(db, policies[id]);
+        memset(&db->drops, 0, sizeof(db->drops));
+        memset(&db->gap, 0, sizeof(db->gap));
+        hashpipe_databuf_detach(db);
+    }
+    return 0;
+}
+
+// Drain the pipeline by stopping threads in topological order.  Threads
+// without input databufs are stopped first.  Every other thread is stopped
+// once all threads writing to its input databufs have finished and its
+// input databufs are empty, so no filled blocks are lost.  Gives up after
+// drain_timeout seconds or if all threads are asked to stop.
+static void
+drain_pipeline(hashpipe_thread_args_t *args, int first, int num_threads)
+{
+    int i, j, k, id, ready, remaining;
+    char stopped[MAX_HASHPIPE_THREADS] = {0};
+    hashpipe_databuf_t *db[HASHPIPE_MAX_DATABUFS+1] = {0};
+    double deadline = monotonic_time() + drain_timeout;
+
+    printf("Draining pipeline\n");
+    do {
+        remaining = 0;
+        for(i=first; i<num_threads; i++) {
+            if(stopped[i]) {
+                continue;
+            }
+            ready = 1;
+            for(j=0; ready && j<args[i].num_inputs; j++) {
+                id = args[i].input_buffers[j];
+                for(k=first; ready && k<num_threads; k++) {
+                    if(writes_databuf(&args[k], id)
+                    && !hashpipe_thread_finished(&args[k], 0)) {
+                        ready = 0;
+                    }
+                }
+                if(ready && !db[id]) {
+                    db[id] = hashpipe_databuf_attach(args[i].instance_id, id);
+                }
+                if(ready && db[id] && hashpipe_databuf_total_status(db[id])) {
+                    ready = 0;
+                }
+            }
+            if(ready) {
+                __atomic_store_n(&args[i].run, 0, __ATOMIC_RELEASE);
+                stopped[i] = 1;
+            } else {
+                remaining++;
+            }
+        }
+        if(remaining) {
+            usleep(10000);
+        }
+    } while(remaining && run_threads() && monotonic_time() < deadline);
+
+    if(remaining && run_threads()) {
+        fprintf(stderr, "Pipeline did not drain within %g seconds, "
+            "stopping remaining threads.\n", drain_timeout);
+    }
+
+    for(id=0; id<=HASHPIPE_MAX_DATABUFS; id++) {
+        hashpipe_databuf_detach(db[id]);
+    }
+}
+
+// Restart all threads named name among threads first to num_threads-1 of
+// args without stopping the rest of the pipeline.  Each thread is stopped
+// (and cancelled if it does not stop within stop_timeout seconds), its init
+// function is run again (attaching to, rather than re-creating, its
+// databufs) and it is started again, resuming after the last blocks it
+// released.  Threads without the HASHPIPE_THREAD_REPLICABLE flag would start
+// over at block 0 and get out of step with their databufs, so they are not
+// restarted.  Returns number of threads restarted, or -1 if a thread could
+// not be restarted, in which case the pipeline is stopped.
+static int
+restart_threads(hashpipe_thread_args_t *args, pthread_t *threads,
+        char *joinable, int first, int num_threads, const char *name,
+        double stop_timeout, double start_timeout)
+{
+    int i, n = 0, restarts;
+    double timeout, deadline = monotonic_time() + stop_timeout;
+    hashpipe_status_t st;
+    char key[16];
+
+    for(i=first; i<num_threads; i++) {
+        if(!strcmp(args[i].thread_desc->name, name)
+        && !(args[i].thread_desc->flags & HASHPIPE_THREAD_REPLICABLE)) {
+            fprintf(stderr, "Cannot restart thread '%s': it does not iterate "
+                "over blocks with hashpipe_thread_first_block() and "
+                "hashpipe_thread_next_block(), so it would not resume where "
+                "it left off.\n", name);
+            return 0;
+        }
+    }
+
+    for(i=first; i<num_threads; i++) {
+        if(!strcmp(args[i].thread_desc->name, name)) {
+            __atomic_store_n(&args[i].run, 0, __ATOMIC_RELEASE);
+            n++;
+        }
+    }
+    if(n == 0) {
+        return 0;
+    }
+    printf("Restarting thread '%s'\n", name);
+
+    for(i=num_threads-1; i>=first; i--) {
+        if(strcmp(args[i].thread_desc->name, name)) {
+            continue;
+        }
+        timeout = deadline - monotonic_time();
+        if(!hashpipe_thread_finished(&args[i], timeout > 0 ? timeout : 0)) {
+            fprintf(stderr, "Thread '%s' did not stop within %g seconds, "
+                "cancelling it.\n", name, stop_timeout);
+            // Blocking system calls are cancellation points.  Signals are
+            // not used to interrupt them, since the process wide SIGINT
+            // handler would stop the whole pipeline.
+            pthread_cancel(threads[i]);
+        }
+        pthread_join(threads[i], NULL);
+        joinable[i] = 0;
+    }
+
+    // Start threads again in reverse order (as at startup)
+    for(i=num_threads-1; i>=first; i--) {
+        if(strcmp(args[i].thread_desc->name, name)) {
+            continue;
+        }
+        hashpipe_thread_args_reset(&args[i]);
+        print_thread_databufs("restarting", &args[i]);
+        if(hashpipe_thread_init(&args[i], 0)) {
+            fprintf(stderr, "Error re-initializing thread '%s'.\n", name);
+            break;
+        }
+        if(pthread_create(&threads[i], NULL, hashpipe_thread_run,
+                    (void *)&args[i])) {
+            fprintf(stderr, "Error creating thread for '%s'.\n", name);
+            break;
+        }
+        joinable[i] = 1;
+        if(!wait_thread_ready(&args[i], start_timeout)) {
+            break;
+        }
+        if(hashpipe_status_attach(args[i].instance_id, &st) == HASHPIPE_OK) {
+            hashpipe_thread_status_key(&args[i], "RSTS", key);
+            hashpipe_status_lock_safe(&st);
+            restarts = 0;
+            hgeti4(st.buf, key, &restarts);
+            hputi4(st.buf, key, restarts + 1);
+            hashpipe_status_unlock_safe(&st);
+            hashpipe_status_detach(&st);
+        }
+    }
+
+    if(i >= first) {
+        fprintf(stderr, "Restarting thread '%s' failed, shutting down.\n",
+            name);
+        // Do not let anyone wait for threads that were not started again
+        for(; i>=first; i--) {
+            if(!strcmp(args[i].thread_desc->name, name)) {
+                hashpipe_thread_set_finished(&args[i]);
+            }
+        }
+        clear_run_threads();
+        return -1;
+    }
+    return n;
+}
+
+// Wait for a stop request (as wait_stop_request() does), restarting the
+// threads named in the HOT_RESTART_KEY status key in the meantime (see
+// restart_threads()).  Only threads first to num_threads-1 of the
+// all_threads threads in args run in this process, so names of other
+// threads are left for their group process to handle.  The key is cleared
+// once the threads have been restarted (or, by the process running thread
+// 0, if no thread has that name).
+static void
+wait_hot_restart(hashpipe_thread_args_t *args, pthread_t *threads,
+        char *joinable, int first, int num_threads, int all_threads,
+        double stop_timeout, double start_timeout)
+{
+    struct pollfd pfd[2] = {{hashpipe_stop_fd(), POLLIN, 0},
+                            {drain_fd, POLLIN, 0}};
+    hashpipe_status_t st;
+    char name[HASHPIPE_STATUS_RECORD_SIZE];
+    int i, mine;
+
+    if(hashpipe_status_attach(args[first].instance_id, &st) != HASHPIPE_OK) {
+        hashpipe_error(__FUNCTION__, "Error attaching to status buffer, "
+                "hot restart disabled.");
+        wait_stop_request(drain_fd);
+        return;
+    }
+
+    while(run_threads()) {
+        if(poll(pfd, 2, HOT_RESTART_INTERVAL * 1000) > 0
+        && (pfd[1].revents & POLLIN)) {
+            break;
+        }
+
+        name[0] = '\0';
+        hashpipe_status_lock_safe(&st);
+        hgets(st.buf, HOT_RESTART_KEY, sizeof(name), name);
+        hashpipe_status_unlock_read_safe(&st);
+        if(!name[0]) {
+            continue;
+        }
+
+        // Find out whether the named thread belongs to this process
+        for(i=0, mine=-1; i<all_threads && mine<1; i++) {
+            if(!strcmp(args[i].thread_desc->name, name)) {
+                mine = i >= first && i < num_threads;
+            }
+        }
+        if(mine == 0 || (mine == -1 && first > 0)) {
+            continue;
+        }
+        if(mine == -1) {
+            fprintf(stderr, "Cannot restart unknown thread '%s'.\n", name);
+        } else if(restart_threads(args, threads, joinable, first, num_threads,
+                    name, stop_timeout, start_timeout) < 0) {
+            break;
+        }
+        hashpipe_status_lock_safe(&st);
+        hputs(st.buf, HOT_RESTART_KEY, "");
+        hashpipe_status_unlock_safe(&st);
+    }
+
+    hashpipe_status_detach(&st);
+}
+
+// A group of consecutive threads that runs in a process of its own (see
+// --fork).  The launcher forks the group processes and restarts any that
+// crash.  Databufs are created by the launcher (when initializing threads)
+// and group processes only attach to them, so restarting a group does not
+// affect the blocks in its databufs.
+typedef struct {
+    int first;      // Index of first thread of group
+    int end;        // Index after last thread of group
+    pid_t pid;      // Process running group (0 if none)
+    int ready_fd;   // Pipe that process signals readiness on (or -1)
+    int restarts;   // Number of times group has been restarted
+    double restart_time; // When to restart group (0 if not pending)
+    int stopping;   // Non-zero once process has been asked to stop
+} hashpipe_group_t;
+
+// Write end of readiness pipe in a group process (-1 in the launcher)
+static int group_ready_fd = -1;
+
+// SIGTERM handler of group processes, which the launcher uses to stop a
+// group at once (SIGINT requests a stop as usual, draining if so configured)
+static void stop_group(int sig)
+{
+    clear_run_threads();
+}
+
+// Add group starting at thread first to groups
+static void
+add_group(hashpipe_group_t *groups, int *num_groups, int first)
+{
+    memset(&groups[*num_groups], 0, sizeof(hashpipe_group_t));
+    groups[*num_groups].first = first;
+    groups[*num_groups].ready_fd = -1;
+    (*num_groups)++;
+}
+
+// Returns non-zero if a thread of group g writes to a databuf that a thread
+// of group h reads
+static int
+group_feeds(hashpipe_thread_args_t *args, hashpipe_group_t *g,
+        hashpipe_group_t *h)
+{
+    int i, j, k;
+
+    for(i=h->first; i<h->end; i++) {
+        for(j=0; j<args[i].num_inputs; j++) {
+            for(k=g->first; k<g->end; k++) {
+                if(writes_databuf(&args[k], args[i].input_buffers[j])) {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Fork process for group g.  Returns 0 in the new process, the process id
+// of the new process in the launcher, or -1 on error.
+static pid_t
+fork_group(hashpipe_thread_args_t *args, hashpipe_group_t *groups, int g)
+{
+    int fds[2];
+    pid_t pid, launcher = getpid();
+
+    if(pipe(fds)) {
+        perror("pipe");
+        return -1;
+    }
+    // Do not let the new process inherit (and repeat) buffered output
+    fflush(NULL);
+    pid = fork();
+    if(pid == -1) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    } else if(pid == 0) {
+        close(fds[0]);
+        group_ready_fd = fds[1];
+        // Exit if the launcher does, and keep signals meant for the launcher
+        // (e.g. control-c) away from the group, since the launcher decides
+        // how groups are stopped.
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if(getppid() != launcher) {
+            exit(0);
+        }
+        setpgid(0, 0);
+        // Get stop and drain notifications of our own
+        reset_stop_fd();
+        set_run_threads();
+        if(drain_fd != -1) {
+            close(drain_fd);
+            drain_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+        drain_requested = 0;
+        signal(SIGTERM, stop_group);
+        return 0;
+    }
+    close(fds[1]);
+    groups[g].pid = pid;
+    groups[g].ready_fd = fds[0];
+    groups[g].stopping = 0;
+    printf("Started process %d for threads '%s' to '%s'\n", pid,
+        args[groups[g].first].thread_desc->name,
+        args[groups[g].end-1].thread_desc->name);
+    return pid;
+}
+
+// Read readiness of group g from its pipe.  Returns 1 if it became ready, 0
+// if it exited first, or -1 if there is nothing to read yet.
+static int
+read_group_ready(hashpipe_group_t *group)
+{
+    char c;
+    ssize_t n = read(group->ready_fd, &c, 1);
+
+    if(n == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return -1;
+    }
+    close(group->ready_fd);
+    group->ready_fd = -1;
+    return n == 1;
+}
+
+// Handle exit of process pid with wait status.  Crashed groups (killed by a
+// signal or exited with a non-zero status) are scheduled for restart unless
+// the pipeline is stopping.  A group that exits normally stops the
+// pipeline, just like a thread that returns normally.
+static void
+group_exited(hashpipe_thread_args_t *args, hashpipe_group_t *groups,
+        int num_groups, pid_t pid, int status, int stopping)
+{
+    int g;
+
+    for(g=0; g<num_groups && groups[g].pid != pid; g++);
+    if(g == num_groups) {
+        return;
+    }
+    groups[g].pid = 0;
+    if(groups[g].ready_fd != -1) {
+        close(groups[g].ready_fd);
+        groups[g].ready_fd = -1;
+    }
+    if(stopping) {
+        return;
+    }
+    if(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        printf("Process %d for threads '%s' to '%s' finished\n", pid,
+            args[groups[g].first].thread_desc->name,
+            args[groups[g].end-1].thread_desc->name);
+        request_stop();
+        return;
+    }
+    if(WIFSIGNALED(status)) {
+        fprintf(stderr, "Process %d for threads '%s' to '%s' killed by "
+            "signal %d, restarting it in %g seconds.\n", pid,
+            args[groups[g].first].thread_desc->name,
+            args[groups[g].end-1].thread_desc->name, WTERMSIG(status),
+            GROUP_RESTART_DELAY);
+    } else {
+        fprintf(stderr, "Process %d for threads '%s' to '%s' exited with "
+            "status %d, restarting it in %g seconds.\n", pid,
+            args[groups[g].first].thread_desc->name,
+            args[groups[g].end-1].thread_desc->name, WEXITSTATUS(status),
+            GROUP_RESTART_DELAY);
+    }
+    groups[g].restart_time = monotonic_time() + GROUP_RESTART_DELAY;
+}
+
+// Reap any group processes that have exited, waiting up to timeout seconds
+// for one to exit.  Returns number of group processes still running.
+static int
+reap_groups(hashpipe_thread_args_t *args, hashpipe_group_t *groups,
+        int num_groups, double timeout, int stopping)
+{
+    int g, status, running;
+    pid_t pid;
+    double deadline = monotonic_time() + timeout;
+
+    for(;;) {
+        while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            group_exited(args, groups, num_groups, pid, status, stopping);
+        }
+        for(g=0, running=0; g<num_groups; g++) {
+            running += groups[g].pid != 0;
+        }
+        if(!running || monotonic_time() >= deadline) {
+            return running;
+        }
+        usleep(10000);
+    }
+}
+
+// Stop all group processes.  When draining, each group is asked to stop
+// (and drain itself) once all groups feeding it have exited.  Groups that
+// are still running after that (or all groups, if not draining) are stopped
+// at once, and killed if they do not exit in time.
+static void
+stop_groups(hashpipe_thread_args_t *args, hashpipe_group_t *groups,
+        int num_groups, double stop_timeout)
+{
+    int g, h, ready;
+    double deadline = monotonic_time() + drain_timeout;
+
+    if(drain_requested && run_threads()) {
+        printf("Draining pipeline\n");
+        while(reap_groups(args, groups, num_groups, 0, 1)
+        && run_threads() && monotonic_time() < deadline) {
+            for(g=0; g<num_groups; g++) {
+                if(!groups[g].pid || groups[g].stopping) {
+                    continue;
+                }
+                for(h=0, ready=1; ready && h<num_groups; h++) {
+                    if(h != g && groups[h].pid
+                    && group_feeds(args, &groups[h], &groups[g])) {
+                        ready = 0;
+                    }
+                }
+                if(ready) {
+                    kill(groups[g].pid, SIGINT);
+                    groups[g].stopping = 1;
+                }
+            }
+            usleep(10000);
+        }
+    }
+    clear_run_threads();
+
+    for(g=0; g<num_groups; g++) {
+        if(groups[g].pid) {
+            kill(groups[g].pid, SIGTERM);
         }
     }
-    pthread_cleanup_push((void (*)(void *))hashpipe_databuf_detach, args->ibuf);
-    if(args->thread_desc->obuf_desc.create) {
-        args->obuf = hashpipe_databuf_attach(args->instance_id, args->output_buffer);
-        if (args->obuf==NULL) {
-            hashpipe_error(__FUNCTION__,
-                    "Error attaching to databuf %d for %s output",
-                    args->output_buffer, args->thread_desc->name);
-            rv = THREAD_ERROR;
+    if(reap_groups(args, groups, num_groups,
+                stop_timeout + GROUP_STOP_MARGIN, 1)) {
+        for(g=0; g<num_groups; g++) {
+            if(groups[g].pid) {
+                fprintf(stderr, "Process %d did not stop, killing it.\n",
+                    groups[g].pid);
+                kill(groups[g].pid, SIGKILL);
+            }
         }
+        reap_groups(args, groups, num_groups, stop_timeout, 1);
     }
-    pthread_cleanup_push((void (*)(void *))hashpipe_databuf_detach, args->obuf);
-
+}
 
-    // Sets up call to set state to finished on thread exit
-    pthread_cleanup_push((void (*)(void *))hashpipe_thread_set_finished, args);
+// Layout of the thread resume segment, indexed like args
+typedef struct {
+    hashpipe_auxshm_hdr_t hdr;
+    hashpipe_thread_resume_t thread[];
+} resume_segment_t;
 
-    // Call user run function
-    if(rv == THREAD_OK) {
-        rv = args->thread_desc->run(args);
+// Keep the resume positions of the num_threads threads of args in an
+// auxiliary segment, so that the threads of a restarted group process resume
+// after the last blocks that their crashed predecessors released (see
+// hashpipe_thread_first_block()).  Returns non-zero on error.
+static int
+share_resume_positions(int instance_id, hashpipe_thread_args_t *args,
+        int num_threads)
+{
+    resume_segment_t *seg;
+    int i;
+
+    seg = hashpipe_auxshm_create(instance_id, HASHPIPE_AUXSHM_RESUME,
+            sizeof(resume_segment_t)
+            + num_threads * sizeof(hashpipe_thread_resume_t));
+    if(!seg) {
+        return 1;
     }
-
-    // Set thread state to finished
-    hashpipe_thread_set_finished(args);
-    pthread_cleanup_pop(0);
-
-    // User thread returned (or was not run), stop other threads
-    clear_run_threads();
-
-    // Detach from output buffer
-    if(hashpipe_databuf_detach(args->obuf)) {
-        hashpipe_error(__FUNCTION__, "Error detaching from output databuf.");
-        rv = THREAD_ERROR;
+    for(i=0; i<num_threads; i++) {
+        memset(&seg->thread[i], -1, sizeof(hashpipe_thread_resume_t));
+        args[i].shared_resume = &seg->thread[i];
     }
-    pthread_cleanup_pop(0); // detach obuf
-    args->obuf = NULL;
+    return 0;
+}
 
-    // Detach from input buffer
-    if(hashpipe_databuf_detach(args->ibuf)) {
-        hashpipe_error(__FUNCTION__, "Error detaching from input databuf.");
-        rv = THREAD_ERROR;
+// Start each group of threads in a process of its own.  Groups are started
+// in reverse order, each once the one after it is ready.  This is done before
+// the launcher starts any threads of its own, so the group processes are
+// forked from a single threaded process.  Returns the index of the group in a
+// group process.  Returns -1 in the launcher, setting *start_failed if a
+// group failed to start.
+static int
+start_groups(hashpipe_thread_args_t *args, hashpipe_group_t *groups,
+        int num_groups, int *start_failed)
+{
+    int g, ready;
+    pid_t pid;
+    struct pollfd pfd[2];
+
+    for(g=num_groups-1; g>=0 && run_threads(); g--) {
+        pid = fork_group(args, groups, g);
+        if(pid == 0) {
+            return g;
+        } else if(pid == -1) {
+            *start_failed = 1;
+            break;
+        }
+        // Wait for group to become ready (or exit)
+        ready = -1;
+        pfd[0].fd = groups[g].ready_fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = hashpipe_stop_fd();
+        pfd[1].events = POLLIN;
+        while(ready == -1 && run_threads()) {
+            if(poll(pfd, 2, 1000) > 0 && (pfd[0].revents & (POLLIN|POLLHUP))) {
+                ready = read_group_ready(&groups[g]);
+            }
+        }
+        if(ready == 0) {
+            *start_failed = 1;
+            break;
+        }
     }
-    pthread_cleanup_pop(0); // detach ibuf
-    args->ibuf = NULL;
+    return -1;
+}
 
-    // Set exit status
-    set_exit_status(args);
-    pthread_cleanup_pop(0); // set exit status
+// Supervise the group processes started by start_groups() until the pipeline
+// is stopped, restarting groups that crash.  Returns the index of the group
+// in a restarted group process.  Returns -1 in the launcher once all group
+// processes have exited.
+static int
+supervise_groups(hashpipe_thread_args_t *args, hashpipe_group_t *groups,
+        int num_groups, double stop_timeout, int start_failed)
+{
+    int g, n;
+    pid_t pid;
+    struct pollfd pfd[MAX_HASHPIPE_THREADS+2];
+    int pfd_group[MAX_HASHPIPE_THREADS+2];
+    double now;
+
+    if(start_failed) {
+        fprintf(stderr, "Pipeline startup failed, shutting down.\n");
+        clear_run_threads();
+    }
 
-    // Detach from status buffer
-    hashpipe_status_detach(&args->st);
-    pthread_cleanup_pop(0); // detach status
+    while(run_threads() && !drain_requested) {
+        // Wait for stop requests and restarted groups becoming ready
+        pfd[0].fd = hashpipe_stop_fd();
+        pfd[0].events = POLLIN;
+        pfd[1].fd = drain_fd;
+        pfd[1].events = POLLIN;
+        for(g=0, n=2; g<num_groups; g++) {
+            if(groups[g].ready_fd != -1) {
+                pfd[n].fd = groups[g].ready_fd;
+                pfd[n].events = POLLIN;
+                pfd_group[n++] = g;
+            }
+        }
+        if(poll(pfd, n, 100) > 0) {
+            while(--n >= 2) {
+                g = pfd_group[n];
+                if((pfd[n].revents & (POLLIN|POLLHUP))
+                && read_group_ready(&groups[g]) == 1) {
+                    printf("Process %d for threads '%s' to '%s' restarted "
+                        "(%d restarts)\n", groups[g].pid,
+                        args[groups[g].first].thread_desc->name,
+                        args[groups[g].end-1].thread_desc->name,
+                        groups[g].restarts);
+                }
+            }
+        }
 
-done:
+        reap_groups(args, groups, num_groups, 0, 0);
+
+        // Restart crashed groups once their restart delay has passed
+        now = monotonic_time();
+        for(g=0; g<num_groups && run_threads() && !drain_requested; g++) {
+            if(groups[g].restart_time && now >= groups[g].restart_time) {
+                groups[g].restart_time = 0;
+                groups[g].restarts++;
+                pid = fork_group(args, groups, g);
+                if(pid == 0) {
+                    return g;
+                } else if(pid == -1) {
+                    groups[g].restart_time = now + GROUP_RESTART_DELAY;
+                }
+            }
+        }
+    }
 
-    return rv;
+    stop_groups(args, groups, num_groups, stop_timeout);
+    return -1;
 }
 
 #define MAX_PLUGIN_NAME (1024)
@@ -265,6 +1580,7 @@ int main(int argc, char *argv[])
     hashpipe_status_t st;
     int num_threads = 0;
     pthread_t threads[MAX_HASHPIPE_THREADS];
+    char joinable[MAX_HASHPIPE_THREADS] = {0};
     struct hashpipe_thread_args args[MAX_HASHPIPE_THREADS];
     char plugin_name[MAX_PLUGIN_NAME+MAX_PLUGIN_EXT+1];
 
@@ -277,14 +1593,107 @@ int main(int argc, char *argv[])
       {"option",   1, NULL, 'o'},
       {"plugin",   1, NULL, 'p'},
       {"version",  0, NULL, 'V'},
-//    {"buffer",   1, NULL, 'b'},
+      {"buffer",   1, NULL, 'b'},
+      {"replicas", 1, NULL, 'n'},
+      {"history",          1, NULL, OPT_HISTORY},
+      {"history-interval", 1, NULL, OPT_HISTORY_INTERVAL},
+      {"history-samples",  1, NULL, OPT_HISTORY_SAMPLES},
+      {"metrics",          1, NULL, OPT_METRICS},
+      {"status-size",      1, NULL, OPT_STATUS_SIZE},
+      {"status-shards",    2, NULL, OPT_STATUS_SHARDS},
+      {"sched",            1, NULL, OPT_SCHED},
+      {"nice",             1, NULL, OPT_NICE},
+      {"start-timeout",    1, NULL, OPT_START_TIMEOUT},
+      {"parallel-start",   0, NULL, OPT_PARALLEL_START},
+      {"stop-timeout",     1, NULL, OPT_STOP_TIMEOUT},
+      {"drain",            2, NULL, OPT_DRAIN},
+      {"watchdog",         2, NULL, OPT_WATCHDOG},
+      {"watchdog-log",     0, NULL, OPT_WATCHDOG_LOG},
+      {"thread-stats",     2, NULL, OPT_THREAD_STATS},
+      {"latency",          2, NULL, OPT_LATENCY},
+      {"trace",            2, NULL, OPT_TRACE},
+      {"fork",             0, NULL, OPT_FORK},
+      {"hot-restart",      0, NULL, OPT_HOT_RESTART},
+      {"overflow",         1, NULL, OPT_OVERFLOW},
+      {"config",           1, NULL, OPT_CONFIG},
       {0,0,0,0}
     };
 
+    // Status history settings
+    char * history_keys[HASHPIPE_HISTORY_MAX_KEYS];
+    int num_history_keys = 0;
+    double history_interval = HASHPIPE_HISTORY_DEFAULT_INTERVAL;
+    unsigned long history_samples = HASHPIPE_HISTORY_DEFAULT_SAMPLES;
+    hashpipe_history_t history;
+    pthread_t history_thread;
+
+    // Metrics exporter settings
+    hashpipe_metrics_args_t metrics_args = {0, NULL};
+    pthread_t metrics_thread;
+
+    // Status shard merge thread
+    pthread_t shard_thread;
+
+    // Stall watchdog settings
+    hashpipe_watchdog_args_t watchdog_args = {0, 0, 0, NULL, 0};
+    pthread_t watchdog_thread;
+
+    // Thread statistics settings
+    hashpipe_stats_args_t stats_args = {0, 0, NULL, 0};
+    pthread_t stats_thread;
+
+    // Block latency settings
+    hashpipe_latency_args_t latency_args = {0, 0};
+    pthread_t latency_thread;
+
+    // Number of event trace records per thread (0 if not tracing)
+    int trace_records = 0;
+
+    // Thread startup settings
+    double start_timeout = DEFAULT_START_TIMEOUT;
+    double stop_timeout = DEFAULT_STOP_TIMEOUT;
+    double stop_deadline, timeout;
+    int parallel_start = 0;
+    int first_started;
+    int start_failed = 0;
+
     int instance_id  = 0;
     int input_buffer  = 0;
     int output_buffer = 1;
 
+    // Explicit databuf wiring of next thread (from "-b IN:OUT")
+    int wired = 0;
+    int num_wired_inputs = 0;
+    int num_wired_outputs = 0;
+    int wired_inputs[HASHPIPE_MAX_THREAD_DATABUFS];
+    int wired_outputs[HASHPIPE_MAX_THREAD_DATABUFS];
+
+    // Number of replicas of next thread (from "-n N")
+    int num_replicas = 1;
+
+    // Groups of threads that run in processes of their own (from "--fork").
+    // Pipeline threads group_start to num_threads-1 run in this process.  In
+    // a group process, group is the index of its group (otherwise it is -1).
+    hashpipe_group_t groups[MAX_HASHPIPE_THREADS];
+    int num_groups = 0;
+    int group = -1;
+    int group_start = 0;
+    int thread_failed = 0;
+    void *thread_rv;
+
+    // Restart threads named in the status buffer (from "--hot-restart")
+    int hot_restart = 0;
+
+    // Overflow policies of databufs, indexed by databuf id (from
+    // "--overflow")
+    int overflow[HASHPIPE_MAX_DATABUFS+1] = {0};
+
+    // Replace any --config options with the contents of their config files
+    // (before anything else is done so that config errors are caught early)
+    if(hashpipe_config_expand(&argc, &argv, long_opts)) {
+      exit(1);
+    }
+
     // Preemptively set RLIMIT_MEMLOCK to max
     struct rlimit rlim;
     getrlimit(RLIMIT_MEMLOCK, &rlim);
@@ -321,7 +1730,7 @@ int main(int argc, char *argv[])
 
     // Parse command line.  Leading '-' means treat non-option arguments as if
     // it were the argument of an option with character code 1.
-    while((opt=getopt_long(argc,argv,"-hlI:m:c:b:o:p:V",long_opts,NULL))!=-1) {
+    while((opt=getopt_long(argc,argv,"-hlI:m:c:b:n:o:p:V",long_opts,NULL))!=-1) {
       switch (opt) {
         case 1:
           // optarg is name of thread
@@ -332,23 +1741,86 @@ int main(int argc, char *argv[])
               exit(1);
           }
 
-          // Init thread
-          printf("initing  thread '%s' with databufs %d and %d\n",
-              args[num_threads].thread_desc->name, args[num_threads].input_buffer,
-              args[num_threads].output_buffer);
-
-          rv = hashpipe_thread_init(&args[num_threads]);
+          // Wire up databufs
+          if(wired) {
+            if(num_wired_inputs && !thread_has_input(&args[num_threads])) {
+              fprintf(stderr, "Thread '%s' does not have input databufs.\n",
+                  args[num_threads].thread_desc->name);
+              exit(1);
+            }
+            if(num_wired_outputs && !thread_has_output(&args[num_threads])) {
+              fprintf(stderr, "Thread '%s' does not have output databufs.\n",
+                  args[num_threads].thread_desc->name);
+              exit(1);
+            }
+            args[num_threads].num_inputs = num_wired_inputs;
+            memcpy(args[num_threads].input_buffers, wired_inputs,
+                sizeof(wired_inputs));
+            args[num_threads].num_outputs = num_wired_outputs;
+            memcpy(args[num_threads].output_buffers, wired_outputs,
+                sizeof(wired_outputs));
+            if(num_wired_inputs) {
+              args[num_threads].input_buffer = wired_inputs[0];
+            }
+            if(num_wired_outputs) {
+              args[num_threads].output_buffer = wired_outputs[0];
+            }
+          } else {
+            args[num_threads].num_inputs =
+              thread_has_input(&args[num_threads]) ? 1 : 0;
+            args[num_threads].input_buffers[0] = input_buffer;
+            args[num_threads].num_outputs =
+              thread_has_output(&args[num_threads]) ? 1 : 0;
+            args[num_threads].output_buffers[0] = output_buffer;
+          }
+          if(check_databuf_ids(&args[num_threads])) {
+            exit(1);
+          }
 
-          if (rv) {
-              fprintf(stderr, "Error initializing thread for '%s'.\n",
+          // Clone args for any additional replicas
+          if(num_threads + num_replicas >= MAX_HASHPIPE_THREADS) {
+              fprintf(stderr, "Too many threads (max %d)\n",
+                  MAX_HASHPIPE_THREADS - 1);
+              exit(1);
+          }
+          if(num_replicas > 1 && !(args[num_threads].thread_desc->flags
+                & HASHPIPE_THREAD_REPLICABLE)) {
+              fprintf(stderr, "Thread '%s' cannot be run as replicas.\n",
                   args[num_threads].thread_desc->name);
               exit(1);
           }
+          args[num_threads].num_replicas = num_replicas;
+          for(i=1; i<num_replicas; i++) {
+              clone_thread_args(&args[num_threads+i], &args[num_threads]);
+              args[num_threads+i].replica = i;
+          }
+          spread_replica_cpus(&args[num_threads], num_replicas);
+
+          // Init thread (and its replicas)
+          for(i=0; i<num_replicas; i++) {
+              print_thread_databufs("initing ", &args[num_threads+i]);
+
+              rv = hashpipe_thread_init(&args[num_threads+i], 1);
+
+              if (rv) {
+                  fprintf(stderr, "Error initializing thread for '%s'.\n",
+                      args[num_threads].thread_desc->name);
+                  exit(1);
+              }
+          }
 
-          // Setup for next thread
-          num_threads++;
-          input_buffer++;
-          output_buffer++;
+          // Setup for next thread.  Implicit numbering continues from the
+          // first output databuf of an explicitly wired thread.
+          if(wired && num_wired_outputs) {
+            input_buffer = wired_outputs[0];
+            output_buffer = input_buffer + 1;
+          } else if(!wired) {
+            input_buffer++;
+            output_buffer++;
+          }
+          wired = 0;
+          num_threads += num_replicas;
+          num_replicas = 1;
           hashpipe_thread_args_init(&args[num_threads]);
           args[num_threads].instance_id   = instance_id;
           args[num_threads].input_buffer  = input_buffer;
@@ -407,13 +1879,23 @@ int main(int argc, char *argv[])
           hashpipe_status_detach(&st);
           break;
 
-        case 'm': // CPU mask
-          args[num_threads].cpu_mask = strtoul(optarg, NULL, 0);
+        case 'm': // CPU mask (up to 64 CPUs)
+          {
+            unsigned long long mask = strtoull(optarg, NULL, 0);
+            CPU_ZERO(&args[num_threads].cpu_set);
+            for(i=0; i<64; i++) {
+              if(mask & (1ULL<<i)) {
+                CPU_SET(i, &args[num_threads].cpu_set);
+              }
+            }
+          }
           break;
 
-        case 'c': // CPU number
-          i = strtol(optarg, NULL, 0);
-          args[num_threads].cpu_mask = (1<<i);
+        case 'c': // CPU list
+          if(hashpipe_parse_cpulist(optarg, &args[num_threads].cpu_set)) {
+            fprintf(stderr, "Invalid CPU list '%s'\n", optarg);
+            exit(1);
+          }
           break;
 
         case 'p': // Load plugin
@@ -449,8 +1931,202 @@ int main(int argc, char *argv[])
           break;
 
         case 'b': // Set buffer
-          // "-b B" jumps to input buffer B, output buffer B+1
-          // TODO
+          if((cp = strchr(optarg, ':'))) {
+            // "-b IN[,IN...]:OUT[,OUT...]" wires next thread explicitly
+            *cp++ = '\0';
+            num_wired_inputs = parse_databuf_list(optarg, wired_inputs);
+            num_wired_outputs = parse_databuf_list(cp, wired_outputs);
+            if(num_wired_inputs < 0 || num_wired_outputs < 0) {
+              fprintf(stderr, "Invalid databuf list '%s:%s' (ids must be "
+                  "0 to %d, at most %d per list)\n", optarg, cp,
+                  HASHPIPE_MAX_DATABUFS, HASHPIPE_MAX_THREAD_DATABUFS);
+              exit(1);
+            }
+            wired = 1;
+          } else {
+            // "-b B" jumps to input buffer B, output buffer B+1
+            input_buffer = strtol(optarg, &cp, 0);
+            if(*cp || input_buffer < 0
+            || input_buffer >= HASHPIPE_MAX_DATABUFS) {
+              fprintf(stderr, "Invalid databuf '%s' (must be 0 to %d)\n",
+                  optarg, HASHPIPE_MAX_DATABUFS-1);
+              exit(1);
+            }
+            output_buffer = input_buffer + 1;
+            args[num_threads].input_buffer  = input_buffer;
+            args[num_threads].output_buffer = output_buffer;
+            wired = 0;
+          }
+          break;
+
+        case 'n': // Number of replicas of next thread
+          num_replicas = strtol(optarg, NULL, 0);
+          if(num_replicas < 1 || num_replicas >= MAX_HASHPIPE_THREADS) {
+            fprintf(stderr, "Invalid number of replicas '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_HISTORY: // Comma separated list of status keys to record
+          for(cp=strtok(optarg, ","); cp; cp=strtok(NULL, ",")) {
+            if(num_history_keys == HASHPIPE_HISTORY_MAX_KEYS) {
+              fprintf(stderr, "Too many history keys (max %d)\n",
+                  HASHPIPE_HISTORY_MAX_KEYS);
+              exit(1);
+            }
+            history_keys[num_history_keys++] = cp;
+          }
+          break;
+
+        case OPT_HISTORY_INTERVAL:
+          history_interval = strtod(optarg, NULL);
+          if(history_interval <= 0) {
+            fprintf(stderr, "Invalid history interval '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_HISTORY_SAMPLES:
+          history_samples = strtoul(optarg, NULL, 0);
+          break;
+
+        case OPT_METRICS:
+          metrics_args.addr = optarg;
+          break;
+
+        case OPT_SCHED:
+          if(parse_sched(optarg, &args[num_threads])) {
+            fprintf(stderr, "Invalid scheduling spec '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_NICE:
+          args[num_threads].nice = strtol(optarg, NULL, 0);
+          args[num_threads].set_nice = 1;
+          break;
+
+        case OPT_CONFIG:
+          // Only reached for abbreviations (e.g. --conf=FILE), since
+          // --config is expanded before parsing options
+          fprintf(stderr, "Option --config must not be abbreviated\n");
+          exit(1);
+          break;
+
+        case OPT_DRAIN:
+          drain_timeout = optarg ? strtod(optarg, NULL) : DEFAULT_DRAIN_TIMEOUT;
+          if(drain_timeout <= 0) {
+            fprintf(stderr, "Invalid drain timeout '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_WATCHDOG:
+          watchdog_args.stall_time = optarg ? strtod(optarg, NULL)
+                                            : DEFAULT_STALL_TIME;
+          if(watchdog_args.stall_time <= 0) {
+            fprintf(stderr, "Invalid watchdog stall time '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_WATCHDOG_LOG:
+          watchdog_args.log = 1;
+          if(watchdog_args.stall_time == 0) {
+            watchdog_args.stall_time = DEFAULT_STALL_TIME;
+          }
+          break;
+
+        case OPT_THREAD_STATS:
+          stats_args.interval = optarg ? strtod(optarg, NULL)
+                                       : DEFAULT_STATS_INTERVAL;
+          if(stats_args.interval <= 0) {
+            fprintf(stderr, "Invalid thread stats interval '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_LATENCY:
+          latency_args.interval = optarg ? strtod(optarg, NULL)
+                                         : DEFAULT_LATENCY_INTERVAL;
+          if(latency_args.interval <= 0) {
+            fprintf(stderr, "Invalid latency interval '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_TRACE:
+          trace_records = optarg ? strtol(optarg, NULL, 0)
+                                 : HASHPIPE_TRACE_DEFAULT_RECORDS;
+          if(trace_records <= 0) {
+            fprintf(stderr, "Invalid number of trace records '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_FORK:
+          // Threads given before the first --fork form a group of their own
+          if(num_groups == 0 && num_threads > 0) {
+            add_group(groups, &num_groups, 0);
+          }
+          // Start a new group unless the current one is still empty
+          if(num_groups == 0 || groups[num_groups-1].first < num_threads) {
+            add_group(groups, &num_groups, num_threads);
+          }
+          break;
+
+        case OPT_HOT_RESTART:
+          hot_restart = 1;
+          break;
+
+        case OPT_OVERFLOW:
+          if(parse_overflow(optarg, overflow)) {
+            fprintf(stderr, "Invalid overflow spec '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_STOP_TIMEOUT:
+          stop_timeout = strtod(optarg, NULL);
+          if(stop_timeout < 0) {
+            fprintf(stderr, "Invalid stop timeout '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_START_TIMEOUT:
+          start_timeout = strtod(optarg, NULL);
+          if(start_timeout <= 0) {
+            fprintf(stderr, "Invalid start timeout '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_PARALLEL_START:
+          parallel_start = 1;
+          break;
+
+        case OPT_STATUS_SHARDS:
+          status_shard_interval = optarg ? strtod(optarg, NULL)
+                                         : HASHPIPE_STATUS_SHARD_SYNC_INTERVAL;
+          if(status_shard_interval <= 0) {
+            fprintf(stderr, "Invalid status shard interval '%s'\n", optarg);
+            exit(1);
+          }
+          break;
+
+        case OPT_STATUS_SIZE:
+          // Create status buffer for current instance_id value with at least
+          // the requested size.  An existing status buffer can only be grown
+          // if nothing else is attached to it.
+          if (hashpipe_status_create(instance_id, &st,
+                strtoul(optarg, NULL, 0)) != HASHPIPE_OK) {
+            fprintf(stderr,
+                "Error creating status buffer instance %d of size %s.\n",
+                instance_id, optarg);
+            exit(1);
+          }
+          hashpipe_status_detach(&st);
           break;
 
         case '?': // Command line parsing error
@@ -460,6 +2136,17 @@ int main(int argc, char *argv[])
       }
     }
 
+    // Raise resource limits as needed for the requested real-time priorities
+    // and nice levels while we (may) still have the privileges to do so
+    for(i=0; i<num_threads; i++) {
+      if(args[i].sched_policy == SCHED_FIFO || args[i].sched_policy == SCHED_RR) {
+        raise_rlimit(RLIMIT_RTPRIO, args[i].sched_priority);
+      }
+      if(args[i].set_nice && args[i].nice < 0) {
+        raise_rlimit(RLIMIT_NICE, 20 - args[i].nice);
+      }
+    }
+
     // Drop setuid privileges permanently
     setuid(getuid());
 
@@ -470,6 +2157,24 @@ int main(int argc, char *argv[])
       return 1;
     }
 
+    // Make sure databufs are wired up sensibly
+    if(validate_databufs(args, num_threads)) {
+      exit(1);
+    }
+
+    // Apply databuf overflow policies before any blocks are filled
+    if(set_overflow_policies(args, num_threads, overflow)) {
+      exit(1);
+    }
+
+    // Drop any empty group left by a trailing --fork and find end of groups
+    if(num_groups && groups[num_groups-1].first == num_threads) {
+      num_groups--;
+    }
+    for(i=0; i<num_groups; i++) {
+      groups[i].end = i+1 < num_groups ? groups[i+1].first : num_threads;
+    }
+
     setvbuf(stdout, NULL, _IOLBF, 0);
     setvbuf(stderr, NULL, _IONBF, 0);
 
@@ -477,17 +2182,129 @@ int main(int argc, char *argv[])
     fprintf(stderr, "sed '\n");
 #endif
 
-    // Catch INT and TERM signals
+    // Catch INT and TERM signals (after setting up the run threads flag and
+    // stop notification, which the handler uses)
+    set_run_threads();
+    if(drain_timeout > 0) {
+      drain_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if(drain_fd == -1) {
+        perror("eventfd");
+        exit(1);
+      }
+    }
     signal(SIGINT, cc);
     signal(SIGTERM, cc);
-    set_run_threads();
 
-    // Start threads in reverse order
-    for(i=num_threads-1; i >= 0; i--) {
+    // Create status history buffer, if requested
+    if(num_history_keys
+    && hashpipe_history_create(instance_id, &history,
+          (const char **)history_keys, num_history_keys,
+          history_interval, history_samples) != HASHPIPE_OK) {
+      fprintf(stderr, "Error creating status history buffer.\n");
+      exit(1);
+    }
+
+    // Enable block latency tracing (before any blocks are filled), if
+    // requested
+    if(latency_args.interval > 0
+    && hashpipe_latency_enable(instance_id) != HASHPIPE_OK) {
+      fprintf(stderr, "Error creating block latency segment.\n");
+      exit(1);
+    }
+
+    // Enable event tracing, if requested.  Each thread gets a ring of its
+    // own, which it keeps when it (or its group process) is restarted.
+    if(trace_records > 0) {
+      if(hashpipe_trace_enable(instance_id, num_threads, trace_records)
+          != HASHPIPE_OK) {
+        fprintf(stderr, "Error creating event trace segment.\n");
+        exit(1);
+      }
+      for(i=0; i<num_threads; i++) {
+        args[i].trace_ring = i;
+      }
+    }
+
+    // Start groups of threads in processes of their own, if requested, before
+    // any other threads exist.  Group processes continue below with the
+    // threads of their group.
+    if(num_groups) {
+      if(share_resume_positions(instance_id, args, num_threads)) {
+        fprintf(stderr, "Error creating thread resume segment.\n");
+        exit(1);
+      }
+      group = start_groups(args, groups, num_groups, &start_failed);
+    }
+
+    if(group < 0) {
+      // Start status history thread, if requested
+      if(num_history_keys) {
+        rv = pthread_create(&history_thread, NULL,
+            hashpipe_history_thread_run, (void *)&history);
+        if (rv) {
+            fprintf(stderr, "Error creating status history thread.\n");
+            exit(1);
+        }
+      }
+
+      // Start latency summary thread, if requested
+      if(latency_args.interval > 0) {
+        latency_args.instance_id = instance_id;
+        rv = pthread_create(&latency_thread, NULL,
+            hashpipe_latency_thread_run, (void *)&latency_args);
+        if (rv) {
+            fprintf(stderr, "Error creating block latency thread.\n");
+            exit(1);
+        }
+      }
+
+      // Start metrics exporter thread, if requested
+      if(metrics_args.addr) {
+        metrics_args.instance_id = instance_id;
+        rv = pthread_create(&metrics_thread, NULL,
+            hashpipe_metrics_thread_run, (void *)&metrics_args);
+        if (rv) {
+            fprintf(stderr, "Error creating metrics exporter thread.\n");
+            exit(1);
+        }
+      }
+
+      // Supervise group processes.  Restarted group processes continue below
+      // with the threads of their group, while the launcher skips ahead to
+      // stopping its framework threads once the group processes have exited.
+      if(num_groups) {
+        group = supervise_groups(args, groups, num_groups, stop_timeout,
+            start_failed);
+        if(group < 0) {
+          goto groups_done;
+        }
+      }
+    }
+    if(group >= 0) {
+      group_start = groups[group].first;
+      num_threads = groups[group].end;
+    }
+
+    // Start status shard merge thread, if requested.  Shards are private to
+    // a process, so each group process merges the shards of its own threads.
+    if(status_shard_interval > 0) {
+      rv = pthread_create(&shard_thread, NULL,
+          hashpipe_shard_thread_run, (void *)&status_shard_interval);
+      if (rv) {
+          fprintf(stderr, "Error creating status shard merge thread.\n");
+          exit(1);
+      }
+    }
+
+    // Start threads in reverse order.  Unless starting in parallel, each
+    // thread must become ready (i.e. attach to its buffers) before the thread
+    // upstream of it is started.
+    for(first_started=num_threads; first_started > group_start;
+        first_started--) {
+      i = first_started - 1;
 
       // Launch thread
-      printf("starting thread '%s' with databufs %d and %d\n",
-          args[i].thread_desc->name, args[i].input_buffer, args[i].output_buffer);
+      print_thread_databufs("starting", &args[i]);
       rv = pthread_create(&threads[i], NULL,
           hashpipe_thread_run, (void *)&args[i]);
 
@@ -496,29 +2313,144 @@ int main(int argc, char *argv[])
               args[i].thread_desc->name);
           exit(1);
       }
+      joinable[i] = 1;
+
+      if(!parallel_start && !wait_thread_ready(&args[i], start_timeout)) {
+        start_failed = 1;
+        first_started--;
+        break;
+      }
+    }
+
+    if(parallel_start) {
+      for(i=num_threads-1; i>=group_start; i--) {
+        if(!wait_thread_ready(&args[i], start_timeout)) {
+          start_failed = 1;
+        }
+      }
+    }
+
+    if(start_failed) {
+      fprintf(stderr, "Pipeline startup failed, shutting down.\n");
+      clear_run_threads();
+    } else if(group_ready_fd != -1) {
+      // Let launcher know that our group is ready
+      if(write(group_ready_fd, "", 1) != 1) {
+        perror("write");
+      }
+    }
+    if(group_ready_fd != -1) {
+      close(group_ready_fd);
+    }
+
+    // Start stall watchdog thread, if requested
+    if(watchdog_args.stall_time > 0) {
+      watchdog_args.instance_id = instance_id;
+      watchdog_args.args = &args[first_started];
+      watchdog_args.num_threads = num_threads - first_started;
+      rv = pthread_create(&watchdog_thread, NULL,
+          hashpipe_watchdog_thread_run, (void *)&watchdog_args);
+      if (rv) {
+          fprintf(stderr, "Error creating watchdog thread.\n");
+          exit(1);
+      }
+    }
 
-      sleep(3);
+    // Start thread statistics thread, if requested
+    if(stats_args.interval > 0) {
+      stats_args.instance_id = instance_id;
+      stats_args.args = &args[first_started];
+      stats_args.num_threads = num_threads - first_started;
+      rv = pthread_create(&stats_thread, NULL,
+          hashpipe_stats_thread_run, (void *)&stats_args);
+      if (rv) {
+          fprintf(stderr, "Error creating thread stats thread.\n");
+          exit(1);
+      }
     }
 
-    /* Wait for SIGINT (i.e. control-c) or SIGTERM (aka "kill <pid>") */
-    while (run_threads()) {
-        sleep(1);
+    /* Wait for SIGINT (i.e. control-c) or SIGTERM (aka "kill <pid>"), or for
+     * any thread to exit */
+    if(hot_restart) {
+      wait_hot_restart(args, threads, joinable, first_started, num_threads,
+          num_groups ? groups[num_groups-1].end : num_threads,
+          stop_timeout, start_timeout);
+    } else {
+      wait_stop_request(drain_fd);
     }
 
-    for(i=num_threads-1; i>=0; i--) {
-      pthread_cancel(threads[i]);
+    // Drain pipeline if that is how it is being stopped
+    if(run_threads()) {
+      drain_pipeline(args, first_started, num_threads);
     }
-    for(i=num_threads-1; i>=0; i--) {
-      pthread_kill(threads[i], SIGINT);
+    clear_run_threads();
+
+    // Threads stop on their own once they see that run_threads() is false.
+    // Only threads that have not stopped by the stop timeout are cancelled.
+    stop_deadline = monotonic_time() + stop_timeout;
+    for(i=num_threads-1; i>=first_started; i--) {
+      timeout = stop_deadline - monotonic_time();
+      if(!hashpipe_thread_finished(&args[i], timeout > 0 ? timeout : 0)) {
+        fprintf(stderr, "Thread '%s' did not stop within %g seconds, "
+            "cancelling it.\n", args[i].thread_desc->name, stop_timeout);
+        pthread_cancel(threads[i]);
+        // Interrupt any blocking system call
+        pthread_kill(threads[i], SIGINT);
+      }
     }
-    for(i=num_threads-1; i>=0; i--) {
-      pthread_join(threads[i], NULL);
+    for(i=num_threads-1; i>=first_started; i--) {
+      // Threads that failed to restart were joined already
+      if(!joinable[i]) {
+        continue;
+      }
+      pthread_join(threads[i], &thread_rv);
+      if(thread_rv == THREAD_ERROR) {
+        thread_failed = 1;
+      }
       printf("Joined thread '%s'\n", args[i].thread_desc->name);
       fflush(stdout);
     }
+    // Watchdog and stats threads use thread args, so join them before
+    // destroying the args
+    if(watchdog_args.stall_time > 0) {
+      pthread_join(watchdog_thread, NULL);
+    }
+    if(stats_args.interval > 0) {
+      pthread_join(stats_thread, NULL);
+    }
+    if(status_shard_interval > 0) {
+      pthread_join(shard_thread, NULL);
+    }
+
+groups_done:
     for(i=num_threads; i>=0; i--) {
       hashpipe_thread_args_destroy(&args[i]);
     }
 
-    exit(0);
+    // Group processes have no launcher framework threads to stop
+    if(group >= 0) {
+      exit(start_failed ? GROUP_EXIT_START_FAILED
+          : thread_failed ? GROUP_EXIT_THREAD_ERROR : 0);
+    }
+
+    // Resume positions are of no use once all group processes have exited
+    if(num_groups) {
+      hashpipe_auxshm_delete(instance_id, HASHPIPE_AUXSHM_RESUME);
+    }
+
+    if(metrics_args.addr) {
+      pthread_join(metrics_thread, NULL);
+    }
+
+    if(latency_args.interval > 0) {
+      pthread_join(latency_thread, NULL);
+    }
+
+
+    if(num_history_keys) {
+      pthread_join(history_thread, NULL);
+      hashpipe_history_detach(&history);
+    }
+
+    exit(start_failed ? 1 : 0);
 }
@@ -2,6 +2,9 @@
 #define _HASHPIPE_H
 
 #include <stdio.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
 
 #include "hashpipe_error.h"
 #include "hashpipe_databuf.h"
@@ -72,6 +75,7 @@ typedef struct hashpipe_thread_desc hashpipe_thread_desc_t;
 //   run  - A pointer to the thread's run function
 //   ibuf - A structure describing the thread's input data buffer (if any)
 //   obuf - A structure describing the thread's output data buffer (if any)
+//   flags - HASHPIPE_THREAD_* capability flags (may be omitted)
 //
 // "name" is used to match command line thread spcifiers to thread metadata so
 // that the pipeline can be constructed as specified on the command line.
@@ -105,6 +109,16 @@ typedef struct hashpipe_thread_desc hashpipe_thread_desc_t;
 // The create function must have the following signature:
 //
 //   hashpipe_databuf_t * my_create_function(int instance_id, int databuf_id)
+//
+// "flags" is a bitwise OR of the following capabilities:
+//
+//   HASHPIPE_THREAD_REPLICABLE - The run function iterates over blocks with
+//                                hashpipe_thread_first_block() and
+//                                hashpipe_thread_next_block() (as
+//                                hashpipe_stage_run() does), so the thread
+//                                can be run as a worker pool (-n option)
+//                                and restarted with --hot-restart (it then
+//                                resumes after the last blocks it released).
 
 // These typedefs are used to declare pointers to a pipeline thread's init and
 // run functions.
@@ -129,24 +143,82 @@ struct hashpipe_thread_desc {
   runfunc_t run;
   databuf_desc_t ibuf_desc;
   databuf_desc_t obuf_desc;
+  int flags;
 };
 
+// Capability flags of hashpipe_thread_desc (see above)
+#define HASHPIPE_THREAD_REPLICABLE 0x1
+
+// Maximum number of input (or output) databufs of a single thread
+#define HASHPIPE_MAX_THREAD_DATABUFS 8
+
+// Last block a thread set free in each input databuf and set filled in each
+// output databuf (-1 if none)
+typedef struct {
+    int last_iblock[HASHPIPE_MAX_THREAD_DATABUFS];
+    int last_oblock[HASHPIPE_MAX_THREAD_DATABUFS];
+} hashpipe_thread_resume_t;
+
 // This structure passed (via a pointer) to the application's thread
 // initialization and run functions.  The `user_data` field can be used to pass
-// info from the init function to the run function.
+// info from the init function to the run function.  Threads wired to more
+// than one input (or output) databuf with the -b option find them in
+// `ibufs` (or `obufs`); `ibuf` and `obuf` (and `input_buffer` and
+// `output_buffer`) always refer to the first one.  Threads launched as a
+// worker pool with the -n option have `num_replicas` > 1 and a distinct
+// `replica` index (0 to `num_replicas`-1) in each replica's args.
 struct hashpipe_thread_args {
     hashpipe_thread_desc_t *thread_desc;
     int instance_id;
     int input_buffer;
     int output_buffer;
-    unsigned int cpu_mask; // 0 means use inherited
+    cpu_set_t cpu_set; // Empty set means use inherited
+    int sched_policy;   // SCHED_* policy, -1 means use inherited
+    int sched_priority; // Priority for SCHED_FIFO and SCHED_RR
+    int nice;           // Nice level, only used if set_nice is non-zero
+    int set_nice;
     int finished;
+    int ready; // Set once thread is attached to its buffers
     pthread_cond_t finished_c;
     pthread_mutex_t finished_m;
     hashpipe_status_t st;
     hashpipe_databuf_t *ibuf;
     hashpipe_databuf_t *obuf;
     void *user_data;
+    int num_inputs;
+    int num_outputs;
+    int input_buffers[HASHPIPE_MAX_THREAD_DATABUFS];
+    int output_buffers[HASHPIPE_MAX_THREAD_DATABUFS];
+    hashpipe_databuf_t *ibufs[HASHPIPE_MAX_THREAD_DATABUFS];
+    hashpipe_databuf_t *obufs[HASHPIPE_MAX_THREAD_DATABUFS];
+    int replica;
+    int num_replicas;
+    int run; // Cleared to stop this thread only (see run_threads())
+    // Progress tracking, updated by the databuf functions that the thread
+    // calls (see hashpipe_databuf.h)
+    uint64_t progress; // Number of blocks set filled or free
+    int wait_semid;    // semid of databuf being waited on, -1 if none
+    int wait_block;    // Block being waited on
+    int wait_filled;   // Non-zero if waiting for filled, zero for free
+    pid_t tid;             // Linux thread id, set when thread starts
+    clockid_t cpu_clock;   // CPU time clock of thread, set when it starts
+    int trace_ring;        // Event trace ring of thread (see hashpipe_trace.h)
+    // Time (in nanoseconds) spent waiting in databuf functions, accumulated
+    // by them: wait_ns[0] for free (output) blocks, wait_ns[1] for filled
+    // (input) blocks
+    uint64_t wait_ns[2];
+    uint64_t wait_start_ns; // CLOCK_MONOTONIC start of current wait, 0 if none
+    // Last block the thread set free in each input databuf and set filled in
+    // each output databuf (-1 if none), updated by the databuf functions.  A
+    // thread that is restarted resumes after these blocks (see
+    // hashpipe_thread_first_block()).
+    int last_iblock[HASHPIPE_MAX_THREAD_DATABUFS];
+    int last_oblock[HASHPIPE_MAX_THREAD_DATABUFS];
+    // Copy of last_iblock and last_oblock in shared memory (NULL if none),
+    // which outlives the thread's process, so that a thread of a restarted
+    // group process (see --fork) resumes where its predecessor left off.
+    // hashpipe_thread_first_block() prefers it to the arrays above.
+    hashpipe_thread_resume_t *shared_resume;
 };
 
 // Used to return OK status via return from run
@@ -156,9 +228,18 @@ struct hashpipe_thread_args {
 // Maximum number of threads that be defined by plugins
 #define MAX_HASHPIPE_THREADS 1024
 
-// Function threads use to determine whether to keep running.
+// Function threads use to determine whether to keep running.  It returns
+// false once all threads are asked to stop or, when the pipeline is being
+// drained, once the calling thread is asked to stop.
 int run_threads();
 
+// Returns a file descriptor that becomes (and stays) readable once threads
+// are asked to stop, or -1 if it could not be created.  Threads that block
+// in poll() or select() (e.g. waiting for network packets) can include it in
+// their set of file descriptors to notice stop requests immediately.  Do not
+// read from it.
+int hashpipe_stop_fd();
+
 // This function is used by pipeline plugins to register threads with the
 // pipeline executable.
 int register_hashpipe_thread(hashpipe_thread_desc_t * ptm);
@@ -174,10 +255,87 @@ hashpipe_thread_desc_t * find_hashpipe_thread(char *name);
 // List all known hashpipe threads to FILE f.
 void list_hashpipe_threads(FILE * f);
 
-// Get CPU affinity of calling thread
+// Get CPU affinity of calling thread as a mask of CPUs 0 to 31
 // Returns 0 on error
 unsigned int get_cpu_affinity();
 
+// Parse a Linux "cpulist" string (comma separated CPU numbers or ranges,
+// e.g. "0-3,64,66", where ranges may have a stride, e.g. "0-15:2") into
+// cpuset.  Returns 0 on success, -1 if list is invalid.
+int hashpipe_parse_cpulist(const char *list, cpu_set_t *cpuset);
+
+// Format cpuset as a cpulist string in buf (of size bytes).  Returns 0 on
+// success, -1 if buf is too small (the list is truncated).
+int hashpipe_format_cpulist(const cpu_set_t *cpuset, char *buf, size_t size);
+
+// Block iteration for threads that may be run as a worker pool (-n option).
+// Replica R of N handles blocks R, R+N, R+2N, ... of each of its databufs
+// (whose number of blocks the framework requires to be a multiple of N), so
+// each replica owns its blocks exclusively and blocks are filled and freed
+// in stream order without any further synchronization between replicas.
+// Threads that are not replicated (N = 1) simply iterate over all blocks.
+// When a thread is restarted (see the --hot-restart option),
+// hashpipe_thread_first_block() returns the block after the last one it
+// released in that databuf, so the thread continues where it left off.
+// Typical use in a run function:
+//
+//   int block = hashpipe_thread_first_block(args, db);
+//   while(run_threads()) {
+//       ... wait for/process/release block ...
+//       block = hashpipe_thread_next_block(args, db, block);
+//   }
+int hashpipe_thread_first_block(const hashpipe_thread_args_t *args,
+        const hashpipe_databuf_t *db);
+int hashpipe_thread_next_block(const hashpipe_thread_args_t *args,
+        const hashpipe_databuf_t *db, int block);
+
+// Standard pipeline thread loop.  hashpipe_stage_run() repeatedly waits for
+// the next filled block of the thread's (first) input databuf and the next
+// free block of its (first) output databuf, calls process with pointers to
+// (and indices of) the two blocks, and then marks the output block filled
+// and the input block free, until threads are asked to stop.  Threads
+// without an input (output) databuf get NULL for in (out).  Blocks are
+// iterated with hashpipe_thread_first_block() and hashpipe_thread_next_block()
+// so the stage can be run as a worker pool.  Output blocks are acquired with
+// hashpipe_databuf_acquire_free(), so the output databuf's overflow policy
+// applies: under drop-newest, input blocks are released unprocessed while
+// the output databuf is full (stages without input wait instead), and under
+// discard-unread, output continues at the block that policy returns.
+// process returns:
+//
+//   HASHPIPE_OK               output block produced, input block consumed
+//   HASHPIPE_STAGE_NO_OUTPUT  input block consumed, output block passed to
+//                             the next call again (e.g. when integrating)
+//   HASHPIPE_TIMEOUT          nothing consumed or produced (e.g. no packets
+//                             yet), both blocks passed to the next call again
+//   HASHPIPE_STAGE_DONE       stage is done (e.g. end of input file), blocks
+//                             are not released
+//   negative value            error, stage stops
+//
+// Once a second, the stage stores its state ("waiting" or "processing") in
+// its skey and, using keys made by hashpipe_thread_status_key(), its total
+// number of blocks processed (BLKS), blocks per second (BPS) and the mean and
+// maximum time (in microseconds) process took per block (PRUS and PRMX) over
+// the last second, not counting calls that returned HASHPIPE_TIMEOUT.  Time
+// spent waiting for blocks is accounted by the databuf functions (see
+// wait_ns in hashpipe_thread_args_t).  Returns THREAD_OK or THREAD_ERROR, so
+// a run function can simply return its result.
+#define HASHPIPE_STAGE_NO_OUTPUT 2
+#define HASHPIPE_STAGE_DONE      3
+
+typedef int (*hashpipe_stage_process_t)(hashpipe_thread_args_t *args,
+        char *in, int in_block, char *out, int out_block);
+
+void *hashpipe_stage_run(hashpipe_thread_args_t *args,
+        hashpipe_stage_process_t process);
+
+// Make status key for thread a from its skey (minus any "STAT" suffix, at
+// most 4 characters) or its name (if no skey) followed by suffix (at most 4
+// characters).  For replicas of a thread, the last character of the prefix
+// is the replica index.  key must have room for 9 characters.
+void hashpipe_thread_status_key(hashpipe_thread_args_t *a,
+        const char *suffix, char *key);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,226 @@
+/* hashpipe_auxshm.c
+ *
+ * Implementation of the auxiliary segment routines described in
+ * hashpipe_auxshm.h
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <errno.h>
+
+#include "hashpipe_ipckey.h"
+#include "hashpipe_auxshm.h"
+#include "hashpipe_error.h"
+
+// Kind of the directory segment itself
+#define AUXSHM_DIRECTORY 0xffffffff
+
+// Layout of the directory segment
+typedef struct {
+    hashpipe_auxshm_hdr_t hdr;
+    int shmid[HASHPIPE_AUXSHM_MAX_KINDS]; // shmid+1 of segments, 0 if none
+} auxshm_dir_t;
+
+// Returns 1 if the segment with id shmid is an auxiliary segment of kind,
+// otherwise 0.  shmids of deleted segments may have been reused by now.
+static int auxshm_check(int shmid, uint32_t kind)
+{
+    struct shmid_ds ds;
+    hashpipe_auxshm_hdr_t *h;
+    int ok;
+
+    if(shmctl(shmid, IPC_STAT, &ds) == -1
+    || ds.shm_segsz < sizeof(hashpipe_auxshm_hdr_t)) {
+        errno = 0;
+        return 0;
+    }
+    h = shmat(shmid, NULL, SHM_RDONLY);
+    if(h == (void *)-1) {
+        errno = 0;
+        return 0;
+    }
+    ok = h->magic == HASHPIPE_AUXSHM_MAGIC && h->kind == kind;
+    shmdt(h);
+    return ok;
+}
+
+static void auxshm_init(hashpipe_auxshm_hdr_t *h, uint32_t kind, size_t size)
+{
+    h->kind = kind;
+    h->pid = getpid();
+    h->size = size;
+    __atomic_store_n(&h->magic, HASHPIPE_AUXSHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+// Attach to the directory segment of instance_id, creating it if create is
+// non-zero.  Returns NULL if it does not exist (or on error, after logging
+// an error message).
+static auxshm_dir_t *auxshm_dir(int instance_id, int create)
+{
+    auxshm_dir_t *dir;
+    int shmid, created = 0;
+    key_t key = hashpipe_aux_key(instance_id & 0x3f);
+    if(key == HASHPIPE_KEY_ERROR || key == IPC_PRIVATE) {
+        hashpipe_error(__FUNCTION__, "hashpipe_aux_key error");
+        return NULL;
+    }
+
+    shmid = shmget(key, 0, 0666);
+    if(shmid == -1 && errno == ENOENT && create) {
+        shmid = shmget(key, sizeof(auxshm_dir_t), 0666 | IPC_CREAT | IPC_EXCL);
+        created = shmid != -1;
+    }
+    if(shmid == -1) {
+        if(errno != ENOENT) {
+            hashpipe_error(__FUNCTION__, "shmget error");
+        }
+        errno = 0;
+        return NULL;
+    }
+    if(!created && !auxshm_check(shmid, AUXSHM_DIRECTORY)) {
+        errno = 0;
+        hashpipe_error(__FUNCTION__, "key 0x%08x is used by a segment that "
+                "is not a hashpipe auxiliary segment directory", key);
+        return NULL;
+    }
+    dir = shmat(shmid, NULL, 0);
+    if(dir == (void *)-1) {
+        hashpipe_error(__FUNCTION__, "shmat error");
+        return NULL;
+    }
+    if(created) {
+        auxshm_init(&dir->hdr, AUXSHM_DIRECTORY, sizeof(auxshm_dir_t));
+    }
+    return dir;
+}
+
+// Returns shmid of the segment of kind listed in dir, or -1 if there is no
+// (valid) one
+static int auxshm_lookup(auxshm_dir_t *dir, int kind)
+{
+    int shmid = dir->shmid[kind] - 1;
+    if(shmid >= 0 && !auxshm_check(shmid, kind)) {
+        // Listed segment is gone (and its shmid perhaps reused)
+        dir->shmid[kind] = 0;
+        shmid = -1;
+    }
+    return shmid;
+}
+
+void *hashpipe_auxshm_create(int instance_id, int kind, size_t size)
+{
+    auxshm_dir_t *dir;
+    hashpipe_auxshm_hdr_t *h;
+    int shmid;
+
+    if(kind < 0 || kind >= HASHPIPE_AUXSHM_MAX_KINDS
+    || size < sizeof(hashpipe_auxshm_hdr_t)) {
+        hashpipe_error(__FUNCTION__, "invalid kind %d or size %zu", kind,
+                size);
+        return NULL;
+    }
+    if(!(dir = auxshm_dir(instance_id, 1))) {
+        return NULL;
+    }
+
+    // Replace any previous segment, which may have a different size
+    shmid = auxshm_lookup(dir, kind);
+    if(shmid >= 0 && shmctl(shmid, IPC_RMID, NULL) == -1) {
+        hashpipe_error(__FUNCTION__, "shmctl error");
+        shmdt(dir);
+        return NULL;
+    }
+    dir->shmid[kind] = 0;
+
+    shmid = shmget(IPC_PRIVATE, size, 0666 | IPC_CREAT);
+    if(shmid == -1) {
+        hashpipe_error(__FUNCTION__, "shmget error");
+        shmdt(dir);
+        return NULL;
+    }
+    h = shmat(shmid, NULL, 0);
+    if(h == (void *)-1) {
+        hashpipe_error(__FUNCTION__, "shmat error");
+        shmctl(shmid, IPC_RMID, NULL);
+        shmdt(dir);
+        return NULL;
+    }
+
+    // Newly created segments are zeroed
+    auxshm_init(h, kind, size);
+    dir->shmid[kind] = shmid + 1;
+    shmdt(dir);
+    return h;
+}
+
+void *hashpipe_auxshm_attach(int instance_id, int kind, int readonly)
+{
+    auxshm_dir_t *dir;
+    void *p;
+    int shmid;
+
+    if(kind < 0 || kind >= HASHPIPE_AUXSHM_MAX_KINDS
+    || !(dir = auxshm_dir(instance_id, 0))) {
+        return NULL;
+    }
+    shmid = auxshm_lookup(dir, kind);
+    shmdt(dir);
+    if(shmid < 0) {
+        return NULL;
+    }
+    p = shmat(shmid, NULL, readonly ? SHM_RDONLY : 0);
+    if(p == (void *)-1) {
+        hashpipe_error(__FUNCTION__, "shmat error");
+        return NULL;
+    }
+    return p;
+}
+
+int hashpipe_auxshm_detach(void *p)
+{
+    if(p && shmdt(p)) {
+        hashpipe_error(__FUNCTION__, "shmdt error");
+        return HASHPIPE_ERR_SYS;
+    }
+    return HASHPIPE_OK;
+}
+
+int hashpipe_auxshm_delete(int instance_id, int kind)
+{
+    auxshm_dir_t *dir;
+    int i, shmid, rv = HASHPIPE_OK;
+
+    if(kind < 0 || kind >= HASHPIPE_AUXSHM_MAX_KINDS) {
+        return HASHPIPE_ERR_PARAM;
+    }
+    if(!(dir = auxshm_dir(instance_id, 0))) {
+        return HASHPIPE_ERR_KEY;
+    }
+    shmid = auxshm_lookup(dir, kind);
+    if(shmid < 0) {
+        rv = HASHPIPE_ERR_KEY;
+    } else if(shmctl(shmid, IPC_RMID, NULL) == -1) {
+        hashpipe_error(__FUNCTION__, "shmctl error");
+        rv = HASHPIPE_ERR_SYS;
+    } else {
+        dir->shmid[kind] = 0;
+    }
+
+    // Remove directory once it is empty
+    for(i=0; i<HASHPIPE_AUXSHM_MAX_KINDS; i++) {
+        if(auxshm_lookup(dir, i) >= 0) {
+            break;
+        }
+    }
+    if(i == HASHPIPE_AUXSHM_MAX_KINDS) {
+        shmid = shmget(hashpipe_aux_key(instance_id & 0x3f), 0, 0666);
+        if(shmid != -1 && auxshm_check(shmid, AUXSHM_DIRECTORY)) {
+            shmctl(shmid, IPC_RMID, NULL);
+        }
+        errno = 0;
+    }
+    shmdt(dir);
+    return rv;
+}
@@ -0,0 +1,62 @@
+/* hashpipe_auxshm.h
+ *
+ * Auxiliary shared memory segments of a hashpipe instance (e.g. the block
+ * latency and event trace segments).  Auxiliary segments are created with
+ * IPC_PRIVATE and found through a small directory segment, whose key comes
+ * from the otherwise unused 00XXXXXX proj_id range (see hashpipe_aux_key()).
+ * Every segment, including the directory, starts with a hashpipe_auxshm_hdr_t
+ * whose magic and kind identify it, so hashpipe never clears or deletes a
+ * segment that it did not create.
+ */
+#ifndef _HASHPIPE_AUXSHM_H
+#define _HASHPIPE_AUXSHM_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define HASHPIPE_AUXSHM_MAGIC 0x4d48535855415048ULL // "HPAUXSHM"
+
+// Kinds of auxiliary segments
+#define HASHPIPE_AUXSHM_LATENCY   0 // Block latency (hashpipe_latency.h)
+#define HASHPIPE_AUXSHM_TRACE     1 // Event trace (hashpipe_trace.h)
+#define HASHPIPE_AUXSHM_RESUME    2 // Thread resume positions (hashpipe.c)
+#define HASHPIPE_AUXSHM_MAX_KINDS 8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Header at the start of every auxiliary segment */
+typedef struct {
+    uint64_t magic; /* HASHPIPE_AUXSHM_MAGIC */
+    uint32_t kind;  /* HASHPIPE_AUXSHM_* kind */
+    pid_t pid;      /* Process that created the segment */
+    uint64_t size;  /* Size of segment (bytes) */
+} hashpipe_auxshm_hdr_t;
+
+/* Create a segment of the given kind and size (in bytes, including the
+ * header) for instance_id, replacing any segment of that kind created
+ * earlier.  The segment is zeroed apart from its header.  Returns a pointer
+ * to the attached segment or NULL on error.
+ */
+void *hashpipe_auxshm_create(int instance_id, int kind, size_t size);
+
+/* Attach to the segment of the given kind for instance_id (read-only if
+ * readonly is non-zero).  Returns NULL if there is none.
+ */
+void *hashpipe_auxshm_attach(int instance_id, int kind, int readonly);
+
+/* Detach from segment */
+int hashpipe_auxshm_detach(void *p);
+
+/* Delete the segment of the given kind for instance_id (and the directory
+ * segment once it lists no segments).  Returns HASHPIPE_OK if deleted,
+ * HASHPIPE_ERR_KEY if there is none, HASHPIPE_ERR_SYS on error.
+ */
+int hashpipe_auxshm_delete(int instance_id, int kind);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _HASHPIPE_AUXSHM_H
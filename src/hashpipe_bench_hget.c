@@ -0,0 +1,167 @@
+/* hashpipe_bench_hget.c
+ *
+ * Microbenchmark for the status buffer keyword search routines in hget.c.
+ * For status buffers holding various numbers of keys, it checks that every
+ * SIMD level supported by the CPU gives the same results as the scalar code
+ * and reports the time per ksearch(), blsearch() and strnsrch() call at each
+ * level.
+ *
+ * Not built by default, use "make hashpipe_bench_hget" to build it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "fitshead.h"
+
+static const char *level_name[] = {"scalar", "sse4.2", "avx2"};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* Create a status-like buffer holding nkeys keys, with a blank line before
+ * every 10th key (for blsearch) and some lower case keys.
+ */
+static char *make_buffer(int nkeys, int *size)
+{
+    char *buf;
+    char key[16];
+    int i;
+
+    *size = ((2 * nkeys * 80 + 2879) / 2880) * 2880;
+    buf = malloc(*size + 1);
+    memset(buf, ' ', *size);
+    buf[*size] = '\0';
+    memcpy(buf, "END", 3);
+    hlength(buf, *size);
+
+    for(i=0; i<nkeys; i++) {
+        if(i % 10 == 9) {
+            hputs(buf, "BLANK", "");
+            memcpy(ksearch(buf, "BLANK"), "     ", 5);
+        }
+        sprintf(key, i % 7 == 6 ? "key%05d" : "KEY%05d", i);
+        hputi4(buf, key, i);
+    }
+    return buf;
+}
+
+/* Keywords to look up: every key (in both cases), some missing keys and
+ * some keys that are prefixes of existing keys.
+ */
+static int make_keys(int nkeys, char ***keys)
+{
+    int i, n = 0;
+
+    *keys = malloc((3 * nkeys + 2) * sizeof(char *));
+    for(i=0; i<nkeys; i++) {
+        (*keys)[n] = malloc(16);
+        sprintf((*keys)[n++], "KEY%05d", i);
+        (*keys)[n] = malloc(16);
+        sprintf((*keys)[n++], "key%05d", i);
+        if(i % 10 == 0) {
+            (*keys)[n] = malloc(16);
+            sprintf((*keys)[n++], "KEY%04d", i / 10);
+        }
+    }
+    (*keys)[n++] = strdup("MISSING");
+    (*keys)[n++] = strdup("END");
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, i, j, k, level, maxlevel, size, nkeys, rv = 0;
+    int nkeys_list[] = {100, 1000, 2000};
+    int reps = 0;
+    char *buf, **keys;
+    char **expect_k, **expect_b, **expect_s;
+    double t, tk, tb, ts;
+
+    while((opt = getopt(argc, argv, "r:h")) != -1) {
+        switch(opt) {
+        case 'r':
+            reps = strtol(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-r REPS]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    maxlevel = hsetsimd(-1);
+    printf("%6s %8s %14s %14s %14s\n",
+            "keys", "level", "ksearch_ns", "blsearch_ns", "strnsrch_ns");
+
+    for(i=0; i<3; i++) {
+        nkeys = nkeys_list[i];
+        buf = make_buffer(nkeys, &size);
+        k = make_keys(nkeys, &keys);
+        expect_k = malloc(k * sizeof(char *));
+        expect_b = malloc(k * sizeof(char *));
+        expect_s = malloc(k * sizeof(char *));
+
+        for(level=0; level<=maxlevel; level++) {
+            hsetsimd(level);
+
+            // Check results against scalar code
+            for(j=0; j<k; j++) {
+                if(level == 0) {
+                    expect_k[j] = ksearch(buf, keys[j]);
+                    expect_b[j] = blsearch(buf, keys[j]);
+                    expect_s[j] = strnsrch(buf, keys[j], size);
+                } else if(ksearch(buf, keys[j]) != expect_k[j]
+                       || blsearch(buf, keys[j]) != expect_b[j]
+                       || strnsrch(buf, keys[j], size) != expect_s[j]) {
+                    fprintf(stderr, "%s mismatch for key %s with %d keys\n",
+                            level_name[level], keys[j], nkeys);
+                    rv = 1;
+                }
+            }
+
+            // Time a pass over all keys, repeated to cover ~10M lines
+            int n = reps ? reps : 1 + 10000000 / ((long)k * nkeys);
+            t = now();
+            for(int r=0; r<n; r++) {
+                for(j=0; j<k; j++) {
+                    if(ksearch(buf, keys[j]) != expect_k[j]) rv = 1;
+                }
+            }
+            tk = (now() - t) / ((double)n * k);
+            t = now();
+            for(int r=0; r<n; r++) {
+                for(j=0; j<k; j++) {
+                    if(blsearch(buf, keys[j]) != expect_b[j]) rv = 1;
+                }
+            }
+            tb = (now() - t) / ((double)n * k);
+            t = now();
+            for(int r=0; r<n; r++) {
+                for(j=0; j<k; j++) {
+                    if(strnsrch(buf, keys[j], size) != expect_s[j]) rv = 1;
+                }
+            }
+            ts = (now() - t) / ((double)n * k);
+            printf("%6d %8s %14.1f %14.1f %14.1f\n", nkeys, level_name[level],
+                    tk * 1e9, tb * 1e9, ts * 1e9);
+        }
+
+        for(j=0; j<k; j++) {
+            free(keys[j]);
+        }
+        free(keys);
+        free(expect_k);
+        free(expect_b);
+        free(expect_s);
+        hlength(buf, -1);
+        free(buf);
+    }
+
+    return rv;
+}
@@ -110,6 +110,15 @@ int main(int argc, char *argv[]) {
     printf("  n_block=%d\n", db->n_block);
     printf("  shmid=%d\n", db->shmid);
     printf("  semid=%d\n", db->semid);
+    printf("  overflow_policy=%s\n",
+        db->overflow_policy == HASHPIPE_OVERFLOW_DROP ? "drop-newest"
+        : db->overflow_policy == HASHPIPE_OVERFLOW_FLUSH
+        ? "discard-unread" : "block");
+    printf("  dropped_blocks=%lu\n", db->drops.blocks);
+    if(db->drops.blocks) {
+        printf("  last_dropped_seq=%lu-%lu\n",
+            db->drops.first_seq, db->drops.last_seq);
+    }
 
     exit(0);
 }
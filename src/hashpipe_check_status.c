@@ -4,11 +4,15 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
 #include <getopt.h>
 
 #include "fitshead.h"
 #include "hashpipe_error.h"
 #include "hashpipe_status.h"
+#include "hashpipe_history.h"
 
 static void usage() { 
     printf(
@@ -17,9 +21,15 @@ static void usage() {
         "  -h,     --help         Show this message\n"
         "  -I N,   --instance=N   Specify hashpipe instance [0]\n"
         "  -v,     --verbose      Be verbose [false]\n"
+        "  -L,     --lockstats    Show status lock holder and statistics\n"
         "Query options:\n"
         "  -Q KEY, --query=KEY    Query string value of KEY\n"
         "  -g KEY, --get=KEY      Query double value of KEY\n"
+        "  -w KEY, --wait=KEY     Wait for KEY to change, then print it\n"
+        "                         (may be given multiple times)\n"
+        "History options:\n"
+        "  -H KEY, --history=KEY  Dump recorded history of KEY ('*' for all)\n"
+        "  -F,     --follow       Keep printing new history records\n"
         "Update options:\n"
         "  -k KEY, --key=KEY      Specify KEY to be updated\n"
         "  -s VAL, --string=VAL   Update key with string value VAL\n"
@@ -54,6 +64,62 @@ static hashpipe_status_t *get_status_buffer(int instance_id)
     return &s;
 }
 
+static void print_history_record(const hashpipe_history_header_t *hdr,
+        const hashpipe_history_record_t *rec, void *data)
+{
+    const char *key = (const char *)data;
+    char timestamp[64];
+    time_t sec = rec->time_ns / 1000000000;
+    struct tm tm;
+
+    if (strcmp(key, "*") && strcmp(key, hdr->keys[rec->key_idx])) {
+        return;
+    }
+    localtime_r(&sec, &tm);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%03lu %-8s %s\n", timestamp,
+        (rec->time_ns / 1000000) % 1000, hdr->keys[rec->key_idx],
+        (rec->flags & HASHPIPE_HISTORY_ABSENT) ? "(absent)" : rec->value);
+}
+
+static void dump_history(int instance_id, char *key, int follow)
+{
+    hashpipe_history_t h;
+    uint64_t next;
+
+    if (hashpipe_history_attach(instance_id, &h) != HASHPIPE_OK) {
+        fprintf(stderr, "No status history for instance %d.\n", instance_id);
+        exit(1);
+    }
+    next = hashpipe_history_read(&h, 0, print_history_record, key);
+    while (follow) {
+        fflush(stdout);
+        usleep(h.hdr->interval * 1e6);
+        next = hashpipe_history_read(&h, next, print_history_record, key);
+    }
+    hashpipe_history_detach(&h);
+}
+
+static void print_lock_stats(hashpipe_status_t *s)
+{
+    hashpipe_status_lockinfo_t li;
+
+    hashpipe_status_lock_stats(s, &li);
+    printf("holder_pid      %d\n", li.holder_pid);
+    printf("holder_tid      %d\n", li.holder_tid);
+    printf("lock_count      %lu\n", li.lock_count);
+    printf("contended_count %lu\n", li.contended_count);
+    printf("recovered_count %lu\n", li.recovered_count);
+    printf("wait_total_us   %.3f\n", li.wait_ns_total / 1e3);
+    printf("wait_max_us     %.3f\n", li.wait_ns_max / 1e3);
+    printf("wait_mean_us    %.3f\n", li.contended_count ?
+        li.wait_ns_total / 1e3 / li.contended_count : 0.0);
+    printf("hold_total_us   %.3f\n", li.hold_ns_total / 1e3);
+    printf("hold_max_us     %.3f\n", li.hold_ns_max / 1e3);
+    printf("hold_mean_us    %.3f\n", li.lock_count ?
+        li.hold_ns_total / 1e3 / li.lock_count : 0.0);
+}
+
 int main(int argc, char *argv[]) {
 
     int instance_id = 0;
@@ -69,10 +135,14 @@ int main(int argc, char *argv[]) {
         {"double", 1, NULL, 'd'},
         {"int",    1, NULL, 'i'},
         {"verbose",  0, NULL, 'v'},
+        {"lockstats", 0, NULL, 'L'},
         {"clear",  0, NULL, 'C'},
         {"del",    0, NULL, 'D'},
         {"query",  1, NULL, 'Q'},
         {"instance", 1, NULL, 'I'},
+        {"wait",   1, NULL, 'w'},
+        {"history", 1, NULL, 'H'},
+        {"follow", 0, NULL, 'F'},
         {0,0,0,0}
     };
     int opt,opti;
@@ -82,7 +152,13 @@ int main(int argc, char *argv[]) {
     double dbltmp;
     int inttmp;
     int verbose=0, clear=0;
-    while ((opt=getopt_long(argc,argv,"hk:g:s:f:d:i:vCDQ:I:",long_opts,&opti))!=-1) {
+    const char *wait_keys[HASHPIPE_STATUS_MAX_SUBSCRIBED_KEYS];
+    int num_wait_keys=0;
+    char *history_key=NULL;
+    int follow=0;
+    hashpipe_status_sub_t sub;
+    int i;
+    while ((opt=getopt_long(argc,argv,"hk:g:s:f:d:i:vLCDQ:I:w:H:F",long_opts,&opti))!=-1) {
         switch (opt) {
             case 'I':
                 instance_id = atoi(optarg);
@@ -94,7 +170,7 @@ int main(int argc, char *argv[]) {
                 s = get_status_buffer(instance_id);
                 hashpipe_status_lock(s);
                 hgets(s->buf, optarg, 80, value);
-                hashpipe_status_unlock(s);
+                hashpipe_status_unlock_read(s);
                 value[80] = '\0';
                 printf("%s\n", value);
                 break;
@@ -102,7 +178,7 @@ int main(int argc, char *argv[]) {
                 s = get_status_buffer(instance_id);
                 hashpipe_status_lock(s);
                 hgetr8(s->buf, optarg, &dbltmp);
-                hashpipe_status_unlock(s);
+                hashpipe_status_unlock_read(s);
                 printf("%g\n", dbltmp);
                 break;
             case 's':
@@ -148,12 +224,30 @@ int main(int argc, char *argv[]) {
                     hashpipe_status_unlock(s);
                 }
                 break;
+            case 'w':
+                if (num_wait_keys < HASHPIPE_STATUS_MAX_SUBSCRIBED_KEYS) {
+                    wait_keys[num_wait_keys++] = optarg;
+                } else {
+                    fprintf(stderr, "Too many keys to wait for, "
+                        "ignoring %s\n", optarg);
+                }
+                break;
+            case 'H':
+                history_key = optarg;
+                break;
+            case 'F':
+                follow=1;
+                break;
             case 'C':
                 clear=1;
                 break;
             case 'v':
                 verbose=1;
                 break;
+            case 'L':
+                s = get_status_buffer(instance_id);
+                print_lock_stats(s);
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -170,12 +264,34 @@ int main(int argc, char *argv[]) {
     /* If verbose, print out buffer */
     if (verbose) { 
         hashpipe_status_lock(s);
-        printf("%s\n", s->buf);
-        hashpipe_status_unlock(s);
+        printf("%.*s\n", (int)s->buf_size, s->buf);
+        hashpipe_status_unlock_read(s);
     }
 
     if (clear) 
         hashpipe_status_clear(s);
 
+    if (history_key)
+        dump_history(instance_id, history_key, follow);
+
+    /* Wait for any of the given keys to change */
+    if (num_wait_keys) {
+        hashpipe_status_subscribe(s, &sub, wait_keys, num_wait_keys);
+        if (hashpipe_status_wait_change(&sub, -1) != HASHPIPE_OK) {
+            fprintf(stderr, "Error waiting for status change.\n");
+            exit(1);
+        }
+        hashpipe_status_lock(s);
+        for (i=0; i<num_wait_keys; i++) {
+            if (sub.changed & (1U << i)) {
+                value[0] = '\0';
+                hgets(s->buf, wait_keys[i], 80, value);
+                value[80] = '\0';
+                printf("%s=%s\n", wait_keys[i], value);
+            }
+        }
+        hashpipe_status_unlock_read(s);
+    }
+
     exit(0);
 }
@@ -15,14 +15,19 @@
 #include "hashpipe_error.h"
 #include "hashpipe_status.h"
 #include "hashpipe_databuf.h"
+#include "hashpipe_history.h"
+#include "hashpipe_latency.h"
+#include "hashpipe_trace.h"
+#include "hashpipe_auxshm.h"
 
 void usage() {
     printf(
             "Usage: hashpipe_clean_shmem [options]\n"
             "\n"
-            "Clears status buffer and deletes data buffers for specified\n"
-            "Hashpipe instance.  If -d is given, deletes status buffer\n"
-            "instead of just clearing it.\n"
+            "Clears status buffer and deletes status history, block latency,\n"
+            "event trace, thread resume and data buffers for specified Hashpipe\n"
+            "instance.  If -d is given, deletes status buffer instead of just\n"
+            "clearing it.\n"
             "\n"
             "Options:\n"
             "  -I N, --instance=N    Instance number [0]\n"
@@ -114,10 +119,46 @@ int main(int argc, char *argv[]) {
       printf("Cleared status shared memory.\n");
     }
 
+    /* Status history shared mem */
+    rv = hashpipe_history_delete(instance_id);
+    if (rv==HASHPIPE_OK) {
+        printf("Deleted status history shared memory.\n");
+    } else if (rv!=HASHPIPE_ERR_KEY) {
+        fprintf(stderr, "Error deleting status history segment.\n");
+        ex|=1;
+    }
+
+    /* Block latency shared mem */
+    rv = hashpipe_latency_delete(instance_id);
+    if (rv==HASHPIPE_OK) {
+        printf("Deleted block latency shared memory.\n");
+    } else if (rv!=HASHPIPE_ERR_KEY) {
+        fprintf(stderr, "Error deleting block latency segment.\n");
+        ex|=1;
+    }
+
+    /* Event trace shared mem */
+    rv = hashpipe_trace_delete(instance_id);
+    if (rv==HASHPIPE_OK) {
+        printf("Deleted event trace shared memory.\n");
+    } else if (rv!=HASHPIPE_ERR_KEY) {
+        fprintf(stderr, "Error deleting event trace segment.\n");
+        ex|=1;
+    }
+
+    /* Thread resume shared mem (left behind if a launcher crashed) */
+    rv = hashpipe_auxshm_delete(instance_id, HASHPIPE_AUXSHM_RESUME);
+    if (rv==HASHPIPE_OK) {
+        printf("Deleted thread resume shared memory.\n");
+    } else if (rv!=HASHPIPE_ERR_KEY) {
+        fprintf(stderr, "Error deleting thread resume segment.\n");
+        ex|=1;
+    }
+
     /* Databuf shared mem */
     hashpipe_databuf_t *d=NULL;
     int i = 0;
-    for (i=1; i<=20; i++) {
+    for (i=1; i<=HASHPIPE_MAX_DATABUFS; i++) {
         d = hashpipe_databuf_attach(instance_id, i); // Repeat for however many needed ..
         if (d==NULL) continue;
         if (d->semid) { 
@@ -0,0 +1,244 @@
+/* hashpipe_config.c
+ *
+ * Translation of pipeline config files (see hashpipe_config.h) into
+ * command line arguments for the hashpipe executable.
+ */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "hashpipe_config.h"
+
+// Growable argument vector
+typedef struct {
+    int argc;
+    int size;
+    char **argv;
+} argvec_t;
+
+static void argvec_push(argvec_t *v, const char *arg)
+{
+    if(v->argc + 1 >= v->size) {
+        v->size = v->size ? 2 * v->size : 64;
+        v->argv = realloc(v->argv, v->size * sizeof(char *));
+        if(!v->argv) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    v->argv[v->argc++] = strdup(arg);
+    v->argv[v->argc] = NULL;
+}
+
+// Push "--name" or "--name=value"
+static void argvec_push_opt(argvec_t *v, const char *name, const char *value)
+{
+    char *arg;
+    if(asprintf(&arg, value ? "--%s=%s" : "--%s", name, value) < 0) {
+        perror("asprintf");
+        exit(1);
+    }
+    argvec_push(v, arg);
+    free(arg);
+}
+
+// Strip leading and trailing white space from s (in place)
+static char *strip(char *s)
+{
+    char *e;
+    while(isspace(*s)) {
+        s++;
+    }
+    for(e=s+strlen(s); e>s && isspace(e[-1]); e--);
+    *e = '\0';
+    return s;
+}
+
+// Returns 1 for true, 0 for false, -1 for neither
+static int parse_bool(const char *s)
+{
+    if(!strcasecmp(s, "true") || !strcasecmp(s, "yes")
+    || !strcasecmp(s, "on") || !strcmp(s, "1")) {
+        return 1;
+    }
+    if(!strcasecmp(s, "false") || !strcasecmp(s, "no")
+    || !strcasecmp(s, "off") || !strcmp(s, "0")) {
+        return 0;
+    }
+    return -1;
+}
+
+static const struct option *find_option(const struct option *long_opts,
+        const char *name)
+{
+    for(; long_opts->name; long_opts++) {
+        if(!strcmp(long_opts->name, name)) {
+            return long_opts;
+        }
+    }
+    return NULL;
+}
+
+// Options that make no sense in a config file
+static const char *excluded_opts[] = {"config", "help", "list", "version"};
+
+// Append arguments described by config file path to v.  Returns 0 on
+// success, -1 on error.
+static int config_load(const char *path, const struct option *long_opts,
+        argvec_t *v)
+{
+    FILE *f;
+    char *line = NULL;
+    size_t len = 0;
+    int lineno = 0;
+    int i, b, rv = 0;
+    char *p, *key, *value;
+    char *thread = NULL;
+    enum {GLOBAL, STATUS, THREAD} section = GLOBAL;
+    const struct option *opt;
+
+    if(!(f = fopen(path, "r"))) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+#define CONFIG_ERROR(...) do { \
+        fprintf(stderr, "%s:%d: ", path, lineno); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        rv = -1; \
+        goto done; \
+    } while(0)
+
+    while(getline(&line, &len, f) != -1) {
+        lineno++;
+        p = strip(line);
+        if(*p == '\0' || *p == '#' || *p == ';') {
+            continue;
+        }
+
+        if(*p == '[') {
+            // End of previous thread section
+            if(thread) {
+                argvec_push(v, thread);
+                free(thread);
+                thread = NULL;
+            }
+            if(p[strlen(p)-1] != ']') {
+                CONFIG_ERROR("missing ']' in section header");
+            }
+            p[strlen(p)-1] = '\0';
+            p = strip(p+1);
+            if(!strcmp(p, "global")) {
+                section = GLOBAL;
+            } else if(!strcmp(p, "status")) {
+                section = STATUS;
+            } else if(!strncmp(p, "thread", 6) && isspace(p[6])) {
+                section = THREAD;
+                thread = strdup(strip(p+6));
+            } else {
+                CONFIG_ERROR("unknown section '%s' (expected global, status "
+                        "or thread NAME)", p);
+            }
+            continue;
+        }
+
+        if(!(value = strchr(p, '='))) {
+            CONFIG_ERROR("expected KEY = VALUE");
+        }
+        *value++ = '\0';
+        key = strip(p);
+        value = strip(value);
+        if(*key == '\0') {
+            CONFIG_ERROR("missing key");
+        }
+
+        if(section == STATUS) {
+            if(asprintf(&p, "%s=%s", key, value) < 0) {
+                perror("asprintf");
+                exit(1);
+            }
+            argvec_push_opt(v, "option", p);
+            free(p);
+            continue;
+        }
+
+        for(i=0; i<sizeof(excluded_opts)/sizeof(excluded_opts[0]); i++) {
+            if(!strcmp(key, excluded_opts[i])) {
+                CONFIG_ERROR("option '%s' is not allowed in config files",
+                        key);
+            }
+        }
+        if(!(opt = find_option(long_opts, key))) {
+            CONFIG_ERROR("unknown option '%s'", key);
+        }
+        if(opt->has_arg == no_argument) {
+            if((b = parse_bool(value)) < 0) {
+                CONFIG_ERROR("option '%s' needs a boolean value", key);
+            }
+            if(b) {
+                argvec_push_opt(v, key, NULL);
+            }
+        } else if(*value == '\0' && opt->has_arg == optional_argument) {
+            argvec_push_opt(v, key, NULL);
+        } else if(*value == '\0') {
+            CONFIG_ERROR("option '%s' needs a value", key);
+        } else {
+            argvec_push_opt(v, key, value);
+        }
+    }
+
+    if(thread) {
+        argvec_push(v, thread);
+    }
+
+#undef CONFIG_ERROR
+
+done:
+    free(thread);
+    free(line);
+    fclose(f);
+    return rv;
+}
+
+int hashpipe_config_expand(int *argc, char ***argv,
+        const struct option *long_opts)
+{
+    argvec_t v = {0, 0, NULL};
+    const char *path;
+    int i, found = 0;
+
+    for(i=0; i<*argc; i++) {
+        if(i > 0 && !strcmp((*argv)[i], "--config")) {
+            if(++i == *argc) {
+                fprintf(stderr, "--config requires a file name\n");
+                return -1;
+            }
+            path = (*argv)[i];
+        } else if(i > 0 && !strncmp((*argv)[i], "--config=", 9)) {
+            path = (*argv)[i] + 9;
+        } else {
+            argvec_push(&v, (*argv)[i]);
+            continue;
+        }
+        if(config_load(path, long_opts, &v)) {
+            return -1;
+        }
+        found = 1;
+    }
+
+    if(found) {
+        *argc = v.argc;
+        *argv = v.argv;
+    } else {
+        for(i=0; i<v.argc; i++) {
+            free(v.argv[i]);
+        }
+        free(v.argv);
+    }
+    return 0;
+}
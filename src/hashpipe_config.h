@@ -0,0 +1,50 @@
+/* hashpipe_config.h
+ *
+ * Pipeline configuration files for the hashpipe executable.  A config file
+ * is an INI style description of the command line options of a pipeline:
+ *
+ *   # Comment lines start with '#' or ';'
+ *   [global]                ; options that precede all threads
+ *   instance = 3
+ *   plugin = my_plugin
+ *   status-size = 1048576
+ *
+ *   [status]                ; initial status keys (same as --option=K=V)
+ *   BINDHOST = eth4
+ *
+ *   [thread net_thread]     ; options for (and name of) a thread
+ *   cpu = 2
+ *   sched = fifo:10
+ *   buffer = :1
+ *
+ *   [thread xgpu_thread]
+ *   replicas = 4
+ *   buffer = 1:2
+ *
+ * Every key of the [global] and [thread NAME] sections is the name of a
+ * long command line option (without the leading "--"), and options are
+ * applied in the order they appear in the file, exactly as if they were
+ * given on the command line.  Options that take no argument (e.g.
+ * parallel-start) take a boolean value (true/false, yes/no, on/off or 1/0).
+ * As with threads given on the command line, threads are started in the
+ * reverse order of their sections (the last one first), so downstream
+ * threads are running before upstream threads feed them.
+ */
+#ifndef _HASHPIPE_CONFIG_H
+#define _HASHPIPE_CONFIG_H
+
+#include <getopt.h>
+
+/* Replace every "--config FILE" (or "--config=FILE") in the argc/argv
+ * command line with the command line arguments described by config file
+ * FILE.  long_opts is the list of long options that config file keys may
+ * name.  All config files are read and checked before returning, so errors
+ * are reported before the pipeline creates anything.  On success *argc and
+ * *argv are updated (the new argv is allocated with malloc and never freed)
+ * and 0 is returned.  On error, a message giving the file name and line
+ * number is printed on stderr and -1 is returned.
+ */
+int hashpipe_config_expand(int *argc, char ***argv,
+        const struct option *long_opts);
+
+#endif // _HASHPIPE_CONFIG_H
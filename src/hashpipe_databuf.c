@@ -19,6 +19,15 @@
 #include "hashpipe_status.h"
 #include "hashpipe_databuf.h"
 #include "hashpipe_error.h"
+#include "hashpipe_latency.h"
+#include "hashpipe_trace.h"
+#include "hashpipe_probes.h"
+#include "hashpipe.h"
+
+// Functions defined in hashpipe_thread.c, but not declared/exposed in public
+// hashpipe.h, that track the progress of the calling thread.
+void hashpipe_thread_note_progress(int semid, int block_id, int filled);
+void hashpipe_thread_note_wait(int semid, int block_id, int filled);
 
 /* union for semaphore ops. */
 union semun {
@@ -28,12 +37,34 @@ union semun {
     struct seminfo *__buf;
 };
 
+// Offset of the array of per-block sequence numbers (see
+// hashpipe_databuf_acquire_free()), which follows the last block.
+static size_t seq_offset(size_t header_size, size_t block_size, int n_block)
+{
+    return (header_size + block_size*n_block + 7) & ~(size_t)7;
+}
+
+static uint64_t *block_seq(hashpipe_databuf_t *d)
+{
+    return (uint64_t *)((char *)d
+            + seq_offset(d->header_size, d->block_size, d->n_block));
+}
+
+// Semaphore increment that marks a filled block as being read.  Readers of
+// databufs that may be flushed add 2 instead of 1 so that the writer only
+// frees filled blocks whose semaphore value is exactly 1.
+static int read_claim(hashpipe_databuf_t *d)
+{
+    return d->overflow_policy == HASHPIPE_OVERFLOW_FLUSH ? 2 : 1;
+}
+
 hashpipe_databuf_t *hashpipe_databuf_create(int instance_id,
         int databuf_id, size_t header_size, size_t block_size, int n_block)
 {
     int rv = 0;
     int verify_sizing = 0;
-    size_t total_size = header_size + block_size*n_block;
+    size_t total_size = seq_offset(header_size, block_size, n_block)
+        + n_block * sizeof(uint64_t);
 
     if(header_size < sizeof(hashpipe_databuf_t)) {
         hashpipe_error(__FUNCTION__, "header size must be larger than %lu",
@@ -126,6 +157,9 @@ hashpipe_databuf_t *hashpipe_databuf_create(int instance_id,
     }
     free(arg.array);
 
+    hashpipe_latency_register(d->semid, databuf_id);
+    HASHPIPE_PROBE4(databuf_create, instance_id, databuf_id, d, d->semid);
+
     return d;
 }
 
@@ -183,6 +217,9 @@ hashpipe_databuf_t *hashpipe_databuf_attach(int instance_id, int databuf_id)
         return NULL;
     }
 
+    hashpipe_latency_register(d->semid, databuf_id);
+    HASHPIPE_PROBE4(databuf_attach, instance_id, databuf_id, d, d->semid);
+
     return d;
 
 }
@@ -201,7 +238,7 @@ int hashpipe_databuf_total_status(hashpipe_databuf_t *d)
     memset(arg.array, 0, sizeof(unsigned short)*d->n_block);
     semctl(d->semid, 0, GETALL, arg);
     int i,tot=0;
-    for (i=0; i<d->n_block; i++) tot+=arg.array[i];
+    for (i=0; i<d->n_block; i++) tot+=(arg.array[i] != 0);
     free(arg.array);
     return tot;
 
@@ -238,7 +275,16 @@ int hashpipe_databuf_wait_free(hashpipe_databuf_t *d, int block_id)
     struct timespec timeout;
     timeout.tv_sec = 0;
     timeout.tv_nsec = 250000000;
+    hashpipe_thread_note_wait(d->semid, block_id, 0);
+    hashpipe_trace_event(HASHPIPE_TRACE_WAIT_FREE, HASHPIPE_TRACE_BEGIN,
+            d->semid, block_id);
+    HASHPIPE_PROBE3(databuf_wait_free, d, d->semid, block_id);
     rv = semtimedop(d->semid, &op, 1, &timeout);
+    hashpipe_trace_event(HASHPIPE_TRACE_WAIT_FREE, HASHPIPE_TRACE_END,
+            d->semid, block_id);
+    HASHPIPE_PROBE4(databuf_wait_free_return, d, d->semid, block_id, rv);
+    // Keep noting the wait if it timed out (it will usually be retried)
+    if (rv!=-1 || errno!=EAGAIN) hashpipe_thread_note_wait(-1, block_id, 0);
     if (rv==-1) {
         if (errno==EAGAIN) {
 #ifdef HASHPIPE_TRACE
@@ -266,9 +312,24 @@ int hashpipe_databuf_busywait_free(hashpipe_databuf_t *d, int block_id)
     //struct timespec timeout;
     //timeout.tv_sec = 0;
     //timeout.tv_nsec = 250000000;
+    hashpipe_thread_note_wait(d->semid, block_id, 0);
+    hashpipe_trace_event(HASHPIPE_TRACE_WAIT_FREE, HASHPIPE_TRACE_BEGIN,
+            d->semid, block_id);
+    HASHPIPE_PROBE3(databuf_wait_free, d, d->semid, block_id);
     do {
       rv = semop(d->semid, &op, 1);
+      // Give up if threads are asked to stop
+      if(rv == -1 && errno == EAGAIN && !run_threads()) {
+        hashpipe_trace_event(HASHPIPE_TRACE_WAIT_FREE, HASHPIPE_TRACE_END,
+                d->semid, block_id);
+        HASHPIPE_PROBE4(databuf_wait_free_return, d, d->semid, block_id, rv);
+        return HASHPIPE_TIMEOUT;
+      }
     } while(rv == -1 && errno == EAGAIN);
+    hashpipe_trace_event(HASHPIPE_TRACE_WAIT_FREE, HASHPIPE_TRACE_END,
+            d->semid, block_id);
+    HASHPIPE_PROBE4(databuf_wait_free_return, d, d->semid, block_id, rv);
+    hashpipe_thread_note_wait(-1, block_id, 0);
     if (rv==-1) { 
         // Don't complain on a signal interruption
         if (errno==EINTR) return HASHPIPE_ERR_SYS;
@@ -286,18 +347,28 @@ int hashpipe_databuf_wait_filled(hashpipe_databuf_t *d, int block_id)
      * Probably do this by giving an array of semops, since
      * (afaik) the whole array happens atomically:
      * step 1: wait for val=1 then decrement (semop=-1)
-     * step 2: increment by 1 (semop=1)
+     * step 2: increment by 1 (semop=1), or by 2 to claim the block
+     * if the writer may flush it (see read_claim()).
      */
     int rv;
     struct sembuf op[2];
     op[0].sem_num = op[1].sem_num = block_id;
     op[0].sem_flg = op[1].sem_flg = 0;
     op[0].sem_op = -1;
-    op[1].sem_op = 1;
+    op[1].sem_op = read_claim(d);
     struct timespec timeout;
     timeout.tv_sec = 0;
     timeout.tv_nsec = 250000000;
+    hashpipe_thread_note_wait(d->semid, block_id, 1);
+    hashpipe_trace_event(HASHPIPE_TRACE_WAIT_FILLED, HASHPIPE_TRACE_BEGIN,
+            d->semid, block_id);
+    HASHPIPE_PROBE3(databuf_wait_filled, d, d->semid, block_id);
     rv = semtimedop(d->semid, op, 2, &timeout);
+    hashpipe_trace_event(HASHPIPE_TRACE_WAIT_FILLED, HASHPIPE_TRACE_END,
+            d->semid, block_id);
+    HASHPIPE_PROBE4(databuf_wait_filled_return, d, d->semid, block_id, rv);
+    // Keep noting the wait if it timed out (it will usually be retried)
+    if (rv!=-1 || errno!=EAGAIN) hashpipe_thread_note_wait(-1, block_id, 1);
     if (rv==-1) {
         if (errno==EAGAIN) return HASHPIPE_TIMEOUT;
         // Don't complain on a signal interruption
@@ -306,6 +377,7 @@ int hashpipe_databuf_wait_filled(hashpipe_databuf_t *d, int block_id)
         perror("semop");
         return HASHPIPE_ERR_SYS;
     }
+    hashpipe_latency_consumed(d->semid, block_id);
     return 0;
 }
 
@@ -316,7 +388,8 @@ int hashpipe_databuf_busywait_filled(hashpipe_databuf_t *d, int block_id)
      * Probably do this by giving an array of semops, since
      * (afaik) the whole array happens atomically:
      * step 1: wait for val=1 then decrement (semop=-1)
-     * step 2: increment by 1 (semop=1)
+     * step 2: increment by 1 (semop=1), or by 2 to claim the block
+     * if the writer may flush it (see read_claim()).
      */
     int rv;
     struct sembuf op[2];
@@ -324,13 +397,28 @@ int hashpipe_databuf_busywait_filled(hashpipe_databuf_t *d, int block_id)
     op[0].sem_flg = IPC_NOWAIT;
     op[1].sem_flg = IPC_NOWAIT;
     op[0].sem_op = -1;
-    op[1].sem_op = 1;
+    op[1].sem_op = read_claim(d);
     //struct timespec timeout;
     //timeout.tv_sec = 0;
     //timeout.tv_nsec = 250000000;
+    hashpipe_thread_note_wait(d->semid, block_id, 1);
+    hashpipe_trace_event(HASHPIPE_TRACE_WAIT_FILLED, HASHPIPE_TRACE_BEGIN,
+            d->semid, block_id);
+    HASHPIPE_PROBE3(databuf_wait_filled, d, d->semid, block_id);
     do {
       rv = semop(d->semid, op, 2);
+      // Give up if threads are asked to stop
+      if(rv == -1 && errno == EAGAIN && !run_threads()) {
+        hashpipe_trace_event(HASHPIPE_TRACE_WAIT_FILLED, HASHPIPE_TRACE_END,
+                d->semid, block_id);
+        HASHPIPE_PROBE4(databuf_wait_filled_return, d, d->semid, block_id, rv);
+        return HASHPIPE_TIMEOUT;
+      }
     } while(rv == -1 && errno == EAGAIN);
+    hashpipe_trace_event(HASHPIPE_TRACE_WAIT_FILLED, HASHPIPE_TRACE_END,
+            d->semid, block_id);
+    HASHPIPE_PROBE4(databuf_wait_filled_return, d, d->semid, block_id, rv);
+    hashpipe_thread_note_wait(-1, block_id, 1);
     if (rv==-1) { 
         // Don't complain on a signal interruption
         if (errno==EINTR) return HASHPIPE_ERR_SYS;
@@ -338,6 +426,7 @@ int hashpipe_databuf_busywait_filled(hashpipe_databuf_t *d, int block_id)
         perror("semop");
         return HASHPIPE_ERR_SYS;
     }
+    hashpipe_latency_consumed(d->semid, block_id);
     return 0;
 }
 
@@ -350,6 +439,11 @@ int hashpipe_databuf_set_free(hashpipe_databuf_t *d, int block_id)
     int rv;
     union semun arg;
     arg.val = 0;
+    // Time stamp before the block can be reused
+    hashpipe_latency_released(d->semid, block_id);
+    hashpipe_trace_event(HASHPIPE_TRACE_SET_FREE, HASHPIPE_TRACE_INSTANT,
+            d->semid, block_id);
+    HASHPIPE_PROBE3(databuf_set_free, d, d->semid, block_id);
     rv = semctl(d->semid, block_id, SETVAL, arg);
 #ifdef HASHPIPE_TRACE
     printf("after %s(%p, %d) %016lx\n",
@@ -359,6 +453,7 @@ int hashpipe_databuf_set_free(hashpipe_databuf_t *d, int block_id)
         hashpipe_error(__FUNCTION__, "semctl error");
         return HASHPIPE_ERR_SYS;
     }
+    hashpipe_thread_note_progress(d->semid, block_id, 0);
     return 0;
 }
 
@@ -371,6 +466,11 @@ int hashpipe_databuf_set_filled(hashpipe_databuf_t *d, int block_id)
     int rv;
     union semun arg;
     arg.val = 1;
+    // Time stamp before the block can be consumed
+    hashpipe_latency_filled(d->semid, block_id);
+    hashpipe_trace_event(HASHPIPE_TRACE_SET_FILLED, HASHPIPE_TRACE_INSTANT,
+            d->semid, block_id);
+    HASHPIPE_PROBE3(databuf_set_filled, d, d->semid, block_id);
     rv = semctl(d->semid, block_id, SETVAL, arg);
 #ifdef HASHPIPE_TRACE
     printf("after %s(%p, %d) %016lx\n",
@@ -380,5 +480,99 @@ int hashpipe_databuf_set_filled(hashpipe_databuf_t *d, int block_id)
         hashpipe_error(__FUNCTION__, "semctl error");
         return HASHPIPE_ERR_SYS;
     }
+    hashpipe_thread_note_progress(d->semid, block_id, 1);
     return 0;
 }
+
+int hashpipe_databuf_set_overflow(hashpipe_databuf_t *d, int policy)
+{
+    if(policy < HASHPIPE_OVERFLOW_BLOCK
+    || policy > HASHPIPE_OVERFLOW_FLUSH) {
+        hashpipe_error(__FUNCTION__, "invalid overflow policy %d", policy);
+        return HASHPIPE_ERR_PARAM;
+    }
+    d->overflow_policy = policy;
+    return HASHPIPE_OK;
+}
+
+// Add a dropped block with sequence number seq to the databuf's counters
+static void note_drop(hashpipe_databuf_t *d, uint64_t seq)
+{
+    hashpipe_databuf_drops_t *g = &d->gap;
+
+    if(g->blocks == 0 || seq < g->first_seq) {
+        g->first_seq = seq;
+    }
+    if(g->blocks == 0 || seq > g->last_seq) {
+        g->last_seq = seq;
+    }
+    g->blocks++;
+    d->drops.first_seq = g->first_seq;
+    d->drops.last_seq = g->last_seq;
+    // Counters are read by other processes while the writer updates them
+    __atomic_fetch_add(&d->drops.blocks, 1, __ATOMIC_RELAXED);
+}
+
+// Free every filled block that is not being read, starting at block_id, and
+// count them as dropped.  Returns the first block at or after block_id that
+// is now free, or -1 if there is none.
+static int flush_blocks(hashpipe_databuf_t *d, int block_id)
+{
+    // Taking the block succeeds only if its value is exactly 1
+    struct sembuf op[2] = {{0, -1, IPC_NOWAIT}, {0, 0, IPC_NOWAIT}};
+    int i, b, first = -1;
+
+    for(i=0; i<d->n_block; i++) {
+        b = (block_id + i) % d->n_block;
+        op[0].sem_num = op[1].sem_num = b;
+        if(semop(d->semid, op, 2) == 0) {
+            note_drop(d, block_seq(d)[b]);
+        } else if(errno != EAGAIN) {
+            hashpipe_error(__FUNCTION__, "semop error");
+            return -1;
+        }
+        if(first == -1 && hashpipe_databuf_block_status(d, b) == 0) {
+            first = b;
+        }
+    }
+    return first;
+}
+
+int hashpipe_databuf_acquire_free(hashpipe_databuf_t *d, int *block_id,
+        uint64_t seq, hashpipe_databuf_drops_t *drops)
+{
+    struct sembuf op = {*block_id, 0, IPC_NOWAIT};
+    int b = *block_id;
+    int rv;
+
+    if(d->overflow_policy != HASHPIPE_OVERFLOW_BLOCK
+    && semop(d->semid, &op, 1) == -1) {
+        if(errno != EAGAIN) {
+            if (errno==EINTR) return HASHPIPE_ERR_SYS;
+            hashpipe_error(__FUNCTION__, "semop error");
+            return HASHPIPE_ERR_SYS;
+        }
+        if(d->overflow_policy == HASHPIPE_OVERFLOW_DROP) {
+            note_drop(d, seq);
+            return HASHPIPE_DROPPED;
+        }
+        b = flush_blocks(d, b);
+    }
+
+    // Wait in the usual way if the block is still not free (e.g. because
+    // all blocks were being read)
+    rv = hashpipe_databuf_wait_free(d, b < 0 ? *block_id : b);
+    if(rv != HASHPIPE_OK) {
+        return rv;
+    }
+    if(b >= 0) {
+        *block_id = b;
+    }
+
+    block_seq(d)[*block_id] = seq;
+    if(drops) {
+        *drops = d->gap;
+    }
+    memset(&d->gap, 0, sizeof(d->gap));
+    return HASHPIPE_OK;
+}
@@ -11,10 +11,27 @@
 #include <sys/ipc.h>
 #include <sys/sem.h>
 
+// Highest databuf id that tools (e.g. hashpipe_clean_shmem) look for
+#define HASHPIPE_MAX_DATABUFS 20
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Overflow policies, i.e. what hashpipe_databuf_acquire_free() does when the
+// writer's next block is not free because downstream threads are too slow.
+#define HASHPIPE_OVERFLOW_BLOCK     0 // Wait for the block (the default)
+#define HASHPIPE_OVERFLOW_DROP      1 // Drop the newest data
+#define HASHPIPE_OVERFLOW_FLUSH     2 // Discard all unread blocks
+
+// Dropped blocks and the range of sequence numbers (e.g. mcnt values) that
+// were passed to hashpipe_databuf_acquire_free() for them.
+typedef struct {
+    uint64_t blocks;    /* Number of dropped blocks */
+    uint64_t first_seq; /* Lowest sequence number dropped */
+    uint64_t last_seq;  /* Highest sequence number dropped */
+} hashpipe_databuf_drops_t;
+
 // Define hashpipe_databuf structure
 typedef struct {
     char data_type[64]; /* Type of data in buffer */
@@ -23,6 +40,9 @@ typedef struct {
     int n_block;        /* Number of data blocks in buffer */
     int shmid;          /* ID of this shared mem segment */
     int semid;          /* ID of locking semaphore set */
+    int overflow_policy;            /* HASHPIPE_OVERFLOW_* */
+    hashpipe_databuf_drops_t drops; /* Total drops, range of the latest */
+    hashpipe_databuf_drops_t gap;   /* Drops since the last acquire */
 } hashpipe_databuf_t;
 
 /*
@@ -72,9 +92,14 @@ uint64_t hashpipe_databuf_total_mask(hashpipe_databuf_t *d);
  * can be marked as free or filled.  The "wait" functions
  * block (i.e. sleep) until the specified state happens.
  * The "busywait" functions busy-wait (i.e. do NOT sleep)
- * until the specified state happens.  The "set" functions
+ * until the specified state happens or threads are asked
+ * to stop (see run_threads()), in which case they return
+ * HASHPIPE_TIMEOUT like the "wait" functions do when they
+ * time out.  The "set" functions
  * put the buffer in the specified state, returning error if
- * it is already in that state.
+ * it is already in that state.  When called from a pipeline
+ * thread, these functions also update the thread's progress
+ * tracking and wait time fields (see hashpipe_thread_args_t).
  */
 int hashpipe_databuf_wait_filled(hashpipe_databuf_t *d, int block_id);
 int hashpipe_databuf_busywait_filled(hashpipe_databuf_t *d, int block_id);
@@ -83,6 +108,37 @@ int hashpipe_databuf_wait_free(hashpipe_databuf_t *d, int block_id);
 int hashpipe_databuf_busywait_free(hashpipe_databuf_t *d, int block_id);
 int hashpipe_databuf_set_free(hashpipe_databuf_t *d, int block_id);
 
+/* Set the overflow policy (HASHPIPE_OVERFLOW_*) of the databuf.  Returns
+ * HASHPIPE_ERR_PARAM for an unknown policy.
+ */
+int hashpipe_databuf_set_overflow(hashpipe_databuf_t *d, int policy);
+
+/* Like hashpipe_databuf_wait_free(), but for the (single) writer of a databuf
+ * that must keep up with its input, e.g. a network thread.  seq identifies
+ * the data that will go into the block (e.g. its first mcnt) and is used to
+ * account for dropped blocks.  What happens when *block_id is not free
+ * depends on the databuf's overflow policy:
+ *
+ *   HASHPIPE_OVERFLOW_BLOCK      wait for it like hashpipe_databuf_wait_free()
+ *   HASHPIPE_OVERFLOW_DROP       return HASHPIPE_DROPPED at once; the caller
+ *                                discards its data and tries the same block
+ *                                again with its next data
+ *   HASHPIPE_OVERFLOW_FLUSH      free all filled blocks that no reader is
+ *                                working on (the whole backlog is lost at
+ *                                once), counting them as dropped, and
+ *                                set *block_id to the first of them (or the
+ *                                original block) so that readers still see
+ *                                blocks in sequence order; the caller must
+ *                                continue from the returned *block_id
+ *
+ * On HASHPIPE_OK, if drops is not NULL it receives the blocks dropped since
+ * the previous successful call, which the caller may record in the block's
+ * own header to make the loss explicit downstream.  Returns HASHPIPE_TIMEOUT
+ * or an error code as hashpipe_databuf_wait_free() does.
+ */
+int hashpipe_databuf_acquire_free(hashpipe_databuf_t *d, int *block_id,
+        uint64_t seq, hashpipe_databuf_drops_t *drops);
+
 #ifdef __cplusplus
 }
 #endif
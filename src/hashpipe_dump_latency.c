@@ -0,0 +1,117 @@
+/* hashpipe_dump_latency.c
+ *
+ * Prints the block latency histograms recorded by a hashpipe instance
+ * running with the --latency option.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "hashpipe_error.h"
+#include "hashpipe_latency.h"
+
+void usage() {
+    printf(
+            "Usage: hashpipe_dump_latency [options]\n"
+            "\n"
+            "Options [defaults]:\n"
+            "  -h, --help\n"
+            "  -I N, --instance=N    Instance number           [0]\n"
+            "  -d N, --databuf=N     Databuf ID                [all]\n"
+            "  -v,   --verbose       Also print histogram buckets\n"
+            "\n"
+            "Prints count, mean, percentiles and maximum (in microseconds) of\n"
+            "the queue (fill to consume), hold (consume to release) and total\n"
+            "(origin to release) block latency of each databuf.\n"
+            );
+}
+
+static void print_hist(const char *name, const hashpipe_latency_hist_t *h,
+        int verbose)
+{
+    int i;
+
+    printf("  %-6s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            name, h->count,
+            h->count ? h->sum_ns / 1e3 / h->count : 0.0,
+            hashpipe_latency_quantile(h, 0.5) / 1e3,
+            hashpipe_latency_quantile(h, 0.9) / 1e3,
+            hashpipe_latency_quantile(h, 0.99) / 1e3,
+            hashpipe_latency_quantile(h, 0.999) / 1e3,
+            h->max_ns / 1e3);
+
+    if(verbose) {
+        for(i=0; i<HASHPIPE_LATENCY_NUM_BUCKETS; i++) {
+            if(h->bucket[i]) {
+                printf("    >= %12.3f us: %lu\n",
+                        hashpipe_latency_bucket_value(i) / 1e3, h->bucket[i]);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    static struct option long_opts[] = {
+        {"help",     0, NULL, 'h'},
+        {"instance", 1, NULL, 'I'},
+        {"databuf",  1, NULL, 'd'},
+        {"verbose",  0, NULL, 'v'},
+        {0,0,0,0}
+    };
+    int opt;
+    int instance_id=0;
+    int db_id=-1;
+    int verbose=0;
+    int id;
+    hashpipe_latency_t *lat;
+    hashpipe_latency_databuf_t *db;
+
+    while ((opt=getopt_long(argc,argv,"hI:d:v",long_opts,NULL))!=-1) {
+        switch (opt) {
+            case 'I':
+                instance_id=atoi(optarg);
+                break;
+            case 'd':
+                db_id = atoi(optarg);
+                if(db_id < 0 || db_id > HASHPIPE_MAX_DATABUFS) {
+                    fprintf(stderr, "Invalid databuf ID %d\n", db_id);
+                    exit(1);
+                }
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'h':
+            default:
+                usage();
+                exit(0);
+                break;
+        }
+    }
+
+    lat = hashpipe_latency_attach(instance_id);
+    if(!lat) {
+        fprintf(stderr, "No block latency data for instance %d "
+                "(is hashpipe running with --latency?)\n", instance_id);
+        exit(1);
+    }
+
+    for(id=0; id<=HASHPIPE_MAX_DATABUFS; id++) {
+        db = &lat->db[id];
+        if((db_id >= 0 && id != db_id)
+        || (db_id < 0 && db->queue.count == 0)) {
+            continue;
+        }
+        printf("databuf %d:\n", id);
+        printf("  %-6s %10s %10s %10s %10s %10s %10s %10s\n", "", "count",
+                "mean_us", "p50_us", "p90_us", "p99_us", "p99.9_us", "max_us");
+        print_hist("queue", &db->queue, verbose);
+        print_hist("hold", &db->hold, verbose);
+        print_hist("total", &db->total, verbose);
+    }
+
+    hashpipe_latency_detach(lat);
+
+    exit(0);
+}
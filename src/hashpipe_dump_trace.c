@@ -0,0 +1,150 @@
+/* hashpipe_dump_trace.c
+ *
+ * Writes the event trace rings recorded by a hashpipe instance running with
+ * the --trace option as Chrome trace JSON, which can be loaded into
+ * chrome://tracing or https://ui.perfetto.dev.  Event times are
+ * CLOCK_MONOTONIC times in microseconds.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "hashpipe_error.h"
+#include "hashpipe_databuf.h"
+#include "hashpipe_trace.h"
+
+static const char *event_name[HASHPIPE_TRACE_NUM_TYPES] = {
+    "wait_filled", "wait_free", "set_filled", "set_free",
+    "status_lock", "status_held"
+};
+
+static const char *phase_name[] = {"B", "E", "i"};
+
+void usage() {
+    printf(
+            "Usage: hashpipe_dump_trace [options]\n"
+            "\n"
+            "Options [defaults]:\n"
+            "  -h, --help\n"
+            "  -I N, --instance=N    Instance number           [0]\n"
+            "  -o F, --output=F      Output file          [stdout]\n"
+            "\n"
+            "Writes the event trace of the specified instance as Chrome\n"
+            "trace JSON.\n"
+            );
+}
+
+int main(int argc, char *argv[]) {
+
+    static struct option long_opts[] = {
+        {"help",     0, NULL, 'h'},
+        {"instance", 1, NULL, 'I'},
+        {"output",   1, NULL, 'o'},
+        {0,0,0,0}
+    };
+    int opt;
+    int instance_id=0;
+    const char *output=NULL;
+    FILE *out = stdout;
+    hashpipe_trace_t *trace;
+    hashpipe_trace_ring_t *ring;
+    hashpipe_trace_record_t *recs;
+    hashpipe_databuf_t *db;
+    int semids[HASHPIPE_MAX_DATABUFS+1];
+    int i, j, k, n, used, first = 1;
+
+    while ((opt=getopt_long(argc,argv,"hI:o:",long_opts,NULL))!=-1) {
+        switch (opt) {
+            case 'I':
+                instance_id=atoi(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'h':
+            default:
+                usage();
+                exit(0);
+                break;
+        }
+    }
+
+    trace = hashpipe_trace_attach(instance_id);
+    if(!trace) {
+        fprintf(stderr, "No event trace for instance %d "
+                "(is hashpipe running with --trace?)\n", instance_id);
+        exit(1);
+    }
+
+    recs = malloc(trace->ring_size * sizeof(hashpipe_trace_record_t));
+    if(!recs) {
+        fprintf(stderr, "Error allocating %u trace records\n",
+                trace->ring_size);
+        exit(1);
+    }
+
+    // Map semids back to databuf IDs
+    for(i=0; i<=HASHPIPE_MAX_DATABUFS; i++) {
+        semids[i] = -1;
+        if(i > 0 && (db = hashpipe_databuf_attach(instance_id, i))) {
+            semids[i] = db->semid;
+            hashpipe_databuf_detach(db);
+        }
+    }
+
+    if(output && !(out = fopen(output, "w"))) {
+        perror(output);
+        exit(1);
+    }
+
+    used = trace->used < trace->num_rings ? trace->used : trace->num_rings;
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for(i=0; i<used; i++) {
+        ring = hashpipe_trace_ring(trace, i);
+        n = hashpipe_trace_read(trace, i, recs);
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+                "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", trace->hdr.pid, ring->tid, ring->name);
+        first = 0;
+        for(j=0; j<n; j++) {
+            if(recs[j].type >= HASHPIPE_TRACE_NUM_TYPES
+            || recs[j].phase > HASHPIPE_TRACE_INSTANT) {
+                continue;
+            }
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\","
+                    "\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+                    event_name[recs[j].type],
+                    recs[j].semid == -1 ? "status" : "databuf",
+                    phase_name[recs[j].phase],
+                    recs[j].time_ns / 1e3,
+                    trace->hdr.pid, ring->tid);
+            if(recs[j].phase == HASHPIPE_TRACE_INSTANT) {
+                fprintf(out, ",\"s\":\"t\"");
+            }
+            if(recs[j].semid != -1) {
+                for(k=1; k<=HASHPIPE_MAX_DATABUFS; k++) {
+                    if(semids[k] == recs[j].semid) {
+                        break;
+                    }
+                }
+                if(k <= HASHPIPE_MAX_DATABUFS) {
+                    fprintf(out, ",\"args\":{\"databuf\":%d,\"block\":%d}",
+                            k, recs[j].block_id);
+                } else {
+                    fprintf(out, ",\"args\":{\"semid\":%d,\"block\":%d}",
+                            recs[j].semid, recs[j].block_id);
+                }
+            }
+            fprintf(out, "}");
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    if(out != stdout) {
+        fclose(out);
+    }
+    free(recs);
+    hashpipe_trace_detach(trace);
+
+    exit(0);
+}
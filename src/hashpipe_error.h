@@ -5,9 +5,10 @@
 #ifndef _HASHPIPE_ERROR_H
 #define _HASHPIPE_ERROR_H
 
-/* Some exit codes */
+/* Some exit codes (2 and 3 are taken by HASHPIPE_STAGE_* in hashpipe.h) */
 #define HASHPIPE_OK          0
 #define HASHPIPE_TIMEOUT     1 // Call timed out 
+#define HASHPIPE_DROPPED     4 // Data dropped by databuf overflow policy
 #define HASHPIPE_ERR_GEN    -1 // Super non-informative
 #define HASHPIPE_ERR_SYS    -2 // Failed system call
 #define HASHPIPE_ERR_PARAM  -3 // Parameter out of range
@@ -0,0 +1,218 @@
+/* hashpipe_history.c
+ *
+ * Implementation of the status history routines described
+ * in hashpipe_history.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/types.h>
+#include <time.h>
+#include <errno.h>
+
+#include "hashpipe_ipckey.h"
+#include "hashpipe_history.h"
+#include "hashpipe_error.h"
+#include "fitshead.h"
+
+static size_t hashpipe_history_size(uint64_t nrecords)
+{
+    return sizeof(hashpipe_history_header_t)
+         + nrecords * sizeof(hashpipe_history_record_t);
+}
+
+static int hashpipe_history_map(hashpipe_history_t *h)
+{
+    h->hdr = shmat(h->shmid, NULL, 0);
+    if (h->hdr == (void *)-1) {
+        hashpipe_error(__FUNCTION__, "shmat error");
+        h->hdr = NULL;
+        return HASHPIPE_ERR_SYS;
+    }
+    h->rec = (hashpipe_history_record_t *)(h->hdr + 1);
+    return HASHPIPE_OK;
+}
+
+int hashpipe_history_delete(int instance_id)
+{
+    int shmid;
+    key_t key = hashpipe_history_key(instance_id & 0x3f);
+    if(key == HASHPIPE_KEY_ERROR) {
+        hashpipe_error(__FUNCTION__, "hashpipe_history_key error");
+        return HASHPIPE_ERR_SYS;
+    }
+    shmid = shmget(key, 0, 0666);
+    if(shmid == -1) {
+        errno = 0;
+        return HASHPIPE_ERR_KEY;
+    }
+    if(shmctl(shmid, IPC_RMID, NULL) == -1) {
+        hashpipe_error(__FUNCTION__, "shmctl error");
+        return HASHPIPE_ERR_SYS;
+    }
+    return HASHPIPE_OK;
+}
+
+int hashpipe_history_create(int instance_id, hashpipe_history_t *h,
+        const char **keys, int nkeys, double interval, uint64_t nsamples)
+{
+    int i;
+    key_t key;
+
+    if(nkeys < 1 || nkeys > HASHPIPE_HISTORY_MAX_KEYS || interval <= 0) {
+        hashpipe_error(__FUNCTION__, "invalid parameters");
+        return HASHPIPE_ERR_PARAM;
+    }
+    if(nsamples == 0) {
+        nsamples = HASHPIPE_HISTORY_DEFAULT_SAMPLES;
+    }
+
+    memset(h, 0, sizeof(hashpipe_history_t));
+    h->instance_id = instance_id & 0x3f;
+
+    key = hashpipe_history_key(h->instance_id);
+    if(key == HASHPIPE_KEY_ERROR) {
+        hashpipe_error(__FUNCTION__, "hashpipe_history_key error");
+        return HASHPIPE_ERR_SYS;
+    }
+
+    // History does not survive restarts, so always start with a new segment
+    hashpipe_history_delete(h->instance_id);
+
+    h->shmid = shmget(key, hashpipe_history_size(nsamples * nkeys),
+                      0666 | IPC_CREAT | IPC_EXCL);
+    if(h->shmid == -1) {
+        hashpipe_error(__FUNCTION__, "shmget error");
+        return HASHPIPE_ERR_SYS;
+    }
+    if(hashpipe_history_map(h) != HASHPIPE_OK) {
+        return HASHPIPE_ERR_SYS;
+    }
+
+    // New segments are zero filled by the kernel
+    h->hdr->nrecords = nsamples * nkeys;
+    h->hdr->interval = interval;
+    for(i=0; i<nkeys; i++) {
+        strncpy(h->hdr->keys[i], keys[i], HASHPIPE_HISTORY_KEY_SIZE-1);
+    }
+    __sync_synchronize();
+    h->hdr->nkeys = nkeys;
+
+    return HASHPIPE_OK;
+}
+
+int hashpipe_history_attach(int instance_id, hashpipe_history_t *h)
+{
+    key_t key;
+
+    memset(h, 0, sizeof(hashpipe_history_t));
+    h->instance_id = instance_id & 0x3f;
+
+    key = hashpipe_history_key(h->instance_id);
+    if(key == HASHPIPE_KEY_ERROR) {
+        hashpipe_error(__FUNCTION__, "hashpipe_history_key error");
+        return HASHPIPE_ERR_SYS;
+    }
+    h->shmid = shmget(key, 0, 0666);
+    if(h->shmid == -1) {
+        // Doesn't exist
+        errno = 0;
+        return HASHPIPE_ERR_KEY;
+    }
+    return hashpipe_history_map(h);
+}
+
+int hashpipe_history_detach(hashpipe_history_t *h)
+{
+    if(h && h->hdr) {
+        if(shmdt(h->hdr)) {
+            hashpipe_error(__FUNCTION__, "shmdt error");
+            return HASHPIPE_ERR_SYS;
+        }
+        h->hdr = NULL;
+        h->rec = NULL;
+    }
+    return HASHPIPE_OK;
+}
+
+int hashpipe_history_sample(hashpipe_history_t *h, hashpipe_status_t *s)
+{
+    int i, n = 0;
+    int nkeys = h->hdr->nkeys;
+    char value[HASHPIPE_HISTORY_MAX_KEYS][HASHPIPE_HISTORY_VALUE_SIZE];
+    uint16_t flags[HASHPIPE_HISTORY_MAX_KEYS];
+    hashpipe_history_record_t *r;
+    struct timespec ts;
+    uint64_t now_ns;
+    uint64_t keyframe_ns = HASHPIPE_HISTORY_KEYFRAME_INTERVAL * 1e9;
+
+    // Grab all values with one trip through the lock
+    hashpipe_status_lock(s);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    for(i=0; i<nkeys; i++) {
+        value[i][0] = '\0';
+        flags[i] = 0;
+        if(!hgets(s->buf, h->hdr->keys[i], HASHPIPE_HISTORY_VALUE_SIZE, value[i])) {
+            flags[i] = HASHPIPE_HISTORY_ABSENT;
+        }
+        value[i][HASHPIPE_HISTORY_VALUE_SIZE-1] = '\0';
+    }
+    hashpipe_status_unlock_read(s);
+    now_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    for(i=0; i<nkeys; i++) {
+        // Record only changes, unless it is time for a keyframe
+        if(h->last_time_ns[i]
+        && now_ns - h->last_time_ns[i] < keyframe_ns
+        && flags[i] == h->last_flags[i]
+        && !strcmp(value[i], h->last_value[i])) {
+            continue;
+        }
+
+        r = &h->rec[h->hdr->head % h->hdr->nrecords];
+        r->time_ns = now_ns;
+        r->key_idx = i;
+        r->flags = flags[i];
+        memcpy(r->value, value[i], HASHPIPE_HISTORY_VALUE_SIZE);
+        // Make record visible before advancing head
+        __sync_synchronize();
+        h->hdr->head++;
+        n++;
+
+        strcpy(h->last_value[i], value[i]);
+        h->last_flags[i] = flags[i];
+        h->last_time_ns[i] = now_ns;
+    }
+    h->hdr->nsamples++;
+
+    return n;
+}
+
+uint64_t hashpipe_history_read(hashpipe_history_t *h, uint64_t since,
+        hashpipe_history_cb_t cb, void *data)
+{
+    hashpipe_history_record_t r;
+    uint64_t nrecords = h->hdr->nrecords;
+    uint64_t head = h->hdr->head;
+    uint64_t i;
+
+    __sync_synchronize();
+    if(head > nrecords && since < head - nrecords) {
+        since = head - nrecords;
+    }
+    for(i=since; i<head; i++) {
+        memcpy(&r, &h->rec[i % nrecords], sizeof(r));
+        __sync_synchronize();
+        // The writer overwrites record i while writing record i+nrecords, so
+        // our copy is only known good if the writer has not yet reached it.
+        if(i + nrecords <= h->hdr->head) {
+            continue;
+        }
+        if(r.key_idx < h->hdr->nkeys) {
+            cb(h->hdr, &r, data);
+        }
+    }
+    return head;
+}
@@ -0,0 +1,113 @@
+/* hashpipe_history.h
+ *
+ * Routines dealing with the hashpipe status history shared memory segment.
+ * The history segment holds a ring of time stamped status key values.  It is
+ * written by the status history thread of the hashpipe executable, which
+ * samples a set of status keys at a fixed interval and records a key's value
+ * only when it differs from the previously recorded value (plus periodic
+ * "keyframe" records so that the value of every key can be recovered from
+ * the ring even after the ring has wrapped).  Any process can read the ring
+ * without locking.
+ */
+#ifndef _HASHPIPE_HISTORY_H
+#define _HASHPIPE_HISTORY_H
+
+#include <stdint.h>
+
+#include "hashpipe_status.h"
+
+#define HASHPIPE_HISTORY_MAX_KEYS 64
+#define HASHPIPE_HISTORY_KEY_SIZE 16
+#define HASHPIPE_HISTORY_VALUE_SIZE 72
+// Default sampling interval (seconds)
+#define HASHPIPE_HISTORY_DEFAULT_INTERVAL 1.0
+// Default number of samples per key that the ring can hold
+#define HASHPIPE_HISTORY_DEFAULT_SAMPLES 3600
+// Each key is re-recorded at least this often (seconds) even if unchanged
+#define HASHPIPE_HISTORY_KEYFRAME_INTERVAL 300.0
+
+// Record flags
+#define HASHPIPE_HISTORY_ABSENT 0x1 // Key was not present in status buffer
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One history record */
+typedef struct {
+    uint64_t time_ns; /* Sample time, nanoseconds since the Unix epoch */
+    uint16_t key_idx; /* Index into keys array of history header */
+    uint16_t flags;   /* HASHPIPE_HISTORY_* flags */
+    char value[HASHPIPE_HISTORY_VALUE_SIZE]; /* Value string */
+} hashpipe_history_record_t;
+
+/* Header at the start of the history shared memory segment.  The records
+ * follow immediately after the header.
+ */
+typedef struct {
+    uint64_t nrecords; /* Capacity of ring (records) */
+    double interval;   /* Sampling interval (seconds) */
+    int nkeys;         /* Number of keys being recorded */
+    char keys[HASHPIPE_HISTORY_MAX_KEYS][HASHPIPE_HISTORY_KEY_SIZE];
+    uint64_t head;     /* Total number of records ever written */
+    uint64_t nsamples; /* Total number of samples taken */
+} hashpipe_history_header_t;
+
+/* Handle used by readers and the writer of a history segment */
+typedef struct {
+    int instance_id;
+    int shmid;
+    hashpipe_history_header_t *hdr;
+    hashpipe_history_record_t *rec;
+    // Writer state (unused by readers)
+    char last_value[HASHPIPE_HISTORY_MAX_KEYS][HASHPIPE_HISTORY_VALUE_SIZE];
+    uint16_t last_flags[HASHPIPE_HISTORY_MAX_KEYS];
+    uint64_t last_time_ns[HASHPIPE_HISTORY_MAX_KEYS];
+} hashpipe_history_t;
+
+/* Callback type used by hashpipe_history_read() */
+typedef void (* hashpipe_history_cb_t)(const hashpipe_history_header_t *hdr,
+        const hashpipe_history_record_t *rec, void *data);
+
+/* Create the history segment for instance_id (replacing any existing one)
+ * to record nkeys keys.  The ring holds nsamples samples of every key (if
+ * nsamples is 0, HASHPIPE_HISTORY_DEFAULT_SAMPLES is used), which is the
+ * worst case of every key changing at every sample.  Returns HASHPIPE_OK on
+ * success.
+ */
+int hashpipe_history_create(int instance_id, hashpipe_history_t *h,
+        const char **keys, int nkeys, double interval, uint64_t nsamples);
+
+/* Attach to an existing history segment.  Returns HASHPIPE_OK on success or
+ * HASHPIPE_ERR_KEY if no history segment exists for instance_id.
+ */
+int hashpipe_history_attach(int instance_id, hashpipe_history_t *h);
+
+/* Detach from history segment */
+int hashpipe_history_detach(hashpipe_history_t *h);
+
+/* Delete the history segment for instance_id (if any).  Returns HASHPIPE_OK
+ * if deleted, HASHPIPE_ERR_KEY if it did not exist, HASHPIPE_ERR_SYS on
+ * error.
+ */
+int hashpipe_history_delete(int instance_id);
+
+/* Sample the history keys from status buffer s and record any that changed
+ * since they were last recorded.  Only the writer may call this function.
+ * Returns the number of records written.
+ */
+int hashpipe_history_sample(hashpipe_history_t *h, hashpipe_status_t *s);
+
+/* Call cb for each record in the ring whose index is greater than or equal
+ * to since (records that have already been overwritten are skipped).
+ * Returns the index of the next record to be written, which can be passed as
+ * since in a subsequent call to read only newer records.
+ */
+uint64_t hashpipe_history_read(hashpipe_history_t *h, uint64_t since,
+        hashpipe_history_cb_t cb, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _HASHPIPE_HISTORY_H
@@ -0,0 +1,48 @@
+/*
+ * hashpipe_history_thread.c
+ *
+ * Framework thread that periodically samples a set of status keys into the
+ * status history ring (see hashpipe_history.h).  It is started by the hashpipe
+ * executable when the --history option is given.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hashpipe.h"
+#include "hashpipe_history.h"
+#include "hashpipe_thread_args.h"
+
+void *hashpipe_history_thread_run(void *vp_history)
+{
+    hashpipe_history_t *h = (hashpipe_history_t *)vp_history;
+    hashpipe_status_t st;
+    struct timespec next;
+    long interval_ns = h->hdr->interval * 1e9;
+
+    if(hashpipe_status_attach(h->instance_id, &st) != HASHPIPE_OK) {
+        hashpipe_error(__FUNCTION__,
+                "Error attaching to status shared memory.");
+        return THREAD_ERROR;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while(run_threads()) {
+        hashpipe_history_sample(h, &st);
+
+        // Sleep until next sample time (absolute, so no drift)
+        next.tv_sec  += interval_ns / 1000000000;
+        next.tv_nsec += interval_ns % 1000000000;
+        if(next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    hashpipe_status_detach(&st);
+
+    return THREAD_OK;
+}
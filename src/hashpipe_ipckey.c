@@ -91,3 +91,43 @@ key_t hashpipe_status_key(int instance_id)
     }
     return key;
 }
+
+/*
+ * Get the key to use for the hashpipe status history buffer.
+ * The the comments for hashpipe_databuf_key for details on the instance_id
+ * parameter.
+ */
+key_t hashpipe_history_key(int instance_id)
+{
+    key_t key = HASHPIPE_KEY_ERROR;
+    char *history_key = getenv("HASHPIPE_HISTORY_KEY");
+    if(history_key) {
+        key = strtoul(history_key, NULL, 0);
+    } else {
+        // Use instance_id to generate proj_id for hashpipe_ipckey.
+        // History proj_id is 11XXXXXX (binary) where XXXXXX are the 6 LSbs
+        // of instance_id.
+        key = hashpipe_ipckey((instance_id&0x3f)|0xc0);
+    }
+    return key;
+}
+
+/*
+ * Get the key to use for the hashpipe auxiliary segment directory.
+ * The the comments for hashpipe_databuf_key for details on the instance_id
+ * parameter.
+ */
+key_t hashpipe_aux_key(int instance_id)
+{
+    key_t key = HASHPIPE_KEY_ERROR;
+    char *aux_key = getenv("HASHPIPE_AUX_KEY");
+    if(aux_key) {
+        key = strtoul(aux_key, NULL, 0);
+    } else {
+        // Use instance_id to generate proj_id for hashpipe_ipckey.
+        // Auxiliary proj_id is 00XXXXXX (binary) where XXXXXX are the 6 LSbs
+        // of instance_id.
+        key = hashpipe_ipckey(instance_id&0x3f);
+    }
+    return key;
+}
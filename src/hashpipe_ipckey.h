@@ -54,4 +54,27 @@ key_t hashpipe_databuf_key(int instance_id);
  */
 key_t hashpipe_status_key(int instance_id);
 
+/*
+ * Get the key to use for the hashpipe status history buffer.
+ *
+ * If HASHPIPE_HISTORY_KEY is defined in the environment, its value is used as
+ * the history buffer key.  Otherwise, the key is obtained the same way as for
+ * hashpipe_status_key(), but with a history buffer specific proj_id.
+ *
+ * HASHPIPE_KEY_ERROR is returned on error.
+ */
+key_t hashpipe_history_key(int instance_id);
+
+/*
+ * Get the key to use for the hashpipe auxiliary segment directory (see
+ * hashpipe_auxshm.h).
+ *
+ * If HASHPIPE_AUX_KEY is defined in the environment, its value is used as
+ * the directory key.  Otherwise, the key is obtained the same way as for
+ * hashpipe_status_key(), but with an auxiliary proj_id.
+ *
+ * HASHPIPE_KEY_ERROR is returned on error.
+ */
+key_t hashpipe_aux_key(int instance_id);
+
 #endif // _HASHPIPE_IPCKEY_H
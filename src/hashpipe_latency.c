@@ -0,0 +1,212 @@
+/* hashpipe_latency.c
+ *
+ * Implementation of the block latency routines described
+ * in hashpipe_latency.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hashpipe_latency.h"
+#include "hashpipe_error.h"
+
+// Latency segment of this process (NULL if tracing is not enabled)
+static hashpipe_latency_t *latency = NULL;
+
+// Origin of the block most recently consumed by the calling thread (0 if
+// none)
+static __thread uint64_t current_origin_ns = 0;
+
+// Map from semaphore set id to databuf_id of the databufs this process has
+// created or attached.  Entries are only ever appended (under the mutex), so
+// they can be searched without locking.
+static struct {
+    int semid;
+    int databuf_id;
+} registry[HASHPIPE_MAX_DATABUFS+1];
+static int registry_size = 0;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bucket_index(uint64_t v)
+{
+    int e, i;
+    const int sub = 1 << HASHPIPE_LATENCY_SUB_BITS;
+
+    if(v < sub) {
+        return v;
+    }
+    e = 63 - __builtin_clzll(v);
+    i = ((e - HASHPIPE_LATENCY_SUB_BITS + 1) << HASHPIPE_LATENCY_SUB_BITS)
+      + ((v >> (e - HASHPIPE_LATENCY_SUB_BITS)) & (sub - 1));
+    return i < HASHPIPE_LATENCY_NUM_BUCKETS ? i : HASHPIPE_LATENCY_NUM_BUCKETS-1;
+}
+
+uint64_t hashpipe_latency_bucket_value(int i)
+{
+    const int sub = 1 << HASHPIPE_LATENCY_SUB_BITS;
+    int e;
+
+    if(i < sub) {
+        return i;
+    }
+    e = (i >> HASHPIPE_LATENCY_SUB_BITS) + HASHPIPE_LATENCY_SUB_BITS - 1;
+    return (uint64_t)(sub + (i & (sub - 1))) << (e - HASHPIPE_LATENCY_SUB_BITS);
+}
+
+uint64_t hashpipe_latency_quantile(const hashpipe_latency_hist_t *h,
+        double q)
+{
+    uint64_t n = 0, target;
+    int i;
+
+    if(h->count == 0) {
+        return 0;
+    }
+    target = q * h->count;
+    for(i=0; i<HASHPIPE_LATENCY_NUM_BUCKETS; i++) {
+        n += h->bucket[i];
+        if(n > target) {
+            return hashpipe_latency_bucket_value(i);
+        }
+    }
+    return h->max_ns;
+}
+
+static void hist_add(hashpipe_latency_hist_t *h, uint64_t v)
+{
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&h->bucket[bucket_index(v)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum_ns, v, __ATOMIC_RELAXED);
+    while(v > max && !__atomic_compare_exchange_n(&h->max_ns, &max, v, 1,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+void hashpipe_latency_register(int semid, int databuf_id)
+{
+    int i, n;
+
+    if(databuf_id < 0 || databuf_id > HASHPIPE_MAX_DATABUFS) {
+        return;
+    }
+    pthread_mutex_lock(&registry_mutex);
+    n = registry_size;
+    for(i=0; i<n; i++) {
+        if(registry[i].semid == semid) {
+            break;
+        }
+    }
+    if(i == n && n <= HASHPIPE_MAX_DATABUFS) {
+        registry[n].semid = semid;
+        registry[n].databuf_id = databuf_id;
+        __atomic_store_n(&registry_size, n+1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+// Returns databuf_id of semid, or -1 if not registered
+static int databuf_id_of(int semid)
+{
+    int i, n = __atomic_load_n(&registry_size, __ATOMIC_ACQUIRE);
+
+    for(i=0; i<n; i++) {
+        if(registry[i].semid == semid) {
+            return registry[i].databuf_id;
+        }
+    }
+    return -1;
+}
+
+// Returns stamp for block_id of the databuf with semid and sets *databuf_id,
+// or returns NULL if not traced
+static hashpipe_latency_stamp_t *stamp(int semid, int block_id,
+        int *databuf_id)
+{
+    if(!latency || block_id < 0 || block_id >= HASHPIPE_LATENCY_MAX_BLOCKS
+    || (*databuf_id = databuf_id_of(semid)) < 0) {
+        return NULL;
+    }
+    return &latency->db[*databuf_id].stamp[block_id];
+}
+
+void hashpipe_latency_filled(int semid, int block_id)
+{
+    int databuf_id;
+    hashpipe_latency_stamp_t *s = stamp(semid, block_id, &databuf_id);
+    uint64_t now;
+
+    if(s) {
+        now = now_ns();
+        s->origin_ns = current_origin_ns ? current_origin_ns : now;
+        s->consume_ns = 0;
+        __atomic_store_n(&s->fill_ns, now, __ATOMIC_RELEASE);
+    }
+}
+
+void hashpipe_latency_consumed(int semid, int block_id)
+{
+    int databuf_id;
+    hashpipe_latency_stamp_t *s = stamp(semid, block_id, &databuf_id);
+    uint64_t now, fill;
+
+    if(s && (fill = __atomic_load_n(&s->fill_ns, __ATOMIC_ACQUIRE))) {
+        now = now_ns();
+        // Only the first wait for a block counts as consuming it
+        if(!s->consume_ns) {
+            s->consume_ns = now;
+            hist_add(&latency->db[databuf_id].queue, now - fill);
+        }
+        current_origin_ns = s->origin_ns;
+    }
+}
+
+void hashpipe_latency_released(int semid, int block_id)
+{
+    int databuf_id;
+    hashpipe_latency_stamp_t *s = stamp(semid, block_id, &databuf_id);
+    uint64_t now;
+
+    // Blocks are also set free when databufs are initialized, which only
+    // counts if the block was consumed
+    if(s && s->consume_ns) {
+        now = now_ns();
+        hist_add(&latency->db[databuf_id].hold, now - s->consume_ns);
+        hist_add(&latency->db[databuf_id].total, now - s->origin_ns);
+        s->consume_ns = 0;
+        s->fill_ns = 0;
+    }
+}
+
+int hashpipe_latency_enable(int instance_id)
+{
+    // Replaces any previous latency segment, so it starts from scratch
+    latency = hashpipe_auxshm_create(instance_id,
+            HASHPIPE_AUXSHM_LATENCY, sizeof(hashpipe_latency_t));
+    return latency ? HASHPIPE_OK : HASHPIPE_ERR_SYS;
+}
+
+hashpipe_latency_t *hashpipe_latency_attach(int instance_id)
+{
+    return hashpipe_auxshm_attach(instance_id, HASHPIPE_AUXSHM_LATENCY, 0);
+}
+
+int hashpipe_latency_detach(hashpipe_latency_t *l)
+{
+    return hashpipe_auxshm_detach(l);
+}
+
+int hashpipe_latency_delete(int instance_id)
+{
+    return hashpipe_auxshm_delete(instance_id, HASHPIPE_AUXSHM_LATENCY);
+}
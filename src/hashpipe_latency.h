@@ -0,0 +1,118 @@
+/* hashpipe_latency.h
+ *
+ * Routines dealing with the hashpipe block latency shared memory segment.
+ * When latency tracing is enabled, the databuf functions time stamp every
+ * block of every databuf (with CLOCK_MONOTONIC) when it is filled, when it
+ * is consumed (i.e. when hashpipe_databuf_wait_filled() returns it to the
+ * reading thread) and when it is released (set free).  Each block also
+ * carries the time stamp of its origin: a block filled by a thread that has
+ * no input (e.g. a network thread) originates when it is filled, while a
+ * block filled by any other thread inherits the origin of the input block
+ * that thread most recently consumed.  Three latency histograms are kept
+ * for every databuf:
+ *
+ *   queue  fill to consume, i.e. time spent waiting for the reader
+ *   hold   consume to release, i.e. time the reader spent on the block
+ *   total  origin to release, i.e. end-to-end latency up to and including
+ *          the reader of this databuf
+ *
+ * The histograms use HDR style log-linear buckets (16 buckets per power of
+ * two, so values are resolved to within about 6%) from 1 ns to about 18
+ * minutes.  Any process can read them without locking.
+ *
+ * The latency segment is an auxiliary segment (see hashpipe_auxshm.h).
+ */
+#ifndef _HASHPIPE_LATENCY_H
+#define _HASHPIPE_LATENCY_H
+
+#include <stdint.h>
+
+#include "hashpipe_databuf.h"
+#include "hashpipe_auxshm.h"
+
+// Number of blocks per databuf that are time stamped (blocks beyond this are
+// not traced)
+#define HASHPIPE_LATENCY_MAX_BLOCKS 256
+// Number of sub-buckets per power of two (as a power of two)
+#define HASHPIPE_LATENCY_SUB_BITS 4
+// Number of histogram buckets
+#define HASHPIPE_LATENCY_NUM_BUCKETS (38 << HASHPIPE_LATENCY_SUB_BITS)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Latency histogram */
+typedef struct {
+    uint64_t count;  /* Number of values recorded */
+    uint64_t sum_ns; /* Sum of values */
+    uint64_t max_ns; /* Largest value */
+    uint64_t bucket[HASHPIPE_LATENCY_NUM_BUCKETS];
+} hashpipe_latency_hist_t;
+
+/* Time stamps (nanoseconds of CLOCK_MONOTONIC) of one block */
+typedef struct {
+    uint64_t origin_ns;
+    uint64_t fill_ns;
+    uint64_t consume_ns; /* 0 if not currently consumed */
+} hashpipe_latency_stamp_t;
+
+/* Latency data of one databuf */
+typedef struct {
+    hashpipe_latency_hist_t queue;
+    hashpipe_latency_hist_t hold;
+    hashpipe_latency_hist_t total;
+    hashpipe_latency_stamp_t stamp[HASHPIPE_LATENCY_MAX_BLOCKS];
+} hashpipe_latency_databuf_t;
+
+/* Layout of the latency shared memory segment */
+typedef struct {
+    hashpipe_auxshm_hdr_t hdr;
+    hashpipe_latency_databuf_t db[HASHPIPE_MAX_DATABUFS+1];
+} hashpipe_latency_t;
+
+/* Create the latency segment for instance_id, replacing any previous one,
+ * and enable latency tracing by the databuf functions
+ * of this process.  Returns HASHPIPE_OK on success.
+ */
+int hashpipe_latency_enable(int instance_id);
+
+/* Attach to an existing latency segment.  Returns pointer to segment or NULL
+ * if no latency segment exists for instance_id.
+ */
+hashpipe_latency_t *hashpipe_latency_attach(int instance_id);
+
+/* Detach from latency segment */
+int hashpipe_latency_detach(hashpipe_latency_t *l);
+
+/* Delete the latency segment for instance_id (if any).  Returns HASHPIPE_OK
+ * if deleted, HASHPIPE_ERR_KEY if it did not exist, HASHPIPE_ERR_SYS on
+ * error.
+ */
+int hashpipe_latency_delete(int instance_id);
+
+/* Returns the smallest value (in nanoseconds) that falls in bucket i */
+uint64_t hashpipe_latency_bucket_value(int i);
+
+/* Returns the value (in nanoseconds) below which fraction q (0 to 1) of the
+ * values in histogram h fall, to within the bucket resolution.  Returns 0 for
+ * empty histograms.
+ */
+uint64_t hashpipe_latency_quantile(const hashpipe_latency_hist_t *h,
+        double q);
+
+/* Functions called by the databuf functions.  Databufs are identified by
+ * their semaphore set id, which hashpipe_latency_register() maps to their
+ * databuf_id when they are created or attached.  The time stamping functions
+ * do nothing unless latency tracing is enabled in this process.
+ */
+void hashpipe_latency_register(int semid, int databuf_id);
+void hashpipe_latency_filled(int semid, int block_id);
+void hashpipe_latency_consumed(int semid, int block_id);
+void hashpipe_latency_released(int semid, int block_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _HASHPIPE_LATENCY_H
@@ -0,0 +1,98 @@
+/*
+ * hashpipe_latency_thread.c
+ *
+ * Framework thread that periodically summarizes the block latency histograms
+ * (see hashpipe_latency.h) in the status buffer.  For every databuf N that
+ * has seen any traffic it stores
+ *
+ *   LATQN  queue latency (fill to consume)
+ *   LATHN  hold latency (consume to release)
+ *   LATEN  end-to-end latency (origin to release)
+ *
+ * each as "P50/P99/MAX" in microseconds, accumulated since the pipeline
+ * started.  Use hashpipe_dump_latency to see the full histograms.
+ *
+ * It is started by the hashpipe executable when the --latency option is
+ * given.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hashpipe.h"
+#include "hashpipe_latency.h"
+#include "hashpipe_thread_args.h"
+
+// Format p50/p99/max of h (in microseconds) into str
+static void
+format_hist(const hashpipe_latency_hist_t *h, char *str, size_t size)
+{
+    snprintf(str, size, "%.1f/%.1f/%.1f",
+            hashpipe_latency_quantile(h, 0.5) / 1e3,
+            hashpipe_latency_quantile(h, 0.99) / 1e3,
+            h->max_ns / 1e3);
+}
+
+void *hashpipe_latency_thread_run(void *vp_args)
+{
+    hashpipe_latency_args_t *largs = (hashpipe_latency_args_t *)vp_args;
+    hashpipe_latency_t *lat;
+    hashpipe_latency_databuf_t *db;
+    hashpipe_status_t st;
+    struct timespec ts;
+    long interval_ns = largs->interval * 1e9;
+    int id, changed;
+    char key[16];
+    char q[64], h[64], e[64];
+
+    if(hashpipe_status_attach(largs->instance_id, &st) != HASHPIPE_OK) {
+        hashpipe_error(__FUNCTION__,
+                "Error attaching to status shared memory.");
+        return THREAD_ERROR;
+    }
+
+    lat = hashpipe_latency_attach(largs->instance_id);
+    if(!lat) {
+        hashpipe_error(__FUNCTION__, "Error attaching to latency segment.");
+        hashpipe_status_detach(&st);
+        return THREAD_ERROR;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    while(run_threads()) {
+        // Sleep until next update
+        ts.tv_sec  += interval_ns / 1000000000;
+        ts.tv_nsec += interval_ns % 1000000000;
+        if(ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        for(id=0; id<=HASHPIPE_MAX_DATABUFS; id++) {
+            db = &lat->db[id];
+            if(db->queue.count == 0) {
+                continue;
+            }
+            format_hist(&db->queue, q, sizeof(q));
+            format_hist(&db->hold, h, sizeof(h));
+            format_hist(&db->total, e, sizeof(e));
+
+            hashpipe_status_lock_safe(&st);
+            sprintf(key, "LATQ%d", id);
+            changed = hashpipe_status_puts_changed(&st, key, q);
+            sprintf(key, "LATH%d", id);
+            changed |= hashpipe_status_puts_changed(&st, key, h);
+            sprintf(key, "LATE%d", id);
+            changed |= hashpipe_status_puts_changed(&st, key, e);
+            hashpipe_status_unlock_changed_safe(&st, changed);
+        }
+    }
+
+    hashpipe_latency_detach(lat);
+    hashpipe_status_detach(&st);
+
+    return THREAD_OK;
+}
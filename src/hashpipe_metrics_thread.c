@@ -0,0 +1,374 @@
+/*
+ * hashpipe_metrics_thread.c
+ *
+ * Framework thread that serves pipeline telemetry in the Prometheus text
+ * exposition format over HTTP on a local TCP or unix domain socket.  It is
+ * started by the hashpipe executable when the --metrics option is given.
+ *
+ * Each scrape takes a snapshot of the status buffer (holding the status lock
+ * only for the copy) and formats the snapshot afterwards, so scrapes never
+ * hold the status lock while formatting or writing to the socket.  Exported
+ * metrics are:
+ *
+ *   - every status key with a numeric value
+ *   - every status key ending in "STAT" (i.e. thread states) as an info metric
+ *   - status lock statistics
+ *   - size and occupancy of each databuf of the instance
+ */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "hashpipe.h"
+#include "hashpipe_thread_args.h"
+
+// Growable output buffer
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+} metrics_out_t;
+
+static void out_printf(metrics_out_t *o, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    for(;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(o->buf + o->len, o->size - o->len, fmt, ap);
+        va_end(ap);
+        if(n < 0) {
+            return;
+        }
+        if(o->len + n < o->size) {
+            o->len += n;
+            return;
+        }
+        o->size = 2 * (o->size + n);
+        o->buf = realloc(o->buf, o->size);
+        if(!o->buf) {
+            o->len = o->size = 0;
+            return;
+        }
+    }
+}
+
+// Write s to o as a Prometheus label value (i.e. with escapes)
+static void out_label_value(metrics_out_t *o, const char *s)
+{
+    for(; *s; s++) {
+        switch(*s) {
+            case '\\': out_printf(o, "\\\\"); break;
+            case '"':  out_printf(o, "\\\""); break;
+            case '\n': out_printf(o, "\\n");  break;
+            default:   out_printf(o, "%c", *s); break;
+        }
+    }
+}
+
+// Split a status record into key and value.  String values are unquoted.
+// Returns 1 if the value was quoted, 0 if not, -1 if card is not a key/value
+// record.
+static int parse_card(const char *card, char *key, char *value)
+{
+    int i, n, quoted = 0;
+    const char *v;
+
+    if(card[8] != '=') {
+        return -1;
+    }
+    for(n=8; n>0 && card[n-1] == ' '; n--);
+    memcpy(key, card, n);
+    key[n] = '\0';
+
+    for(v=card+9; v<card+HASHPIPE_STATUS_RECORD_SIZE && *v == ' '; v++);
+    if(*v == '\'') {
+        quoted = 1;
+        v++;
+    }
+    for(i=0; v<card+HASHPIPE_STATUS_RECORD_SIZE && *v; i++, v++) {
+        if(quoted && *v == '\'') {
+            break;
+        }
+        value[i] = *v;
+    }
+    for(; i>0 && value[i-1] == ' '; i--);
+    value[i] = '\0';
+
+    return quoted;
+}
+
+static void format_metrics(metrics_out_t *o, int instance_id,
+        const char *snap, const hashpipe_status_lockinfo_t *li,
+        hashpipe_databuf_t **db)
+{
+    const char *card;
+    char key[HASHPIPE_STATUS_RECORD_SIZE+1];
+    char value[HASHPIPE_STATUS_RECORD_SIZE+1];
+    char *endp;
+    double d;
+    int i, klen, quoted;
+
+    out_printf(o, "# TYPE hashpipe_status gauge\n");
+    for(card=snap; *card && strncmp(card, "END", 3);
+        card += HASHPIPE_STATUS_RECORD_SIZE) {
+        quoted = parse_card(card, key, value);
+        if(quoted < 0 || !value[0]) {
+            continue;
+        }
+        d = strtod(value, &endp);
+        if(*endp == '\0') {
+            out_printf(o, "hashpipe_status{instance=\"%d\",key=\"", instance_id);
+            out_label_value(o, key);
+            out_printf(o, "\"} %.15g\n", d);
+        }
+    }
+
+    out_printf(o, "# TYPE hashpipe_thread_state gauge\n");
+    for(card=snap; *card && strncmp(card, "END", 3);
+        card += HASHPIPE_STATUS_RECORD_SIZE) {
+        quoted = parse_card(card, key, value);
+        klen = strlen(key);
+        if(quoted != 1 || klen < 4 || strcmp(key+klen-4, "STAT")) {
+            continue;
+        }
+        out_printf(o, "hashpipe_thread_state{instance=\"%d\",key=\"",
+                instance_id);
+        out_label_value(o, key);
+        out_printf(o, "\",state=\"");
+        out_label_value(o, value);
+        out_printf(o, "\"} 1\n");
+    }
+
+#define LOCK_METRIC(name, type, val) \
+    out_printf(o, "# TYPE hashpipe_status_lock_" name " " type "\n" \
+                  "hashpipe_status_lock_" name "{instance=\"%d\"} %.15g\n", \
+                  instance_id, (double)(val))
+    LOCK_METRIC("acquisitions_total", "counter", li->lock_count);
+    LOCK_METRIC("contended_total", "counter", li->contended_count);
+    LOCK_METRIC("recovered_total", "counter", li->recovered_count);
+    LOCK_METRIC("wait_seconds_total", "counter", li->wait_ns_total / 1e9);
+    LOCK_METRIC("wait_seconds_max", "gauge", li->wait_ns_max / 1e9);
+    LOCK_METRIC("hold_seconds_total", "counter", li->hold_ns_total / 1e9);
+    LOCK_METRIC("hold_seconds_max", "gauge", li->hold_ns_max / 1e9);
+#undef LOCK_METRIC
+
+    out_printf(o, "# TYPE hashpipe_databuf_blocks gauge\n");
+    for(i=1; i<=HASHPIPE_MAX_DATABUFS; i++) {
+        if(db[i]) {
+            out_printf(o, "hashpipe_databuf_blocks{instance=\"%d\","
+                    "databuf=\"%d\"} %d\n", instance_id, i, db[i]->n_block);
+        }
+    }
+    out_printf(o, "# TYPE hashpipe_databuf_block_size_bytes gauge\n");
+    for(i=1; i<=HASHPIPE_MAX_DATABUFS; i++) {
+        if(db[i]) {
+            out_printf(o, "hashpipe_databuf_block_size_bytes{instance=\"%d\","
+                    "databuf=\"%d\"} %lu\n", instance_id, i, db[i]->block_size);
+        }
+    }
+    out_printf(o, "# TYPE hashpipe_databuf_filled_blocks gauge\n");
+    for(i=1; i<=HASHPIPE_MAX_DATABUFS; i++) {
+        if(db[i]) {
+            out_printf(o, "hashpipe_databuf_filled_blocks{instance=\"%d\","
+                    "databuf=\"%d\"} %d\n", instance_id, i,
+                    hashpipe_databuf_total_status(db[i]));
+        }
+    }
+    out_printf(o, "# TYPE hashpipe_databuf_dropped_blocks_total counter\n");
+    for(i=1; i<=HASHPIPE_MAX_DATABUFS; i++) {
+        if(db[i]) {
+            out_printf(o, "hashpipe_databuf_dropped_blocks_total{instance=\"%d\","
+                    "databuf=\"%d\"} %lu\n", instance_id, i,
+                    db[i]->drops.blocks);
+        }
+    }
+}
+
+// Open listening socket for addr, which is either a TCP port number, a
+// HOST:PORT pair, or a unix domain socket path (starting with '/' or '.').
+static int metrics_listen(const char *addr)
+{
+    int fd, port, one = 1;
+    const char *colon;
+    struct sockaddr_in sin;
+    struct sockaddr_un sun;
+
+    if(addr[0] == '/' || addr[0] == '.') {
+        if(strlen(addr) >= sizeof(sun.sun_path)) {
+            hashpipe_error(__FUNCTION__, "socket path too long: %s", addr);
+            return -1;
+        }
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, addr);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd == -1) {
+            hashpipe_error(__FUNCTION__, "socket error");
+            return -1;
+        }
+        // Remove stale socket from a previous run
+        unlink(addr);
+        if(bind(fd, (struct sockaddr *)&sun, sizeof(sun))) {
+            hashpipe_error(__FUNCTION__, "bind error (%s)", addr);
+            close(fd);
+            return -1;
+        }
+    } else {
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        // Default to loopback so metrics are only served locally
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        colon = strrchr(addr, ':');
+        if(colon) {
+            char host[INET_ADDRSTRLEN] = {0};
+            strncpy(host, addr, colon-addr < INET_ADDRSTRLEN-1 ?
+                    colon-addr : INET_ADDRSTRLEN-1);
+            if(!inet_aton(host, &sin.sin_addr)) {
+                hashpipe_error(__FUNCTION__, "invalid address %s", addr);
+                return -1;
+            }
+            port = strtol(colon+1, NULL, 0);
+        } else {
+            port = strtol(addr, NULL, 0);
+        }
+        sin.sin_port = htons(port);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd == -1) {
+            hashpipe_error(__FUNCTION__, "socket error");
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(bind(fd, (struct sockaddr *)&sin, sizeof(sin))) {
+            hashpipe_error(__FUNCTION__, "bind error (%s)", addr);
+            close(fd);
+            return -1;
+        }
+    }
+
+    if(listen(fd, 8)) {
+        hashpipe_error(__FUNCTION__, "listen error");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void metrics_send(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+    while(len > 0) {
+        n = send(fd, buf, len, MSG_NOSIGNAL);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+void *hashpipe_metrics_thread_run(void *vp_args)
+{
+    hashpipe_metrics_args_t *margs = (hashpipe_metrics_args_t *)vp_args;
+    int instance_id = margs->instance_id;
+    hashpipe_status_t st;
+    hashpipe_status_lockinfo_t li;
+    hashpipe_databuf_t *db[HASHPIPE_MAX_DATABUFS+1] = {NULL};
+    metrics_out_t out = {NULL, 0, 0};
+    metrics_out_t body = {NULL, 0, 0};
+    char *snap;
+    char req[1024];
+    struct pollfd pfd[2];
+    int lfd, cfd, i;
+    void * rv = THREAD_OK;
+
+    if(hashpipe_status_attach(instance_id, &st) != HASHPIPE_OK) {
+        hashpipe_error(__FUNCTION__,
+                "Error attaching to status shared memory.");
+        return THREAD_ERROR;
+    }
+
+    snap = malloc(st.buf_size+1);
+    lfd = metrics_listen(margs->addr);
+    if(!snap || lfd == -1) {
+        rv = THREAD_ERROR;
+        goto done;
+    }
+    hashpipe_info(__FUNCTION__, "serving metrics on %s", margs->addr);
+
+    pfd[0].fd = lfd;
+    pfd[0].events = POLLIN;
+    // Wake up when threads are asked to stop
+    pfd[1].fd = hashpipe_stop_fd();
+    pfd[1].events = POLLIN;
+    while(run_threads()) {
+        // Also wake up periodically to check run_threads()
+        if(poll(pfd, 2, 250) <= 0 || !(pfd[0].revents & POLLIN)) {
+            continue;
+        }
+        cfd = accept(lfd, NULL, NULL);
+        if(cfd == -1) {
+            continue;
+        }
+
+        // Read (and ignore) the request.  Every path serves the metrics.
+        pfd[0].fd = cfd;
+        if(poll(pfd, 1, 1000) > 0) {
+            recv(cfd, req, sizeof(req), 0);
+        }
+        pfd[0].fd = lfd;
+
+        // Attach to any databufs that have appeared since last scrape
+        for(i=1; i<=HASHPIPE_MAX_DATABUFS; i++) {
+            if(!db[i]) {
+                db[i] = hashpipe_databuf_attach(instance_id, i);
+            }
+        }
+
+        body.len = 0;
+        if(hashpipe_status_snapshot(&st, snap, st.buf_size+1,
+                    &li) >= 0) {
+            format_metrics(&body, instance_id, snap, &li, db);
+        }
+
+        out.len = 0;
+        out_printf(&out, "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %lu\r\n"
+                "Connection: close\r\n\r\n", body.len);
+        metrics_send(cfd, out.buf, out.len);
+        if(body.len) {
+            metrics_send(cfd, body.buf, body.len);
+        }
+        close(cfd);
+    }
+
+    close(lfd);
+    if(margs->addr[0] == '/' || margs->addr[0] == '.') {
+        unlink(margs->addr);
+    }
+
+done:
+    for(i=1; i<=HASHPIPE_MAX_DATABUFS; i++) {
+        hashpipe_databuf_detach(db[i]);
+    }
+    free(out.buf);
+    free(body.buf);
+    free(snap);
+    hashpipe_status_detach(&st);
+
+    return rv;
+}
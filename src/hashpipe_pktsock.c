@@ -27,6 +27,7 @@
 #include <poll.h>
 
 #include "hashpipe_pktsock.h"
+#include "hashpipe_probes.h"
 
 //#define PKTSOCK_PROTO ETH_P_ALL
 #define PKTSOCK_PROTO ETH_P_IP
@@ -116,6 +117,8 @@ unsigned char * hashpipe_pktsock_recv_frame_nonblock(struct hashpipe_pktsock *p_
     p_ps->next_idx = 0;
   }
 
+  HASHPIPE_PROBE2(pktsock_recv, p_ps, frame);
+
   return frame;
 }
 
@@ -194,6 +197,7 @@ unsigned char * hashpipe_pktsock_recv_udp_frame(
 // Releases frame back to the kernel
 void hashpipe_pktsock_release_frame(unsigned char * frame)
 {
+  HASHPIPE_PROBE1(pktsock_release, frame);
   TPACKET_HDR(frame, tp_status) = TP_STATUS_KERNEL;
 }
 
@@ -0,0 +1,62 @@
+/* hashpipe_probes.h
+ *
+ * USDT (SystemTap/DTrace style) static probes of the "hashpipe" provider.
+ * When <sys/sdt.h> is available at build time (e.g. from the
+ * systemtap-sdt-dev or systemtap-sdt-devel package), each probe compiles to
+ * a single nop plus an ELF note, so probes cost next to nothing until a
+ * tracer such as perf or bpftrace attaches to them.  Otherwise they compile
+ * to nothing.  List them with e.g. "bpftrace -l 'usdt:libhashpipe.so:*'".
+ *
+ * Probes and their arguments:
+ *
+ *   databuf_create       instance_id, databuf_id, databuf, semid
+ *   databuf_attach       instance_id, databuf_id, databuf, semid
+ *   databuf_wait_filled  databuf, semid, block_id (wait starts)
+ *   databuf_wait_filled_return
+ *                        databuf, semid, block_id, rv (wait ends, rv is 0
+ *                        if the block is ready, -1 on timeout or error)
+ *   databuf_wait_free    databuf, semid, block_id (wait starts)
+ *   databuf_wait_free_return
+ *                        databuf, semid, block_id, rv (as for wait_filled)
+ *   databuf_set_filled   databuf, semid, block_id
+ *   databuf_set_free     databuf, semid, block_id
+ *   status_lock          status buffer (lock requested)
+ *   status_lock_return   status buffer, rv (0 if lock acquired)
+ *   status_unlock        status buffer
+ *   pktsock_recv         pktsock, frame
+ *   pktsock_release      frame
+ *   thread_start         thread name, Linux thread id
+ *   thread_stop          thread name, Linux thread id, run function result
+ *
+ * The busywait databuf functions fire the same probes as their waiting
+ * counterparts.  Databufs are best identified by semid, which is the same in
+ * every process attached to a databuf.
+ *
+ * This header is private to hashpipe and is not installed.
+ */
+#ifndef _HASHPIPE_PROBES_H
+#define _HASHPIPE_PROBES_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(HAVE_SYS_SDT_H) && !defined(HASHPIPE_NO_PROBES)
+#include <sys/sdt.h>
+
+#define HASHPIPE_PROBE1(name, a) DTRACE_PROBE1(hashpipe, name, a)
+#define HASHPIPE_PROBE2(name, a, b) DTRACE_PROBE2(hashpipe, name, a, b)
+#define HASHPIPE_PROBE3(name, a, b, c) DTRACE_PROBE3(hashpipe, name, a, b, c)
+#define HASHPIPE_PROBE4(name, a, b, c, d) \
+    DTRACE_PROBE4(hashpipe, name, a, b, c, d)
+
+#else
+
+#define HASHPIPE_PROBE1(name, a) do {} while(0)
+#define HASHPIPE_PROBE2(name, a, b) do {} while(0)
+#define HASHPIPE_PROBE3(name, a, b, c) do {} while(0)
+#define HASHPIPE_PROBE4(name, a, b, c, d) do {} while(0)
+
+#endif
+
+#endif // _HASHPIPE_PROBES_H
@@ -0,0 +1,40 @@
+/*
+ * hashpipe_shard_thread.c
+ *
+ * Framework thread that periodically merges the per-thread status shards
+ * (see hashpipe_status_shard_attach) into the status buffer.  It is started
+ * by the hashpipe executable when the --status-shards option is given.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hashpipe.h"
+#include "hashpipe_thread_args.h"
+
+void *hashpipe_shard_thread_run(void *vp_interval)
+{
+    double interval = *(double *)vp_interval;
+    long interval_ns = interval * 1e9;
+    struct timespec next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while(run_threads()) {
+        hashpipe_status_shard_sync_all();
+
+        // Sleep until next merge time
+        next.tv_sec  += interval_ns / 1000000000;
+        next.tv_nsec += interval_ns % 1000000000;
+        if(next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    // Shards are merged one last time when their threads detach from them
+
+    return THREAD_OK;
+}
@@ -0,0 +1,203 @@
+/* hashpipe_stage.c
+ *
+ * Standard pipeline thread loop (see hashpipe_stage_run() in hashpipe.h).
+ */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hashpipe.h"
+
+// Interval (in seconds) at which stage status is updated
+#define STAGE_STATUS_INTERVAL 1.0
+
+// Stage state and statistics since the last status update
+typedef struct {
+    const char *state;
+    uint64_t blocks;      // Total blocks processed
+    uint64_t last_blocks; // Total blocks processed at last update
+    uint64_t out_seq;     // Output blocks filled or dropped
+    uint64_t proc_count;  // Calls of process since last update
+    double proc_sum;      // Time spent in process since last update
+    double proc_max;      // Longest call of process since last update
+    double last_update;
+} stage_stats_t;
+
+static double
+stage_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Store stage status if it is time to do so
+static void
+stage_status(hashpipe_thread_args_t *args, stage_stats_t *stats, double now)
+{
+    const char *skey = args->thread_desc->skey;
+    double dt = now - stats->last_update;
+    char key[9];
+    int changed;
+
+    if(dt < STAGE_STATUS_INTERVAL) {
+        return;
+    }
+
+    hashpipe_status_lock_safe(&args->st);
+    changed = 0;
+    if(skey && *skey) {
+        changed |= hashpipe_status_puts_changed(&args->st, skey, stats->state);
+    }
+    hashpipe_thread_status_key(args, "BLKS", key);
+    changed |= hashpipe_status_putnr8_changed(&args->st, key, 0,
+            stats->blocks);
+    hashpipe_thread_status_key(args, "BPS", key);
+    changed |= hashpipe_status_putnr8_changed(&args->st, key, 1,
+            (stats->blocks - stats->last_blocks) / dt);
+    hashpipe_thread_status_key(args, "PRUS", key);
+    changed |= hashpipe_status_putnr8_changed(&args->st, key, 1,
+            stats->proc_count ? 1e6 * stats->proc_sum / stats->proc_count
+                              : 0.0);
+    hashpipe_thread_status_key(args, "PRMX", key);
+    changed |= hashpipe_status_putnr8_changed(&args->st, key, 1,
+            1e6 * stats->proc_max);
+    hashpipe_status_unlock_changed_safe(&args->st, changed);
+
+    stats->last_blocks = stats->blocks;
+    stats->proc_count = 0;
+    stats->proc_sum = 0;
+    stats->proc_max = 0;
+    stats->last_update = now;
+}
+
+// Wait for block *block of db to become filled (or free if filled is zero).
+// Free blocks are acquired with hashpipe_databuf_acquire_free(), so the
+// databuf's overflow policy applies, except that stages without an input
+// databuf have no data of their own to drop and wait under drop-newest.
+// Returns HASHPIPE_OK once the block is filled (free), HASHPIPE_DROPPED if
+// the stage's input block is to be dropped, HASHPIPE_TIMEOUT if threads are
+// asked to stop first, or an error code.
+static int
+stage_wait(hashpipe_thread_args_t *args, stage_stats_t *stats,
+        hashpipe_databuf_t *db, int *block, int filled)
+{
+    int rv;
+
+    for(;;) {
+        if(filled) {
+            rv = hashpipe_databuf_wait_filled(db, *block);
+        } else if(!args->ibuf
+               && db->overflow_policy == HASHPIPE_OVERFLOW_DROP) {
+            rv = hashpipe_databuf_wait_free(db, *block);
+        } else {
+            rv = hashpipe_databuf_acquire_free(db, block, stats->out_seq,
+                    NULL);
+        }
+        if(rv != HASHPIPE_TIMEOUT) {
+            break;
+        }
+        if(!run_threads()) {
+            return HASHPIPE_TIMEOUT;
+        }
+        stats->state = "waiting";
+        stage_status(args, stats, stage_time());
+    }
+    if(rv != HASHPIPE_OK && rv != HASHPIPE_DROPPED) {
+        hashpipe_error(args->thread_desc->name,
+                "error waiting for %s block %d", filled ? "filled" : "free",
+                *block);
+    }
+    return rv;
+}
+
+void *hashpipe_stage_run(hashpipe_thread_args_t *args,
+        hashpipe_stage_process_t process)
+{
+    hashpipe_databuf_t *ibuf = args->ibuf;
+    hashpipe_databuf_t *obuf = args->obuf;
+    int in_block = ibuf ? hashpipe_thread_first_block(args, ibuf) : 0;
+    int out_block = obuf ? hashpipe_thread_first_block(args, obuf) : 0;
+    char *in = NULL, *out = NULL;
+    stage_stats_t stats = {"waiting", 0, 0, 0, 0, 0, 0, 0};
+    double start, t;
+    int rv;
+
+    stats.last_update = stage_time();
+
+    while(run_threads()) {
+        // Wait for input and output blocks
+        if(ibuf) {
+            rv = stage_wait(args, &stats, ibuf, &in_block, 1);
+            if(rv == HASHPIPE_TIMEOUT) {
+                break;
+            } else if(rv != HASHPIPE_OK) {
+                return THREAD_ERROR;
+            }
+            in = hashpipe_databuf_data(ibuf, in_block);
+        }
+        if(obuf) {
+            rv = stage_wait(args, &stats, obuf, &out_block, 0);
+            if(rv == HASHPIPE_TIMEOUT) {
+                break;
+            } else if(rv == HASHPIPE_DROPPED) {
+                // Output databuf is full, drop input block unprocessed
+                stats.out_seq++;
+                hashpipe_databuf_set_free(ibuf, in_block);
+                in_block = hashpipe_thread_next_block(args, ibuf, in_block);
+                stage_status(args, &stats, stage_time());
+                pthread_testcancel();
+                continue;
+            } else if(rv != HASHPIPE_OK) {
+                return THREAD_ERROR;
+            }
+            out = hashpipe_databuf_data(obuf, out_block);
+        }
+
+        // Process blocks
+        stats.state = "processing";
+        start = stage_time();
+        rv = process(args, in, in_block, out, out_block);
+        t = stage_time();
+        // Idle calls (HASHPIPE_TIMEOUT) would skew the time per block
+        if(rv != HASHPIPE_TIMEOUT) {
+            stats.proc_count++;
+            stats.proc_sum += t - start;
+            if(t - start > stats.proc_max) {
+                stats.proc_max = t - start;
+            }
+        }
+
+        if(rv < 0) {
+            hashpipe_error(args->thread_desc->name,
+                    "error %d processing input block %d, output block %d",
+                    rv, in_block, out_block);
+            return THREAD_ERROR;
+        } else if(rv == HASHPIPE_STAGE_DONE) {
+            break;
+        }
+
+        // Pass on output block and release input block
+        if(obuf && rv == HASHPIPE_OK) {
+            hashpipe_databuf_set_filled(obuf, out_block);
+            stats.out_seq++;
+            out_block = hashpipe_thread_next_block(args, obuf, out_block);
+        }
+        if(ibuf && rv != HASHPIPE_TIMEOUT) {
+            hashpipe_databuf_set_free(ibuf, in_block);
+            in_block = hashpipe_thread_next_block(args, ibuf, in_block);
+        }
+        if(rv != HASHPIPE_TIMEOUT) {
+            stats.blocks++;
+        }
+
+        stage_status(args, &stats, t);
+
+        // Will exit if thread has been cancelled
+        pthread_testcancel();
+    }
+
+    return THREAD_OK;
+}
@@ -0,0 +1,404 @@
+/*
+ * hashpipe_stats_thread.c
+ *
+ * Framework thread that periodically measures how much CPU each pipeline
+ * thread uses and stores the results in the status buffer.  For every thread
+ * it stores
+ *
+ *   <PREFIX>CPUT  total CPU time used by the thread (seconds)
+ *   <PREFIX>UTIL  CPU utilisation over the last interval (percent of one CPU)
+ *
+ *   <PREFIX>CSPS  context switches per second over the last interval
+ *   <PREFIX>WTIN  percent of the last interval spent waiting for filled
+ *                 input blocks (i.e. starved)
+ *   <PREFIX>WTOU  percent of the last interval spent waiting for free
+ *                 output blocks (i.e. back-pressured)
+ *
+ * and, if the thread's hardware performance counters could be opened (which
+ * depends on the CPU, on virtualization and on
+ * /proc/sys/kernel/perf_event_paranoid), for the last interval
+ *
+ *   <PREFIX>IPC   instructions per cycle
+ *   <PREFIX>CMPS  cache misses per second
+ *
+ * where <PREFIX> is derived from the thread's skey (see
+ * hashpipe_thread_status_key).  Counters only count user space events, so
+ * they work at the default perf_event_paranoid level of 2.  A thread with
+ * low utilisation spends most of its time blocked, usually waiting for its
+ * databufs.
+ *
+ * BOTTLNCK names the thread that currently limits the pipeline's throughput:
+ * the busiest thread (i.e. the one spending the smallest fraction of the
+ * interval waiting on databufs) whose upstream threads wait for free blocks
+ * and whose downstream threads wait for filled blocks.  It is "none" if no
+ * thread fits that description.
+ *
+ * It is started by the hashpipe executable when the --thread-stats option
+ * is given.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "hashpipe.h"
+#include "hashpipe_thread_args.h"
+
+// Performance counters opened for each thread
+enum {
+    STATS_CYCLES,
+    STATS_INSTRUCTIONS,
+    STATS_CACHE_MISSES,
+    STATS_NUM_COUNTERS
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} counter_desc[STATS_NUM_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}
+};
+
+// Minimum fraction of time that threads upstream (downstream) of a thread
+// must spend waiting for free (filled) blocks for that thread to be
+// considered the bottleneck
+#define STATS_BOTTLENECK_WAIT 0.05
+
+// Per-thread measurement state
+typedef struct {
+    pid_t tid; // Thread being measured (threads get a new tid on restart)
+    int fd[STATS_NUM_COUNTERS];
+    uint64_t count[STATS_NUM_COUNTERS];
+    double cpu_time;
+    long ctxt_switches;
+    uint64_t wait_ns[2];
+    // Fraction of last interval spent waiting for free and filled blocks,
+    // valid only if running is non-zero
+    double wait_frac[2];
+    int running;
+} thread_stats_t;
+
+// Open counter i of thread tid.  Returns file descriptor or -1.
+static int
+open_counter(pid_t tid, int i)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_desc[i].type;
+    attr.config = counter_desc[i].config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                     | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Read counter, scaled for any time it was not counting because the CPU's
+// counters were multiplexed.  Returns 0 on success.
+static int
+read_counter(int fd, uint64_t *count)
+{
+    uint64_t v[3]; // value, time enabled, time running
+
+    if(read(fd, v, sizeof(v)) != sizeof(v)) {
+        return -1;
+    }
+    *count = v[2] ? (uint64_t)((double)v[0] * v[1] / v[2]) : 0;
+    return 0;
+}
+
+// Returns number of (voluntary and involuntary) context switches of thread
+// tid, or -1 on error.  These are not counted by the perf counters because
+// they happen in the kernel.
+static long
+context_switches(pid_t tid)
+{
+    char line[128];
+    FILE *f;
+    long n, total = -1;
+
+    snprintf(line, sizeof(line), "/proc/self/task/%d/status", tid);
+    if(!(f = fopen(line, "r"))) {
+        return -1;
+    }
+    while(fgets(line, sizeof(line), f)) {
+        if(sscanf(line, "voluntary_ctxt_switches: %ld", &n) == 1
+        || sscanf(line, "nonvoluntary_ctxt_switches: %ld", &n) == 1) {
+            total = total < 0 ? n : total + n;
+        }
+    }
+    fclose(f);
+    return total;
+}
+
+// Get wait times of args (see hashpipe_thread_args_t), including the current
+// wait (if any) up to now_ns
+static void
+wait_times(hashpipe_thread_args_t *args, uint64_t now_ns, uint64_t *wait_ns)
+{
+    uint64_t start = __atomic_load_n(&args->wait_start_ns, __ATOMIC_ACQUIRE);
+
+    wait_ns[0] = __atomic_load_n(&args->wait_ns[0], __ATOMIC_RELAXED);
+    wait_ns[1] = __atomic_load_n(&args->wait_ns[1], __ATOMIC_RELAXED);
+    if(start && start < now_ns) {
+        wait_ns[args->wait_filled ? 1 : 0] += now_ns - start;
+    }
+}
+
+// Returns non-zero if thread a writes to any input databuf of thread b
+static int
+feeds(hashpipe_thread_args_t *a, hashpipe_thread_args_t *b)
+{
+    int i, j;
+
+    for(i=0; i<a->num_outputs; i++) {
+        for(j=0; j<b->num_inputs; j++) {
+            if(a->output_buffers[i] == b->input_buffers[j]) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Returns index of the thread that limits throughput (see above), or -1
+static int
+find_bottleneck(hashpipe_thread_args_t *args, thread_stats_t *stats, int n)
+{
+    int i, j, found = -1;
+    int has_up, up_waits, has_down, down_waits;
+    double busy, max_busy = -1;
+
+    for(i=0; i<n; i++) {
+        if(!stats[i].running) {
+            continue;
+        }
+        // Upstream threads must be back-pressured and downstream threads
+        // starved, unless there are none
+        has_up = up_waits = has_down = down_waits = 0;
+        for(j=0; j<n; j++) {
+            if(j == i || !stats[j].running) {
+                continue;
+            }
+            if(feeds(&args[j], &args[i])) {
+                has_up = 1;
+                if(stats[j].wait_frac[0] >= STATS_BOTTLENECK_WAIT) {
+                    up_waits = 1;
+                }
+            }
+            if(feeds(&args[i], &args[j])) {
+                has_down = 1;
+                if(stats[j].wait_frac[1] >= STATS_BOTTLENECK_WAIT) {
+                    down_waits = 1;
+                }
+            }
+        }
+        if((has_up && !up_waits) || (has_down && !down_waits)) {
+            continue;
+        }
+        busy = 1 - stats[i].wait_frac[0] - stats[i].wait_frac[1];
+        if(busy > max_busy) {
+            max_busy = busy;
+            found = i;
+        }
+    }
+    return found;
+}
+
+static double
+cpu_seconds(clockid_t clock)
+{
+    struct timespec ts;
+
+    if(clock_gettime(clock, &ts)) {
+        return -1;
+    }
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Start measuring thread of args (closing counters of any thread measured
+// before)
+static void
+start_stats(thread_stats_t *stats, hashpipe_thread_args_t *args,
+        uint64_t now_ns)
+{
+    int c;
+    pid_t old_tid = stats->tid;
+
+    stats->tid = __atomic_load_n(&args->tid, __ATOMIC_ACQUIRE);
+    stats->cpu_time = cpu_seconds(args->cpu_clock);
+    stats->ctxt_switches = context_switches(stats->tid);
+    wait_times(args, now_ns, stats->wait_ns);
+    for(c=0; c<STATS_NUM_COUNTERS; c++) {
+        if(stats->fd[c] != -1) {
+            close(stats->fd[c]);
+        }
+        stats->fd[c] = stats->tid ? open_counter(stats->tid, c) : -1;
+        if(stats->fd[c] == -1) {
+            // Only report this once, not on every restart
+            if(c == STATS_CYCLES && !old_tid) {
+                hashpipe_info(__FUNCTION__, "no performance counters "
+                        "for thread %s (%s)", args->thread_desc->name,
+                        strerror(errno));
+            }
+            errno = 0;
+        } else {
+            read_counter(stats->fd[c], &stats->count[c]);
+        }
+    }
+}
+
+void *hashpipe_stats_thread_run(void *vp_args)
+{
+    hashpipe_stats_args_t *sargs = (hashpipe_stats_args_t *)vp_args;
+    hashpipe_thread_args_t *args;
+    hashpipe_status_t st;
+    struct timespec ts;
+    long interval_ns = sargs->interval * 1e9;
+    int i, c, n = sargs->num_threads;
+    thread_stats_t *stats;
+    uint64_t count[STATS_NUM_COUNTERS];
+    uint64_t delta[STATS_NUM_COUNTERS];
+    int have[STATS_NUM_COUNTERS];
+    int changed;
+    double cpu_time, now, last = 0, dt;
+    long ctxt_switches;
+    uint64_t now_ns, wait_ns[2];
+    char key[9];
+
+    if(hashpipe_status_attach(sargs->instance_id, &st) != HASHPIPE_OK) {
+        hashpipe_error(__FUNCTION__,
+                "Error attaching to status shared memory.");
+        return THREAD_ERROR;
+    }
+
+    stats = calloc(n, sizeof(thread_stats_t));
+    if(!stats) {
+        hashpipe_error(__FUNCTION__, "Error allocating thread stats.");
+        hashpipe_status_detach(&st);
+        return THREAD_ERROR;
+    }
+
+    for(i=0; i<n; i++) {
+        for(c=0; c<STATS_NUM_COUNTERS; c++) {
+            stats[i].fd[c] = -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        start_stats(&stats[i], &sargs->args[i],
+                (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    last = ts.tv_sec + 1e-9 * ts.tv_nsec;
+    while(run_threads()) {
+        // Sleep until next sample time
+        ts.tv_sec  += interval_ns / 1000000000;
+        ts.tv_nsec += interval_ns % 1000000000;
+        if(ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        now = ts.tv_sec + 1e-9 * ts.tv_nsec;
+        now_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        dt = now - last;
+        last = now;
+
+        for(i=0; i<n; i++) {
+            args = &sargs->args[i];
+
+            // CPU time clock is invalid once the thread has exited
+            cpu_time = cpu_seconds(args->cpu_clock);
+            if(cpu_time < 0) {
+                errno = 0;
+                stats[i].running = 0;
+                continue;
+            }
+            // Start over with a thread that has been restarted
+            if(__atomic_load_n(&args->tid, __ATOMIC_ACQUIRE) != stats[i].tid) {
+                start_stats(&stats[i], args, now_ns);
+                stats[i].running = 0;
+                continue;
+            }
+            ctxt_switches = context_switches(args->tid);
+            wait_times(args, now_ns, wait_ns);
+            for(c=0; c<2; c++) {
+                stats[i].wait_frac[c] = 1e-9 * (wait_ns[c] - stats[i].wait_ns[c]) / dt;
+                stats[i].wait_ns[c] = wait_ns[c];
+            }
+            stats[i].running = 1;
+            for(c=0; c<STATS_NUM_COUNTERS; c++) {
+                have[c] = stats[i].fd[c] != -1
+                    && !read_counter(stats[i].fd[c], &count[c]);
+                if(have[c]) {
+                    delta[c] = count[c] - stats[i].count[c];
+                    stats[i].count[c] = count[c];
+                }
+            }
+
+            changed = 0;
+            hashpipe_status_lock_safe(&st);
+            hashpipe_thread_status_key(args, "CPUT", key);
+            changed |= hashpipe_status_putnr8_changed(&st, key, 3, cpu_time);
+            hashpipe_thread_status_key(args, "UTIL", key);
+            changed |= hashpipe_status_putnr8_changed(&st, key, 1,
+                    100 * (cpu_time - stats[i].cpu_time) / dt);
+            if(have[STATS_CYCLES] && have[STATS_INSTRUCTIONS]) {
+                hashpipe_thread_status_key(args, "IPC", key);
+                changed |= hashpipe_status_putnr8_changed(&st, key, 2,
+                        delta[STATS_CYCLES]
+                        ? (double)delta[STATS_INSTRUCTIONS]
+                          / delta[STATS_CYCLES] : 0.0);
+            }
+            if(have[STATS_CACHE_MISSES]) {
+                hashpipe_thread_status_key(args, "CMPS", key);
+                changed |= hashpipe_status_putnr8_changed(&st, key, 0,
+                        delta[STATS_CACHE_MISSES] / dt);
+            }
+            if(ctxt_switches >= 0 && stats[i].ctxt_switches >= 0) {
+                hashpipe_thread_status_key(args, "CSPS", key);
+                changed |= hashpipe_status_putnr8_changed(&st, key, 0,
+                        (ctxt_switches - stats[i].ctxt_switches) / dt);
+            }
+            hashpipe_thread_status_key(args, "WTIN", key);
+            changed |= hashpipe_status_putnr8_changed(&st, key, 1,
+                    100 * stats[i].wait_frac[1]);
+            hashpipe_thread_status_key(args, "WTOU", key);
+            changed |= hashpipe_status_putnr8_changed(&st, key, 1,
+                    100 * stats[i].wait_frac[0]);
+            hashpipe_status_unlock_changed_safe(&st, changed);
+
+            stats[i].cpu_time = cpu_time;
+            stats[i].ctxt_switches = ctxt_switches;
+        }
+
+        i = find_bottleneck(sargs->args, stats, n);
+        hashpipe_status_lock_safe(&st);
+        changed = hashpipe_status_puts_changed(&st, "BOTTLNCK", i < 0 ? "none"
+                : sargs->args[i].thread_desc->name);
+        hashpipe_status_unlock_changed_safe(&st, changed);
+    }
+
+    for(i=0; i<n; i++) {
+        for(c=0; c<STATS_NUM_COUNTERS; c++) {
+            if(stats[i].fd[c] != -1) {
+                close(stats[i].fd[c]);
+            }
+        }
+    }
+    free(stats);
+    hashpipe_status_detach(&st);
+
+    return THREAD_OK;
+}
@@ -3,6 +3,7 @@
  * Implementation of the status routines described 
  * in hashpipe_status.h
  */
+#define _GNU_SOURCE 1
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,11 +14,19 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <semaphore.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <errno.h>
 
 #include "hashpipe_ipckey.h"
 #include "hashpipe_status.h"
 #include "hashpipe_error.h"
+#include "hashpipe_trace.h"
+#include "hashpipe_probes.h"
 #include "fitshead.h"
 
 /*
@@ -78,15 +87,105 @@ int hashpipe_status_exists(int instance_id)
         hashpipe_error("hashpipe_status_attach", "hashpipe_status_key error");
         return 0;
     }
-    int shmid = shmget(key, HASHPIPE_STATUS_TOTAL_SIZE, 0666);
+    int shmid = shmget(key, 0, 0666);
     return (shmid==-1) ? 0 : 1;
 }
 
-int hashpipe_status_attach(int instance_id, hashpipe_status_t *s)
+/* Round size up to a whole number of FITS blocks */
+static size_t hashpipe_status_round_size(size_t size)
+{
+    return (size + HASHPIPE_STATUS_BLOCK_SIZE - 1)
+        / HASHPIPE_STATUS_BLOCK_SIZE * HASHPIPE_STATUS_BLOCK_SIZE;
+}
+
+/* Size used when creating a status buffer without an explicit size */
+static size_t hashpipe_status_default_size()
+{
+    const char * envstr = getenv("HASHPIPE_STATUS_SIZE");
+    size_t size = HASHPIPE_STATUS_TOTAL_SIZE;
+    if(envstr) {
+        size = strtoul(envstr, NULL, 0);
+        if(size < HASHPIPE_STATUS_BLOCK_SIZE) {
+            size = HASHPIPE_STATUS_BLOCK_SIZE;
+        }
+    }
+    return hashpipe_status_round_size(size);
+}
+
+/* Replace the unattached status segment shmid with a new segment large enough
+ * for size bytes of records, preserving the records and control area.
+ * Returns the new shmid or -1 on error.
+ */
+static int hashpipe_status_grow(key_t key, int shmid, size_t size)
+{
+    struct shmid_ds ds;
+    size_t old_size;
+    char *old_buf, *new_buf;
+    int new_shmid;
+
+    if(shmctl(shmid, IPC_STAT, &ds)) {
+        hashpipe_error(__FUNCTION__, "shmctl error");
+        return -1;
+    }
+    if(ds.shm_nattch != 0) {
+        hashpipe_error(__FUNCTION__,
+            "cannot grow status buffer while %lu processes are attached",
+            ds.shm_nattch);
+        return -1;
+    }
+    old_size = ds.shm_segsz - HASHPIPE_STATUS_CTL_SIZE;
+
+    // Save old contents
+    old_buf = malloc(ds.shm_segsz);
+    new_buf = shmat(shmid, NULL, 0);
+    if(!old_buf || new_buf == (void *)-1) {
+        hashpipe_error(__FUNCTION__, "error saving old status buffer");
+        free(old_buf);
+        return -1;
+    }
+    memcpy(old_buf, new_buf, ds.shm_segsz);
+    shmdt(new_buf);
+
+    // Replace segment
+    if(shmctl(shmid, IPC_RMID, NULL)) {
+        hashpipe_error(__FUNCTION__, "shmctl error");
+        free(old_buf);
+        return -1;
+    }
+    new_shmid = shmget(key, size + HASHPIPE_STATUS_CTL_SIZE,
+                       0666 | IPC_CREAT | IPC_EXCL);
+    if(new_shmid == -1) {
+        hashpipe_error(__FUNCTION__, "shmget error");
+        free(old_buf);
+        return -1;
+    }
+
+    // Restore old contents (new segment is zero filled by the kernel)
+    new_buf = shmat(new_shmid, NULL, 0);
+    if(new_buf == (void *)-1) {
+        hashpipe_error(__FUNCTION__, "shmat error");
+        free(old_buf);
+        return -1;
+    }
+    memcpy(new_buf, old_buf, old_size);
+    memcpy(new_buf + size, old_buf + old_size, HASHPIPE_STATUS_CTL_SIZE);
+    ((hashpipe_status_ctl_t *)(new_buf + size))->waiters = 0;
+    shmdt(new_buf);
+    free(old_buf);
+
+    hashpipe_info(__FUNCTION__, "grew status buffer from %lu to %lu bytes",
+        old_size, size);
+
+    return new_shmid;
+}
+
+int hashpipe_status_create(int instance_id, hashpipe_status_t *s, size_t size)
 {
     char semid[NAME_MAX] = {'\0'};
+    struct shmid_ds ds;
     instance_id &= 0x3f;
     s->instance_id = instance_id;
+    s->shard = NULL;
 
     /* Get shared mem id (creating it if necessary) */
     key_t key = hashpipe_status_key(instance_id);
@@ -94,11 +193,41 @@ int hashpipe_status_attach(int instance_id, hashpipe_status_t *s)
         hashpipe_error("hashpipe_status_attach", "hashpipe_status_key error");
         return(0);
     }
-    s->shmid = shmget(key, HASHPIPE_STATUS_TOTAL_SIZE, 0666 | IPC_CREAT);
+    if(size) {
+        size = hashpipe_status_round_size(size);
+    }
+    s->shmid = shmget(key, 0, 0666);
+    if (s->shmid==-1 && errno == ENOENT) {
+        errno = 0;
+        s->shmid = shmget(key,
+            (size ? size : hashpipe_status_default_size())
+                + HASHPIPE_STATUS_CTL_SIZE, 0666 | IPC_CREAT);
+    }
     if (s->shmid==-1) { 
         hashpipe_error("hashpipe_status_attach", "shmget error");
         return(HASHPIPE_ERR_SYS);
     }
+    if (shmctl(s->shmid, IPC_STAT, &ds)) {
+        hashpipe_error("hashpipe_status_attach", "shmctl error");
+        return(HASHPIPE_ERR_SYS);
+    }
+    if (ds.shm_segsz < HASHPIPE_STATUS_BLOCK_SIZE + HASHPIPE_STATUS_CTL_SIZE
+    || (ds.shm_segsz - HASHPIPE_STATUS_CTL_SIZE) % HASHPIPE_STATUS_BLOCK_SIZE) {
+        // Most likely a segment created by an older version without
+        // room for the control area.
+        hashpipe_error("hashpipe_status_attach",
+            "existing status segment has unexpected size, "
+            "try \"hashpipe_clean_shmem -d -I %d\"", instance_id);
+        return(HASHPIPE_ERR_SYS);
+    }
+    if (size && ds.shm_segsz < size + HASHPIPE_STATUS_CTL_SIZE) {
+        s->shmid = hashpipe_status_grow(key, s->shmid, size);
+        if (s->shmid==-1) {
+            return(HASHPIPE_ERR_SYS);
+        }
+        ds.shm_segsz = size + HASHPIPE_STATUS_CTL_SIZE;
+    }
+    s->buf_size = ds.shm_segsz - HASHPIPE_STATUS_CTL_SIZE;
 
     /* Now attach to the segment */
     s->buf = shmat(s->shmid, NULL, 0);
@@ -108,6 +237,10 @@ int hashpipe_status_attach(int instance_id, hashpipe_status_t *s)
         hashpipe_error("hashpipe_status_attach", "shmat error");
         return(HASHPIPE_ERR_SYS);
     }
+    s->ctl = (hashpipe_status_ctl_t *)(s->buf + s->buf_size);
+
+    /* Let hget/hput functions know how long the buffer is */
+    hlength(s->buf, s->buf_size);
 
     /*
      * Get the semaphore name.  Return error on truncation.
@@ -134,60 +267,442 @@ int hashpipe_status_attach(int instance_id, hashpipe_status_t *s)
     return(HASHPIPE_OK);
 }
 
+int hashpipe_status_attach(int instance_id, hashpipe_status_t *s)
+{
+    return hashpipe_status_create(instance_id, s, 0);
+}
+
+static int hashpipe_status_shard_detach(hashpipe_status_t *s);
+
 int hashpipe_status_detach(hashpipe_status_t *s) {
+    if(s && s->shard) {
+      return hashpipe_status_shard_detach(s);
+    }
     if(s && s->buf) {
+      hlength(s->buf, -1);
       int rv = shmdt(s->buf);
       if (rv!=0) {
           hashpipe_error("hashpipe_status_detach", "shmdt error");
           return HASHPIPE_ERR_SYS;
       }
       s->buf = NULL;
+      s->ctl = NULL;
     }
     return HASHPIPE_OK;
 }
 
-/* TODO: put in some (long, ~few sec) timeout */
+static uint64_t hashpipe_status_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Record the calling thread as the lock holder and account for the time
+ * spent waiting since wait_start_ns (0 if the lock was acquired without
+ * waiting).  Must be called with the lock held.
+ */
+static void hashpipe_status_lock_acquired(hashpipe_status_t *s,
+                                          uint64_t wait_start_ns)
+{
+    hashpipe_status_lockinfo_t *li = &s->ctl->lock;
+    uint64_t now_ns = hashpipe_status_now_ns();
+    uint64_t wait_ns = wait_start_ns ? now_ns - wait_start_ns : 0;
+
+    hashpipe_trace_event(HASHPIPE_TRACE_STATUS_LOCK, HASHPIPE_TRACE_END, -1, 0);
+    hashpipe_trace_event(HASHPIPE_TRACE_STATUS_HELD, HASHPIPE_TRACE_BEGIN, -1, 0);
+    HASHPIPE_PROBE2(status_lock_return, s, 0);
+    li->holder_pid = getpid();
+    li->holder_tid = syscall(SYS_gettid);
+    li->hold_start_ns = now_ns;
+    li->lock_count++;
+    if(wait_start_ns) {
+        li->contended_count++;
+        li->wait_ns_total += wait_ns;
+        if(wait_ns > li->wait_ns_max) {
+            li->wait_ns_max = wait_ns;
+        }
+    }
+}
+
+/* If the process recorded as holding the lock no longer exists, release the
+ * lock on its behalf.  Returns 1 if the lock was released, 0 otherwise.  The
+ * compare-and-swap on holder_pid ensures that only one of several waiters
+ * releases the lock.
+ */
+static int hashpipe_status_recover_dead_holder(hashpipe_status_t *s)
+{
+    hashpipe_status_lockinfo_t *li = &s->ctl->lock;
+    pid_t pid = li->holder_pid;
+    pid_t tid = li->holder_tid;
+
+    // Unknown holder or held by (a thread of) this process
+    if(pid <= 0 || pid == getpid()) {
+        return 0;
+    }
+    // Holder still exists (EPERM means it exists but is not ours to signal)
+    if(kill(pid, 0) == 0 || errno != ESRCH) {
+        errno = 0;
+        return 0;
+    }
+    errno = 0;
+    if(!__sync_bool_compare_and_swap(&li->holder_pid, pid, 0)) {
+        // Another waiter got here first
+        return 0;
+    }
+    li->holder_tid = 0;
+    __sync_fetch_and_add(&li->recovered_count, 1);
+    hashpipe_warn(__FUNCTION__,
+        "status lock holder pid %d (tid %d) is gone, releasing lock",
+        pid, tid);
+    sem_post(s->lock);
+    return 1;
+}
+
+static int hashpipe_status_shard_lock(hashpipe_status_t *s, double timeout_sec);
+
+int hashpipe_status_lock_timeout(hashpipe_status_t *s, double timeout_sec) {
+    int rv;
+    uint64_t start_ns = hashpipe_status_now_ns();
+    uint64_t check_ns = HASHPIPE_STATUS_LOCK_CHECK_INTERVAL * 1e9;
+    uint64_t elapsed_ns, slice_ns;
+    struct timespec abstime;
+
+    if(s->shard) {
+        return hashpipe_status_shard_lock(s, timeout_sec);
+    }
+
+    hashpipe_trace_event(HASHPIPE_TRACE_STATUS_LOCK, HASHPIPE_TRACE_BEGIN, -1, 0);
+    HASHPIPE_PROBE1(status_lock, s);
+
+    // Fast path for uncontended lock
+    if(sem_trywait(s->lock) == 0) {
+        hashpipe_status_lock_acquired(s, 0);
+        return HASHPIPE_OK;
+    } else if(errno != EAGAIN) {
+        hashpipe_trace_event(HASHPIPE_TRACE_STATUS_LOCK, HASHPIPE_TRACE_END,
+                -1, 0);
+        HASHPIPE_PROBE2(status_lock_return, s, HASHPIPE_ERR_SYS);
+        return HASHPIPE_ERR_SYS;
+    }
+
+    for(;;) {
+        elapsed_ns = hashpipe_status_now_ns() - start_ns;
+        slice_ns = check_ns;
+        if(timeout_sec >= 0) {
+            if(elapsed_ns >= timeout_sec * 1e9) {
+                hashpipe_trace_event(HASHPIPE_TRACE_STATUS_LOCK,
+                        HASHPIPE_TRACE_END, -1, 0);
+                HASHPIPE_PROBE2(status_lock_return, s, HASHPIPE_TIMEOUT);
+                return HASHPIPE_TIMEOUT;
+            }
+            if(timeout_sec * 1e9 - elapsed_ns < slice_ns) {
+                slice_ns = timeout_sec * 1e9 - elapsed_ns;
+            }
+        }
+
+        // sem_timedwait takes an absolute CLOCK_REALTIME deadline
+        clock_gettime(CLOCK_REALTIME, &abstime);
+        abstime.tv_sec  += slice_ns / 1000000000;
+        abstime.tv_nsec += slice_ns % 1000000000;
+        if(abstime.tv_nsec >= 1000000000) {
+            abstime.tv_sec++;
+            abstime.tv_nsec -= 1000000000;
+        }
+
+        rv = sem_timedwait(s->lock, &abstime);
+        if(rv == 0) {
+            hashpipe_status_lock_acquired(s, start_ns);
+            return HASHPIPE_OK;
+        } else if(errno == ETIMEDOUT) {
+            hashpipe_status_recover_dead_holder(s);
+        } else if(errno != EINTR) {
+            hashpipe_trace_event(HASHPIPE_TRACE_STATUS_LOCK,
+                    HASHPIPE_TRACE_END, -1, 0);
+            HASHPIPE_PROBE2(status_lock_return, s, HASHPIPE_ERR_SYS);
+            return HASHPIPE_ERR_SYS;
+        }
+    }
+}
+
 int hashpipe_status_lock(hashpipe_status_t *s) {
-    return(sem_wait(s->lock));
+    return hashpipe_status_lock_timeout(s, -1) == HASHPIPE_OK ? 0 : -1;
 }
 
-/* TODO: put in some (long, ~few sec) timeout */
 int hashpipe_status_lock_busywait(hashpipe_status_t *s) {
     int rv;
+    uint64_t start_ns = hashpipe_status_now_ns();
+    uint64_t check_ns = start_ns + HASHPIPE_STATUS_LOCK_CHECK_INTERVAL * 1e9;
+    unsigned int spins = 0;
+    if(s->shard) {
+        return hashpipe_status_shard_lock(s, -1) == HASHPIPE_OK ? 0 : -1;
+    }
+    hashpipe_trace_event(HASHPIPE_TRACE_STATUS_LOCK, HASHPIPE_TRACE_BEGIN, -1, 0);
+    HASHPIPE_PROBE1(status_lock, s);
     do {
       rv = sem_trywait(s->lock);
+      // Check on the holder every so often, but not on every spin
+      if(rv == -1 && errno == EAGAIN && (++spins & 0xfff) == 0
+      && hashpipe_status_now_ns() > check_ns) {
+          hashpipe_status_recover_dead_holder(s);
+          check_ns += HASHPIPE_STATUS_LOCK_CHECK_INTERVAL * 1e9;
+      }
     } while (rv == -1 && errno == EAGAIN);
+    if(rv == 0) {
+        hashpipe_status_lock_acquired(s, spins ? start_ns : 0);
+    } else {
+        hashpipe_trace_event(HASHPIPE_TRACE_STATUS_LOCK, HASHPIPE_TRACE_END,
+                -1, 0);
+        HASHPIPE_PROBE2(status_lock_return, s, rv);
+    }
+    return rv;
+}
+
+static int hashpipe_status_shard_unlock(hashpipe_status_t *s);
+
+/* Unlock the status buffer.  If bump_generation is non-zero, advance the
+ * generation counter and wake any threads waiting for it to change.
+ */
+static int hashpipe_status_unlock_common(hashpipe_status_t *s,
+                                         int bump_generation)
+{
+    hashpipe_status_lockinfo_t *li = &s->ctl->lock;
+    uint64_t hold_ns;
+    int rv;
+
+    if(s->shard) {
+        return hashpipe_status_shard_unlock(s);
+    }
+
+    // Only account for holds that were recorded by hashpipe_status_lock*()
+    if(li->holder_pid) {
+        hold_ns = hashpipe_status_now_ns() - li->hold_start_ns;
+        li->hold_ns_total += hold_ns;
+        if(hold_ns > li->hold_ns_max) {
+            li->hold_ns_max = hold_ns;
+        }
+        li->holder_pid = 0;
+        li->holder_tid = 0;
+    }
+    hashpipe_trace_event(HASHPIPE_TRACE_STATUS_HELD, HASHPIPE_TRACE_END, -1, 0);
+    HASHPIPE_PROBE1(status_unlock, s);
+    if(bump_generation) {
+        __sync_fetch_and_add(&s->ctl->generation, 1);
+    }
+    rv = sem_post(s->lock);
+    if(bump_generation && s->ctl->waiters) {
+        syscall(SYS_futex, &s->ctl->generation, FUTEX_WAKE, INT_MAX,
+                NULL, NULL, 0);
+    }
     return rv;
 }
 
 int hashpipe_status_unlock(hashpipe_status_t *s) {
-    return(sem_post(s->lock));
+    return hashpipe_status_unlock_common(s, 1);
+}
+
+int hashpipe_status_unlock_read(hashpipe_status_t *s) {
+    return hashpipe_status_unlock_common(s, 0);
+}
+
+int hashpipe_status_unlock_changed(hashpipe_status_t *s, int changed) {
+    return hashpipe_status_unlock_common(s, changed);
+}
+
+int hashpipe_status_puts_changed(hashpipe_status_t *s, const char *key,
+                                 const char *value)
+{
+    char old[HASHPIPE_STATUS_RECORD_SIZE+1];
+
+    if(hgets(s->buf, key, sizeof(old), old) && !strcmp(old, value)) {
+        return 0;
+    }
+    hputs(s->buf, key, value);
+    return 1;
+}
+
+int hashpipe_status_putnr8_changed(hashpipe_status_t *s, const char *key,
+                                   int ndec, double value)
+{
+    char old[HASHPIPE_STATUS_RECORD_SIZE+1];
+    char buf[HASHPIPE_STATUS_RECORD_SIZE+1];
+    char *end;
+
+    // Format as hputnr8() would, without its "-0" sign
+    snprintf(buf, sizeof(buf), "%.*f", ndec, value);
+    if(buf[0] == '-' && strtod(buf, &end) == 0.0) {
+        memmove(buf, buf+1, strlen(buf));
+    }
+    if(hgets(s->buf, key, sizeof(old), old) && !strcmp(old, buf)) {
+        return 0;
+    }
+    hputnr8(s->buf, key, ndec, value);
+    return 1;
+}
+
+uint32_t hashpipe_status_generation(hashpipe_status_t *s)
+{
+    return __sync_fetch_and_add(&s->ctl->generation, 0);
+}
+
+/* Copy the card for each subscribed key into cards (or an empty string if
+ * the key is absent) and record the generation they were read at.  Returns a
+ * bit mask of the keys whose card differs from the previous snapshot.
+ */
+static uint32_t hashpipe_status_sub_snapshot(hashpipe_status_sub_t *sub)
+{
+    int i;
+    char *card;
+    char newcard[HASHPIPE_STATUS_RECORD_SIZE+1];
+    uint32_t changed = 0;
+
+    hashpipe_status_lock(sub->s);
+    // Read generation under the lock so no update can slip in between
+    sub->generation = hashpipe_status_generation(sub->s);
+    for(i=0; i<sub->nkeys; i++) {
+        card = ksearch(sub->s->buf, sub->keys[i]);
+        if(card) {
+            memcpy(newcard, card, HASHPIPE_STATUS_RECORD_SIZE);
+            newcard[HASHPIPE_STATUS_RECORD_SIZE] = '\0';
+        } else {
+            newcard[0] = '\0';
+        }
+        if(strcmp(newcard, sub->cards[i])) {
+            strcpy(sub->cards[i], newcard);
+            changed |= (1U << i);
+        }
+    }
+    // Our own read-only access must not wake ourselves (or other waiters)
+    hashpipe_status_unlock_common(sub->s, 0);
+
+    return changed;
+}
+
+int hashpipe_status_subscribe(hashpipe_status_t *s, hashpipe_status_sub_t *sub,
+                              const char **keys, int nkeys)
+{
+    int i;
+
+    if(nkeys < 1 || nkeys > HASHPIPE_STATUS_MAX_SUBSCRIBED_KEYS) {
+        return HASHPIPE_ERR_PARAM;
+    }
+    memset(sub, 0, sizeof(hashpipe_status_sub_t));
+    sub->s = s;
+    sub->nkeys = nkeys;
+    for(i=0; i<nkeys; i++) {
+        strncpy(sub->keys[i], keys[i], HASHPIPE_STATUS_RECORD_SIZE);
+    }
+    hashpipe_status_sub_snapshot(sub);
+    return HASHPIPE_OK;
+}
+
+int hashpipe_status_wait_change(hashpipe_status_sub_t *sub, double timeout_sec)
+{
+    hashpipe_status_ctl_t *ctl = sub->s->ctl;
+    uint64_t start_ns = hashpipe_status_now_ns();
+    uint64_t elapsed_ns, remaining_ns;
+    struct timespec reltime, *timeout;
+    int rv;
+
+    sub->changed = 0;
+    for(;;) {
+        // If generation has moved on, see whether any of our keys changed
+        if(hashpipe_status_generation(sub->s) != sub->generation) {
+            sub->changed = hashpipe_status_sub_snapshot(sub);
+            if(sub->changed) {
+                return HASHPIPE_OK;
+            }
+            // Snapshot may have taken a while, so check generation again
+            continue;
+        }
+
+        timeout = NULL;
+        if(timeout_sec >= 0) {
+            elapsed_ns = hashpipe_status_now_ns() - start_ns;
+            if(elapsed_ns >= timeout_sec * 1e9) {
+                return HASHPIPE_TIMEOUT;
+            }
+            remaining_ns = timeout_sec * 1e9 - elapsed_ns;
+            reltime.tv_sec  = remaining_ns / 1000000000;
+            reltime.tv_nsec = remaining_ns % 1000000000;
+            timeout = &reltime;
+        }
+
+        // Sleep until generation differs from the one we last read
+        __sync_fetch_and_add(&ctl->waiters, 1);
+        rv = syscall(SYS_futex, &ctl->generation, FUTEX_WAIT,
+                     sub->generation, timeout, NULL, 0);
+        __sync_fetch_and_sub(&ctl->waiters, 1);
+        if(rv == -1 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+            return HASHPIPE_ERR_SYS;
+        }
+        errno = 0;
+    }
+}
+
+int hashpipe_status_lock_stats(hashpipe_status_t *s,
+                               hashpipe_status_lockinfo_t *info)
+{
+    if(!s || !s->ctl || !info) {
+        return HASHPIPE_ERR_PARAM;
+    }
+    memcpy(info, &s->ctl->lock, sizeof(hashpipe_status_lockinfo_t));
+    return HASHPIPE_OK;
 }
 
 /* Return pointer to END key */
 static
-char *hashpipe_find_end(char *buf) {
+char *hashpipe_find_end(char *buf, size_t size) {
     /* Loop over fixed size records */
     int offs;
     char *out=NULL;
-    for (offs=0; offs<HASHPIPE_STATUS_TOTAL_SIZE; offs+=HASHPIPE_STATUS_RECORD_SIZE) {
+    for (offs=0; offs<size; offs+=HASHPIPE_STATUS_RECORD_SIZE) {
         if (strncmp(&buf[offs], "END", 3)==0) { out=&buf[offs]; break; }
     }
     return(out);
 }
 
+int hashpipe_status_snapshot(hashpipe_status_t *s, char *buf, size_t size,
+                             hashpipe_status_lockinfo_t *lockinfo)
+{
+    char *end;
+    int len = -1;
+
+    hashpipe_status_lock(s);
+    end = hashpipe_find_end(s->buf, s->buf_size);
+    if(end) {
+        len = end - s->buf + HASHPIPE_STATUS_RECORD_SIZE;
+        if(len < size) {
+            memcpy(buf, s->buf, len);
+            buf[len] = '\0';
+        } else {
+            len = -1;
+        }
+    }
+    if(lockinfo) {
+        hashpipe_status_lock_stats(s, lockinfo);
+    }
+    hashpipe_status_unlock_common(s, 0);
+
+    return len;
+}
+
 /* So far, just checks for existence of "END" in the proper spot */
 void hashpipe_status_chkinit(hashpipe_status_t *s)
 {
     int instance_id = -1;
+    int changed = 1;
 
     /* Lock */
     hashpipe_status_lock(s);
 
+    /* Record size of buffer for other clients */
+    s->ctl->buf_size = s->buf_size;
+
     /* If no END, clear it out */
-    if (hashpipe_find_end(s->buf)==NULL) {
+    if (hashpipe_find_end(s->buf, s->buf_size)==NULL) {
         /* Zero bufer */
-        memset(s->buf, 0, HASHPIPE_STATUS_TOTAL_SIZE);
+        memset(s->buf, 0, s->buf_size);
         /* Fill first record w/ spaces */
         memset(s->buf, ' ', HASHPIPE_STATUS_RECORD_SIZE);
         /* add END */
@@ -206,11 +721,13 @@ void hashpipe_status_chkinit(hashpipe_status_t *s)
                 instance_id, s->instance_id);
             // Fix it (Really?  Why did this condition exist anyway?)
             hputi4(s->buf, "INSTANCE", s->instance_id);
+        } else {
+            changed = 0;
         }
     }
 
-    /* Unlock */
-    hashpipe_status_unlock(s);
+    /* Unlock (attaching to an intact buffer is not a change) */
+    hashpipe_status_unlock_changed(s, changed);
 }
 
 /* Clear out hashpipe status buf */
@@ -220,7 +737,7 @@ void hashpipe_status_clear(hashpipe_status_t *s) {
     hashpipe_status_lock(s);
 
     /* Zero bufer */
-    memset(s->buf, 0, HASHPIPE_STATUS_TOTAL_SIZE);
+    memset(s->buf, 0, s->buf_size);
     /* Fill first record w/ spaces */
     memset(s->buf, ' ', HASHPIPE_STATUS_RECORD_SIZE);
     /* add END */
@@ -231,3 +748,258 @@ void hashpipe_status_clear(hashpipe_status_t *s) {
     /* Unlock */
     hashpipe_status_unlock(s);
 }
+
+/*
+ * Status shards
+ */
+
+struct hashpipe_status_shard {
+    pthread_mutex_t lock;   /* Lock for buf */
+    hashpipe_status_t main; /* Status buffer that the shard is merged into */
+    char *buf;              /* Shard records */
+    char *base;             /* Shard records as of the previous merge */
+    struct hashpipe_status_shard *next;
+};
+
+/* All shards of this process, for hashpipe_status_shard_sync_all() */
+static struct hashpipe_status_shard *shard_list = NULL;
+static pthread_mutex_t shard_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int hashpipe_status_shard_lock(hashpipe_status_t *s, double timeout_sec)
+{
+    int rv;
+    struct timespec abstime;
+
+    if(timeout_sec < 0) {
+        rv = pthread_mutex_lock(&s->shard->lock);
+    } else {
+        clock_gettime(CLOCK_REALTIME, &abstime);
+        abstime.tv_sec  += (time_t)timeout_sec;
+        abstime.tv_nsec += (timeout_sec - (time_t)timeout_sec) * 1e9;
+        if(abstime.tv_nsec >= 1000000000) {
+            abstime.tv_sec++;
+            abstime.tv_nsec -= 1000000000;
+        }
+        rv = pthread_mutex_timedlock(&s->shard->lock, &abstime);
+    }
+    if(rv == ETIMEDOUT) {
+        return HASHPIPE_TIMEOUT;
+    }
+    return rv ? HASHPIPE_ERR_SYS : HASHPIPE_OK;
+}
+
+static int hashpipe_status_shard_unlock(hashpipe_status_t *s)
+{
+    return pthread_mutex_unlock(&s->shard->lock) ? -1 : 0;
+}
+
+int hashpipe_status_shard_attach(int instance_id, hashpipe_status_t *s)
+{
+    struct hashpipe_status_shard *sh;
+    int rv;
+
+    sh = calloc(1, sizeof(struct hashpipe_status_shard));
+    if(!sh) {
+        hashpipe_error(__FUNCTION__, "calloc error");
+        return HASHPIPE_ERR_SYS;
+    }
+    rv = hashpipe_status_attach(instance_id, &sh->main);
+    if(rv != HASHPIPE_OK) {
+        free(sh);
+        return rv;
+    }
+    // Extra byte keeps the copies NUL terminated
+    sh->buf = malloc(sh->main.buf_size + 1);
+    sh->base = malloc(sh->main.buf_size + 1);
+    if(!sh->buf || !sh->base) {
+        hashpipe_error(__FUNCTION__, "malloc error");
+        free(sh->buf);
+        free(sh->base);
+        hashpipe_status_detach(&sh->main);
+        free(sh);
+        return HASHPIPE_ERR_SYS;
+    }
+    sh->buf[sh->main.buf_size] = '\0';
+    sh->base[sh->main.buf_size] = '\0';
+    hlength(sh->buf, sh->main.buf_size);
+    hlength(sh->base, sh->main.buf_size);
+    pthread_mutex_init(&sh->lock, NULL);
+
+    hashpipe_status_lock(&sh->main);
+    memcpy(sh->buf, sh->main.buf, sh->main.buf_size);
+    memcpy(sh->base, sh->main.buf, sh->main.buf_size);
+    hashpipe_status_unlock_common(&sh->main, 0);
+
+    // The shard looks just like the status buffer, except for buf and locking
+    *s = sh->main;
+    s->lock = NULL;
+    s->buf = sh->buf;
+    s->shard = sh;
+
+    pthread_mutex_lock(&shard_list_lock);
+    sh->next = shard_list;
+    shard_list = sh;
+    pthread_mutex_unlock(&shard_list_lock);
+
+    return HASHPIPE_OK;
+}
+
+static int hashpipe_status_shard_detach(hashpipe_status_t *s)
+{
+    struct hashpipe_status_shard *sh = s->shard;
+    struct hashpipe_status_shard **p;
+    int rv;
+
+    rv = hashpipe_status_shard_sync(s);
+
+    pthread_mutex_lock(&shard_list_lock);
+    for(p=&shard_list; *p; p=&(*p)->next) {
+        if(*p == sh) {
+            *p = sh->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shard_list_lock);
+
+    hlength(sh->buf, -1);
+    hlength(sh->base, -1);
+    free(sh->buf);
+    free(sh->base);
+    pthread_mutex_destroy(&sh->lock);
+    if(hashpipe_status_detach(&sh->main) != HASHPIPE_OK) {
+        rv = HASHPIPE_ERR_SYS;
+    }
+    free(sh);
+
+    s->buf = NULL;
+    s->ctl = NULL;
+    s->shard = NULL;
+    return rv;
+}
+
+/* Copy the keyword of card (up to 8 characters, ending at a blank or '=')
+ * into key.  Returns the length of the keyword.
+ */
+static int hashpipe_status_card_key(const char *card, char *key)
+{
+    int i;
+    for(i=0; i<8 && card[i] != ' ' && card[i] != '=' && card[i] != '\0'; i++) {
+        key[i] = card[i];
+    }
+    key[i] = '\0';
+    return i;
+}
+
+/* Store card in buf (of size bytes), replacing the existing card for key or
+ * inserting it before END.  Returns 0 on success, -1 if there is no room.
+ */
+static int hashpipe_status_put_card(char *buf, size_t size,
+                                    const char *card, const char *key)
+{
+    char *line = ksearch(buf, key);
+    if(!line) {
+        line = ksearch(buf, "END");
+        if(!line || line + 2*HASHPIPE_STATUS_RECORD_SIZE > buf + size) {
+            return -1;
+        }
+        memcpy(line + HASHPIPE_STATUS_RECORD_SIZE, line,
+               HASHPIPE_STATUS_RECORD_SIZE);
+    }
+    memcpy(line, card, HASHPIPE_STATUS_RECORD_SIZE);
+    return 0;
+}
+
+/* Apply the changes made to shard sh since the previous merge to the status
+ * buffer (which must be locked).  Records are compared in place first, so
+ * the keyword lookups are only needed for the (few) records that differ.
+ * Returns the number of records stored or deleted.
+ */
+static int hashpipe_status_shard_push(struct hashpipe_status_shard *sh)
+{
+    size_t size = sh->main.buf_size;
+    char key[9];
+    char *end, *line, *prev;
+    int offs, n = 0;
+
+    // Added or changed records
+    end = ksearch(sh->buf, "END");
+    for(offs=0; sh->buf+offs < end; offs+=HASHPIPE_STATUS_RECORD_SIZE) {
+        line = sh->buf + offs;
+        if(!memcmp(line, sh->base+offs, HASHPIPE_STATUS_RECORD_SIZE)
+        || !hashpipe_status_card_key(line, key)) {
+            continue;
+        }
+        prev = ksearch(sh->base, key);
+        if(prev && !memcmp(line, prev, HASHPIPE_STATUS_RECORD_SIZE)) {
+            // Moved, but not changed
+            continue;
+        }
+        if(hashpipe_status_put_card(sh->main.buf, size, line, key)) {
+            hashpipe_warn(__FUNCTION__, "no room in status buffer for %s", key);
+        } else {
+            n++;
+        }
+    }
+
+    // Deleted records
+    end = ksearch(sh->base, "END");
+    for(offs=0; sh->base+offs < end; offs+=HASHPIPE_STATUS_RECORD_SIZE) {
+        line = sh->base + offs;
+        if(!memcmp(line, sh->buf+offs, HASHPIPE_STATUS_RECORD_SIZE)
+        || !hashpipe_status_card_key(line, key)) {
+            continue;
+        }
+        if(!ksearch(sh->buf, key) && hdel(sh->main.buf, key)) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+int hashpipe_status_shard_sync(hashpipe_status_t *s)
+{
+    struct hashpipe_status_shard *sh = s ? s->shard : NULL;
+    int n;
+
+    if(!sh) {
+        return HASHPIPE_OK;
+    }
+
+    pthread_mutex_lock(&sh->lock);
+    if(hashpipe_status_lock(&sh->main)) {
+        pthread_mutex_unlock(&sh->lock);
+        return HASHPIPE_ERR_SYS;
+    }
+    n = hashpipe_status_shard_push(sh);
+    // Changes made by others since the previous merge are pulled into the
+    // shard now.  Waiters on the shard may already have seen the generation
+    // of those changes while the shard was still stale, so wake them again.
+    if(memcmp(sh->buf, sh->main.buf, sh->main.buf_size)) {
+        memcpy(sh->buf, sh->main.buf, sh->main.buf_size);
+        n++;
+    }
+    memcpy(sh->base, sh->main.buf, sh->main.buf_size);
+    // Only wake up change waiters if the status buffer or shard changed
+    hashpipe_status_unlock_common(&sh->main, n > 0);
+    pthread_mutex_unlock(&sh->lock);
+
+    return HASHPIPE_OK;
+}
+
+int hashpipe_status_shard_sync_all()
+{
+    struct hashpipe_status_shard *sh;
+    hashpipe_status_t s;
+    int n = 0;
+
+    pthread_mutex_lock(&shard_list_lock);
+    for(sh=shard_list; sh; sh=sh->next) {
+        s.shard = sh;
+        hashpipe_status_shard_sync(&s);
+        n++;
+    }
+    pthread_mutex_unlock(&shard_list_lock);
+
+    return n;
+}
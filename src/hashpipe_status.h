@@ -7,6 +7,8 @@
 #ifndef _HASHPIPE_STATUS_H
 #define _HASHPIPE_STATUS_H
 
+#include <stdint.h>
+#include <sys/types.h>
 #include <semaphore.h>
 
 // fitshead.h does not need to be included here, but it is likely to be
@@ -14,19 +16,73 @@
 // client.
 #include "fitshead.h"
 
+// Default size of the FITS records area of the status buffer.  Status buffers
+// can be created with a different size (see hashpipe_status_create), so
+// clients should use the buf_size field of hashpipe_status_t rather than this.
 #define HASHPIPE_STATUS_TOTAL_SIZE (2880*64) // FITS-style buffer
 #define HASHPIPE_STATUS_RECORD_SIZE 80 // Size of each record (e.g. FITS "card")
+// Status buffer sizes are rounded up to a multiple of this (a FITS "block")
+#define HASHPIPE_STATUS_BLOCK_SIZE 2880
+// Size of the control area that follows the FITS records in the status shared
+// memory segment.  It is reserved at a fixed size so that the segment size
+// does not change when fields are added to hashpipe_status_ctl_t.
+#define HASHPIPE_STATUS_CTL_SIZE 4096
+// Interval (in seconds) at which a waiting locker checks whether the current
+// lock holder is still alive.
+#define HASHPIPE_STATUS_LOCK_CHECK_INTERVAL 1.0
+// Default interval (in seconds) at which the hashpipe executable merges
+// status shards into the status buffer.
+#define HASHPIPE_STATUS_SHARD_SYNC_INTERVAL 0.1
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Status lock bookkeeping.  The holder fields are set by
+ * hashpipe_status_lock() and friends once the lock is acquired and cleared by
+ * hashpipe_status_unlock(), so a waiter can tell whether the holder has died
+ * with the lock held.  The statistics accumulate over the lifetime of the
+ * status segment.  All times are in nanoseconds.
+ */
+typedef struct {
+    pid_t holder_pid;          /* Process holding the lock (0 if unknown) */
+    pid_t holder_tid;          /* Thread holding the lock (0 if unknown) */
+    uint64_t hold_start_ns;    /* CLOCK_MONOTONIC time lock was acquired */
+    uint64_t lock_count;       /* Number of times lock was acquired */
+    uint64_t contended_count;  /* Number of acquisitions that had to wait */
+    uint64_t recovered_count;  /* Number of recoveries from dead holders */
+    uint64_t wait_ns_total;    /* Total time spent waiting for the lock */
+    uint64_t wait_ns_max;      /* Longest wait for the lock */
+    uint64_t hold_ns_total;    /* Total time the lock was held */
+    uint64_t hold_ns_max;      /* Longest time the lock was held */
+} hashpipe_status_lockinfo_t;
+
+/* Control area stored in the status shared memory segment immediately after
+ * the FITS records (i.e. at the last HASHPIPE_STATUS_CTL_SIZE bytes of the
+ * segment).  Clients that only know about the FITS records are unaffected by
+ * it.
+ */
+typedef struct {
+    uint64_t buf_size;   /* Size of the FITS records area (bytes) */
+    hashpipe_status_lockinfo_t lock; /* Lock holder and statistics */
+    uint32_t generation; /* Bumped when unlocked after changes; futex word */
+    uint32_t waiters;    /* Number of threads waiting for generation change */
+} hashpipe_status_ctl_t;
+
+/* Private per-thread copy of the status buffer (see
+ * hashpipe_status_shard_attach).
+ */
+struct hashpipe_status_shard;
+
 /* Structure describes status memory area */
 typedef struct {
     int instance_id; /* Instance ID of this status buffer (DO NOT SET/CHANGE!) */
     int shmid;   /* Shared memory segment id */
     sem_t *lock; /* POSIX semaphore descriptor for locking */
     char *buf;   /* Pointer to data area */
+    size_t buf_size; /* Size of data area (bytes) */
+    hashpipe_status_ctl_t *ctl; /* Pointer to control area */
+    struct hashpipe_status_shard *shard; /* Shard, if attached to one */
 } hashpipe_status_t;
 
 /*
@@ -50,21 +106,149 @@ int hashpipe_status_exists(int instance_id);
 /* Return a pointer to the status shared mem area,
  * creating it if it doesn't exist.  Attaches/creates
  * lock semaphore as well.  Returns nonzero on error.
+ *
+ * A newly created status buffer holds $HASHPIPE_STATUS_SIZE bytes of records
+ * (if defined in the environment) or HASHPIPE_STATUS_TOTAL_SIZE bytes.  An
+ * existing status buffer is used as is, whatever its size.
  */
 int hashpipe_status_attach(int instance_id, hashpipe_status_t *s);
 
-/* Detach from shared mem segment */
+/* Like hashpipe_status_attach(), but if the status buffer does not exist it
+ * is created with room for size bytes of records (rounded up to a multiple
+ * of HASHPIPE_STATUS_BLOCK_SIZE).  If it exists but is smaller than size, it
+ * is grown to size, preserving its contents, provided that no other process
+ * (or thread) is currently attached to it.  Passing 0 for size is the same
+ * as calling hashpipe_status_attach().  Returns nonzero on error.
+ */
+int hashpipe_status_create(int instance_id, hashpipe_status_t *s, size_t size);
+
+/* Detach from shared mem segment (or from a shard, after a final
+ * hashpipe_status_shard_sync) */
 int hashpipe_status_detach(hashpipe_status_t *s);
 
+/* Attach s to a new status shard for instance_id.  A shard is a private copy
+ * of the status buffer records with its own (process local) lock, so threads
+ * that each use their own shard do not contend with each other (or with
+ * external clients) for the status buffer lock.  s is used exactly like a
+ * status buffer attached with hashpipe_status_attach(): s->buf points to the
+ * shard's records and hashpipe_status_lock/unlock(s) lock the shard.
+ *
+ * Changes made to a shard become visible to other status buffer users only
+ * when the shard is merged with hashpipe_status_shard_sync(), which also
+ * brings the shard up to date with changes made by others.  Returns nonzero
+ * on error.
+ */
+int hashpipe_status_shard_attach(int instance_id, hashpipe_status_t *s);
+
+/* Merge the shard that s is attached to with the status buffer.  Records
+ * that were added, changed or deleted in the shard since the previous merge
+ * are stored into (or deleted from) the status buffer, then the shard is
+ * replaced with a copy of the status buffer.  Does nothing if s is not
+ * attached to a shard.  Returns nonzero on error.
+ */
+int hashpipe_status_shard_sync(hashpipe_status_t *s);
+
+/* Merge all shards of this process with hashpipe_status_shard_sync().
+ * Returns the number of shards merged.
+ */
+int hashpipe_status_shard_sync_all();
+
 /* Lock/unlock the status buffer.  hashpipe_status_lock() will sleep while
  * waiting for the buffer to become unlocked.  hashpipe_status_lock_busywait
  * will busy-wait while waiting for the buffer to become unlocked.  Return
  * non-zero on errors.
+ *
+ * While waiting, both functions periodically check whether the process that
+ * holds the lock is still alive.  If the holder has died with the lock held,
+ * the lock is released on its behalf (and a warning is logged) rather than
+ * blocking forever.
  */
 int hashpipe_status_lock(hashpipe_status_t *s);
 int hashpipe_status_lock_busywait(hashpipe_status_t *s);
 int hashpipe_status_unlock(hashpipe_status_t *s);
 
+/* Unlock the status buffer after only reading it.  Unlike
+ * hashpipe_status_unlock(), this does not advance the generation counter, so
+ * subscribers (see hashpipe_status_wait_change()) are not woken.
+ * hashpipe_status_unlock_changed() advances it only if changed is non-zero,
+ * which suits periodic writers that often store the same values again.
+ */
+int hashpipe_status_unlock_read(hashpipe_status_t *s);
+int hashpipe_status_unlock_changed(hashpipe_status_t *s, int changed);
+
+/* Store value under key in the (locked) status buffer unless key already has
+ * that value.  hashpipe_status_puts_changed() stores a string as hputs()
+ * does, hashpipe_status_putnr8_changed() a number with ndec decimals as
+ * hputnr8() does.  Return 1 if the buffer was changed, otherwise 0.
+ */
+int hashpipe_status_puts_changed(hashpipe_status_t *s, const char *key,
+                                 const char *value);
+int hashpipe_status_putnr8_changed(hashpipe_status_t *s, const char *key,
+                                   int ndec, double value);
+
+/* Like hashpipe_status_lock(), but gives up after timeout_sec seconds.
+ * Returns HASHPIPE_OK if the lock was acquired, HASHPIPE_TIMEOUT if it was
+ * not acquired within the timeout, or HASHPIPE_ERR_SYS on error.  A negative
+ * timeout_sec waits forever.
+ */
+int hashpipe_status_lock_timeout(hashpipe_status_t *s, double timeout_sec);
+
+/* Copy the status lock holder info and statistics into *info.  The copy is
+ * made without taking the lock, so fields may be mutually inconsistent by one
+ * lock/unlock cycle.  Returns HASHPIPE_OK on success.
+ */
+int hashpipe_status_lock_stats(hashpipe_status_t *s,
+                               hashpipe_status_lockinfo_t *info);
+
+/* Returns the status buffer generation counter.  The counter is incremented
+ * every time the status buffer is unlocked after a change, so a reader that sees the same
+ * generation as last time can skip re-reading (or re-parsing) the buffer.
+ */
+uint32_t hashpipe_status_generation(hashpipe_status_t *s);
+
+/* Maximum number of keys in a status subscription */
+#define HASHPIPE_STATUS_MAX_SUBSCRIBED_KEYS 32
+
+/* A subscription to changes of a set of status keys.  Initialize with
+ * hashpipe_status_subscribe() and then call hashpipe_status_wait_change() to
+ * wait for any of the keys to change.  On return, bit i of "changed" is set
+ * if keys[i] changed.  Keys that are absent from the status buffer compare
+ * as empty, so adding or deleting a subscribed key counts as a change.
+ */
+typedef struct {
+    hashpipe_status_t *s;
+    int nkeys;
+    char keys[HASHPIPE_STATUS_MAX_SUBSCRIBED_KEYS][HASHPIPE_STATUS_RECORD_SIZE+1];
+    char cards[HASHPIPE_STATUS_MAX_SUBSCRIBED_KEYS][HASHPIPE_STATUS_RECORD_SIZE+1];
+    uint32_t generation; /* Generation at which cards were last read */
+    uint32_t changed;    /* Bit mask of keys that changed */
+} hashpipe_status_sub_t;
+
+/* Subscribe to changes of the nkeys keys in keys.  Takes a snapshot of the
+ * current values of the keys.  Returns HASHPIPE_OK on success or
+ * HASHPIPE_ERR_PARAM if nkeys is out of range.
+ */
+int hashpipe_status_subscribe(hashpipe_status_t *s, hashpipe_status_sub_t *sub,
+                              const char **keys, int nkeys);
+
+/* Sleep until at least one subscribed key changes value (compared to the last
+ * snapshot) or timeout_sec seconds elapse.  A negative timeout_sec waits
+ * forever.  The waiting is done on a futex in the status shared memory
+ * segment that is woken by hashpipe_status_unlock(), so no polling is
+ * involved.  Returns HASHPIPE_OK with sub->changed set if a key changed,
+ * HASHPIPE_TIMEOUT on timeout, or HASHPIPE_ERR_SYS on error.
+ */
+int hashpipe_status_wait_change(hashpipe_status_sub_t *sub, double timeout_sec);
+
+/* Copy the status buffer records, up to and including the END record, into
+ * buf (of size bytes) while holding the lock only for the copy.  The copy is
+ * NUL terminated.  If lockinfo is non-NULL, the lock statistics are copied
+ * into it as well.  Returns the number of bytes copied (excluding the NUL)
+ * or -1 if buf is too small.
+ */
+int hashpipe_status_snapshot(hashpipe_status_t *s, char *buf, size_t size,
+                             hashpipe_status_lockinfo_t *lockinfo);
+
 /* Check the buffer for appropriate formatting (existence of "END").
  * If not found, zero it out and add END.
  */
@@ -94,6 +278,14 @@ void hashpipe_status_clear(hashpipe_status_t *s);
     hashpipe_status_unlock(s); \
     pthread_cleanup_pop(0);
 
+#define hashpipe_status_unlock_read_safe(s) \
+    hashpipe_status_unlock_read(s); \
+    pthread_cleanup_pop(0);
+
+#define hashpipe_status_unlock_changed_safe(s, changed) \
+    hashpipe_status_unlock_changed(s, changed); \
+    pthread_cleanup_pop(0);
+
 #ifdef __cplusplus
 }
 #endif
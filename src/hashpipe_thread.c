@@ -1,12 +1,29 @@
 #define _GNU_SOURCE 1
 #include <stdio.h>
+#include <stdlib.h>
 #include <sched.h>
 #include <string.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <ctype.h>
 #include "hashpipe.h"
 
+// The run threads flag is read by every thread and cleared from signal
+// handlers, so it is only accessed atomically.  Clearing it also makes
+// stop_fd readable so that anything waiting for a stop request (e.g. the
+// main thread or threads blocked in poll) wakes up immediately.
 static int run_threads_flag = 1;
+static int stop_fd = -1;
+
+// Args of calling pipeline thread (NULL for other threads).  Pipeline
+// threads also have their own run flag, which lets them be stopped
+// individually (e.g. while draining the pipeline), and progress tracking
+// fields that the databuf functions update.
+static __thread hashpipe_thread_args_t *thread_args = NULL;
 
 static hashpipe_thread_desc_t *thread_list[MAX_HASHPIPE_THREADS];
 static int num_threads = 0;
@@ -14,18 +31,151 @@ static int num_threads = 0;
 // Functions to query the run threads flag
 int run_threads()
 {
-  return run_threads_flag;
+  return __atomic_load_n(&run_threads_flag, __ATOMIC_ACQUIRE)
+    && (!thread_args || __atomic_load_n(&thread_args->run, __ATOMIC_ACQUIRE));
+}
+
+// Set args of the calling pipeline thread
+void set_thread_args(hashpipe_thread_args_t *args)
+{
+  thread_args = args;
+}
+
+// Called by databuf functions when the calling thread fills (filled is
+// non-zero) or frees a block
+void hashpipe_thread_note_progress(int semid, int block_id, int filled)
+{
+  int i;
+
+  if(thread_args) {
+    __atomic_add_fetch(&thread_args->progress, 1, __ATOMIC_RELAXED);
+    if(filled) {
+      for(i=0; i<thread_args->num_outputs; i++) {
+        if(thread_args->obufs[i] && thread_args->obufs[i]->semid == semid) {
+          thread_args->last_oblock[i] = block_id;
+          if(thread_args->shared_resume) {
+            thread_args->shared_resume->last_oblock[i] = block_id;
+          }
+          break;
+        }
+      }
+    } else {
+      for(i=0; i<thread_args->num_inputs; i++) {
+        if(thread_args->ibufs[i] && thread_args->ibufs[i]->semid == semid) {
+          thread_args->last_iblock[i] = block_id;
+          if(thread_args->shared_resume) {
+            thread_args->shared_resume->last_iblock[i] = block_id;
+          }
+          break;
+        }
+      }
+    }
+  }
+}
+
+static uint64_t monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Add time since start of current wait (if any) to the calling thread's
+// wait time
+static void end_wait(uint64_t now)
+{
+  uint64_t start = thread_args->wait_start_ns;
+
+  if(start) {
+    __atomic_add_fetch(&thread_args->wait_ns[thread_args->wait_filled ? 1 : 0],
+        now - start, __ATOMIC_RELAXED);
+    __atomic_store_n(&thread_args->wait_start_ns, 0, __ATOMIC_RELEASE);
+  }
+}
+
+// Called by databuf functions when the calling thread starts (semid != -1)
+// or stops (semid == -1) waiting for a block to become filled or free.  A
+// wait that timed out stays noted, so retrying it continues the same wait.
+void hashpipe_thread_note_wait(int semid, int block_id, int filled)
+{
+  uint64_t now;
+
+  if(!thread_args) {
+    return;
+  }
+  now = monotonic_ns();
+  if(semid == -1) {
+    end_wait(now);
+  } else if(!thread_args->wait_start_ns
+         || semid != thread_args->wait_semid
+         || block_id != thread_args->wait_block
+         || filled != thread_args->wait_filled) {
+    end_wait(now);
+    thread_args->wait_block = block_id;
+    thread_args->wait_filled = filled;
+    __atomic_store_n(&thread_args->wait_start_ns, now, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&thread_args->wait_semid, semid, __ATOMIC_RELEASE);
 }
 
 // Functions to set and clear the run threads flag
 void set_run_threads()
 {
-  run_threads_flag = 1;
+  uint64_t count;
+
+  if(stop_fd == -1) {
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(stop_fd == -1) {
+      perror("eventfd");
+    }
+  } else {
+    // Reset any previous stop request
+    while(read(stop_fd, &count, sizeof(count)) == sizeof(count));
+  }
+  __atomic_store_n(&run_threads_flag, 1, __ATOMIC_RELEASE);
 }
 
+// Async-signal-safe, so it can be called from signal handlers
 void clear_run_threads()
 {
-  run_threads_flag = 0;
+  uint64_t one = 1;
+  int saved_errno = errno;
+
+  __atomic_store_n(&run_threads_flag, 0, __ATOMIC_RELEASE);
+  if(stop_fd != -1 && write(stop_fd, &one, sizeof(one)) == -1) {
+    // Counter overflow is impossible, so nothing to do
+  }
+  errno = saved_errno;
+}
+
+// Give the calling process its own stop notification (e.g. after fork),
+// which set_run_threads() then creates.  Without this, a forked process
+// would share stop_fd with its parent.
+void reset_stop_fd()
+{
+  if(stop_fd != -1) {
+    close(stop_fd);
+    stop_fd = -1;
+  }
+}
+
+// File descriptor that becomes readable once threads are asked to stop
+int hashpipe_stop_fd()
+{
+  return stop_fd;
+}
+
+// Wait until threads are asked to stop or fd (if not -1) becomes readable
+void wait_stop_request(int fd)
+{
+  struct pollfd pfd[2] = {{stop_fd, POLLIN, 0}, {fd, POLLIN, 0}};
+
+  while(run_threads()) {
+    // Time out periodically in case stop_fd could not be created
+    if(poll(pfd, 2, 1000) > 0 && (pfd[1].revents & POLLIN)) {
+      break;
+    }
+  }
 }
 
 // Register a thread descriptor
@@ -89,7 +239,8 @@ list_hashpipe_threads(FILE * f)
 unsigned int
 get_cpu_affinity()
 {
-    int i, mask=0;
+    int i;
+    unsigned int mask=0;
     cpu_set_t cpuset;
     CPU_ZERO(&cpuset);
 
@@ -98,14 +249,142 @@ get_cpu_affinity()
         hashpipe_error(__FUNCTION__, "Error getting cpu affinity.");
         return 0;
     }
-    if(mask != 0) {
-        // Only handle 32 cores (for now)
-        for(i=31; i<=0; i--) {
-            mask <<= 1;
-            if(CPU_ISSET(i, &cpuset)) {
-              mask |= 1;
-            }
+    // Only handle 32 cores (use sched_getaffinity for more)
+    for(i=31; i>=0; i--) {
+        mask <<= 1;
+        if(CPU_ISSET(i, &cpuset)) {
+          mask |= 1;
         }
     }
     return mask;
 }
+
+// Parse a cpulist (e.g. "0-3,64,66" or "0-15:2") into cpuset
+int
+hashpipe_parse_cpulist(const char *list, cpu_set_t *cpuset)
+{
+    const char *p = list;
+    char *end;
+    long first, last, stride, i;
+
+    CPU_ZERO(cpuset);
+    for(;;) {
+        first = strtol(p, &end, 10);
+        if(end == p || first < 0) {
+            return -1;
+        }
+        last = first;
+        stride = 1;
+        p = end;
+        if(*p == '-') {
+            last = strtol(++p, &end, 10);
+            if(end == p || last < first) {
+                return -1;
+            }
+            p = end;
+            if(*p == ':') {
+                stride = strtol(++p, &end, 10);
+                if(end == p || stride < 1) {
+                    return -1;
+                }
+                p = end;
+            }
+        }
+        if(last >= CPU_SETSIZE) {
+            return -1;
+        }
+        for(i=first; i<=last; i+=stride) {
+            CPU_SET(i, cpuset);
+        }
+        if(*p == '\0') {
+            return 0;
+        } else if(*p++ != ',') {
+            return -1;
+        }
+    }
+}
+
+// Format cpuset as a cpulist (e.g. "0-3,64,66") in buf
+int
+hashpipe_format_cpulist(const cpu_set_t *cpuset, char *buf, size_t size)
+{
+    int i, first, n = 0;
+
+    if(size > 0) {
+        buf[0] = '\0';
+    }
+    for(i=0; i<CPU_SETSIZE; i++) {
+        if(!CPU_ISSET(i, cpuset)) {
+            continue;
+        }
+        for(first=i; i+1<CPU_SETSIZE && CPU_ISSET(i+1, cpuset); i++);
+        n += snprintf(buf+n, n < size ? size-n : 0,
+                first == i ? "%s%d" : "%s%d-%d", n ? "," : "", first, i);
+    }
+    return n < size ? 0 : -1;
+}
+
+// Replica R of N starts with block R
+int
+hashpipe_thread_first_block(const hashpipe_thread_args_t *args,
+        const hashpipe_databuf_t *db)
+{
+    // Positions in shared memory survive the process of a crashed thread
+    const int *last_iblock = args->shared_resume
+        ? args->shared_resume->last_iblock : args->last_iblock;
+    const int *last_oblock = args->shared_resume
+        ? args->shared_resume->last_oblock : args->last_oblock;
+    int i;
+
+    // A restarted thread resumes after the last block it released
+    for(i=0; i<args->num_inputs; i++) {
+        if(args->ibufs[i] && args->ibufs[i]->semid == db->semid
+        && last_iblock[i] != -1) {
+            return hashpipe_thread_next_block(args, db, last_iblock[i]);
+        }
+    }
+    for(i=0; i<args->num_outputs; i++) {
+        if(args->obufs[i] && args->obufs[i]->semid == db->semid
+        && last_oblock[i] != -1) {
+            return hashpipe_thread_next_block(args, db, last_oblock[i]);
+        }
+    }
+    return args->replica % db->n_block;
+}
+
+// Replica R of N skips the blocks handled by the other N-1 replicas
+int
+hashpipe_thread_next_block(const hashpipe_thread_args_t *args,
+        const hashpipe_databuf_t *db, int block)
+{
+    return (block + args->num_replicas) % db->n_block;
+}
+
+void hashpipe_thread_status_key(hashpipe_thread_args_t *a,
+        const char *suffix, char *key) {
+    const char *base = a->thread_desc->skey;
+    static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    int i, n;
+
+    if(!base || !*base) {
+        base = a->thread_desc->name;
+    }
+    n = strlen(base);
+    if(n > 4 && !strcmp(base+n-4, "STAT")) {
+        n -= 4;
+    }
+    if(n > 4) {
+        n = 4;
+    }
+    // Replicas replace the last prefix character with their index
+    if(a->num_replicas > 1 && n == 4) {
+        n = 3;
+    }
+    for(i=0; i<n; i++) {
+        key[i] = toupper(base[i]);
+    }
+    if(a->num_replicas > 1) {
+        key[n++] = digits[a->replica % (sizeof(digits)-1)];
+    }
+    snprintf(key+n, 5, "%s", suffix);
+}
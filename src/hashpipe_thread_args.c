@@ -1,19 +1,56 @@
+#define _GNU_SOURCE 1
 #include <math.h>
 #include <string.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <stdio.h>
 #include "hashpipe_thread_args.h"
 
 void hashpipe_thread_args_init(struct hashpipe_thread_args *a) {
     a->thread_desc=0;
     a->instance_id=0;
-    a->cpu_mask=0;
+    CPU_ZERO(&a->cpu_set);
+    a->sched_policy=-1;
+    a->sched_priority=0;
+    a->nice=0;
+    a->set_nice=0;
     a->finished=0;
+    a->ready=0;
     pthread_cond_init(&a->finished_c,NULL);
     pthread_mutex_init(&a->finished_m,NULL);
     memset(&a->st, 0, sizeof(hashpipe_status_t));
     a->ibuf = NULL;
     a->obuf = NULL;
+    a->num_inputs = 0;
+    a->num_outputs = 0;
+    memset(a->ibufs, 0, sizeof(a->ibufs));
+    memset(a->obufs, 0, sizeof(a->obufs));
+    a->replica = 0;
+    a->num_replicas = 1;
+    a->run = 1;
+    a->progress = 0;
+    a->wait_semid = -1;
+    a->wait_block = 0;
+    a->wait_filled = 0;
+    a->tid = 0;
+    a->cpu_clock = 0;
+    a->trace_ring = -1;
+    a->wait_ns[0] = 0;
+    a->wait_ns[1] = 0;
+    a->wait_start_ns = 0;
+    memset(a->last_iblock, -1, sizeof(a->last_iblock));
+    memset(a->last_oblock, -1, sizeof(a->last_oblock));
+    a->shared_resume = NULL;
+}
+
+void hashpipe_thread_args_reset(struct hashpipe_thread_args *a) {
+    pthread_mutex_lock(&a->finished_m);
+    a->finished=0;
+    a->ready=0;
+    pthread_mutex_unlock(&a->finished_m);
+    a->wait_semid = -1;
+    a->wait_start_ns = 0;
+    __atomic_store_n(&a->run, 1, __ATOMIC_RELEASE);
 }
 
 void hashpipe_thread_args_destroy(struct hashpipe_thread_args *a) {
@@ -39,9 +76,43 @@ int hashpipe_thread_finished(struct hashpipe_thread_args *a,
     twait.tv_sec = now.tv_sec + (int)timeout_sec;
     twait.tv_nsec = now.tv_usec * 1000 +
         (int)(1e9*(timeout_sec-floor(timeout_sec)));
-    if (a->finished==0)
+    if(twait.tv_nsec >= 1000000000) {
+        twait.tv_sec++;
+        twait.tv_nsec -= 1000000000;
+    }
+    rv = 0;
+    while (a->finished==0 && rv==0)
         rv = pthread_cond_timedwait(&a->finished_c, &a->finished_m, &twait);
     rv = a->finished;
     pthread_mutex_unlock(&a->finished_m);
     return(rv);
 }
+
+void hashpipe_thread_set_ready(struct hashpipe_thread_args *a) {
+    pthread_mutex_lock(&a->finished_m);
+    a->ready=1;
+    pthread_cond_broadcast(&a->finished_c);
+    pthread_mutex_unlock(&a->finished_m);
+}
+
+int hashpipe_thread_wait_ready(struct hashpipe_thread_args *a,
+        float timeout_sec) {
+    struct timeval now;
+    struct timespec twait;
+    int rv = 0;
+    pthread_mutex_lock(&a->finished_m);
+    gettimeofday(&now,NULL);
+    twait.tv_sec = now.tv_sec + (int)timeout_sec;
+    twait.tv_nsec = now.tv_usec * 1000 +
+        (int)(1e9*(timeout_sec-floor(timeout_sec)));
+    if(twait.tv_nsec >= 1000000000) {
+        twait.tv_sec++;
+        twait.tv_nsec -= 1000000000;
+    }
+    // finished_c is also signaled when the thread becomes ready
+    while (a->ready==0 && a->finished==0 && rv==0)
+        rv = pthread_cond_timedwait(&a->finished_c, &a->finished_m, &twait);
+    rv = a->ready ? 1 : a->finished ? -1 : 0;
+    pthread_mutex_unlock(&a->finished_m);
+    return(rv);
+}
@@ -9,6 +9,70 @@
 
 void hashpipe_thread_args_init(hashpipe_thread_args_t *a);
 void hashpipe_thread_args_destroy(hashpipe_thread_args_t *a);
+// Prepare args of a thread that has finished for restarting the thread
+// (keeping its progress and resume positions)
+void hashpipe_thread_args_reset(hashpipe_thread_args_t *a);
 void hashpipe_thread_set_finished(hashpipe_thread_args_t *a);
 int hashpipe_thread_finished(hashpipe_thread_args_t *a, float timeout_sec);
+void hashpipe_thread_set_ready(hashpipe_thread_args_t *a);
+// Wait up to timeout_sec seconds for thread to become ready.  Returns 1 if it
+// is ready, 0 on timeout, or -1 if it finished without becoming ready.
+int hashpipe_thread_wait_ready(hashpipe_thread_args_t *a, float timeout_sec);
+
+/* Framework threads started by the hashpipe executable itself (rather than
+ * from plugins).
+ */
+
+// Status history thread (hashpipe_history_thread.c).  vp_history points to a
+// hashpipe_history_t created with hashpipe_history_create().
+void *hashpipe_history_thread_run(void *vp_history);
+
+// Metrics exporter thread (hashpipe_metrics_thread.c).  addr is a TCP port,
+// a HOST:PORT pair, or a unix domain socket path.
+typedef struct {
+    int instance_id;
+    const char *addr;
+} hashpipe_metrics_args_t;
+
+void *hashpipe_metrics_thread_run(void *vp_args);
+
+// Status shard merge thread (hashpipe_shard_thread.c).  vp_interval points to
+// a double holding the merge interval in seconds.
+void *hashpipe_shard_thread_run(void *vp_interval);
+
+// Stall watchdog thread (hashpipe_watchdog_thread.c).  Watches the
+// num_threads pipeline threads in args and reports any that make no progress
+// for stall_time seconds in the status buffer (and on stderr if log is
+// non-zero).
+typedef struct {
+    int instance_id;
+    double stall_time;
+    int log;
+    hashpipe_thread_args_t *args;
+    int num_threads;
+} hashpipe_watchdog_args_t;
+
+void *hashpipe_watchdog_thread_run(void *vp_args);
+
+// Thread statistics thread (hashpipe_stats_thread.c).  Stores CPU usage and
+// performance counter statistics of the num_threads pipeline threads in args
+// in the status buffer every interval seconds.
+typedef struct {
+    int instance_id;
+    double interval;
+    hashpipe_thread_args_t *args;
+    int num_threads;
+} hashpipe_stats_args_t;
+
+void *hashpipe_stats_thread_run(void *vp_args);
+
+// Block latency thread (hashpipe_latency_thread.c).  Stores a summary of the
+// block latency histograms of all databufs in the status buffer every
+// interval seconds.
+typedef struct {
+    int instance_id;
+    double interval;
+} hashpipe_latency_args_t;
+
+void *hashpipe_latency_thread_run(void *vp_args);
 #endif // _HASHPIPE_THREAD_ARGS_H
@@ -0,0 +1,148 @@
+/* hashpipe_trace.c
+ *
+ * Implementation of the event trace routines described in hashpipe_trace.h
+ */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#include "hashpipe_trace.h"
+#include "hashpipe_error.h"
+
+// Trace segment of this process (NULL if tracing is not enabled)
+static hashpipe_trace_t *trace = NULL;
+
+// Ring of calling thread (NULL if it has none)
+static __thread hashpipe_trace_ring_t *thread_ring = NULL;
+
+static size_t ring_stride(uint32_t ring_size)
+{
+    return sizeof(hashpipe_trace_ring_t)
+        + ring_size * sizeof(hashpipe_trace_record_t);
+}
+
+static hashpipe_trace_record_t *ring_records(hashpipe_trace_ring_t *r)
+{
+    return (hashpipe_trace_record_t *)(r + 1);
+}
+
+hashpipe_trace_ring_t *hashpipe_trace_ring(hashpipe_trace_t *t, int i)
+{
+    return (hashpipe_trace_ring_t *)((char *)(t + 1)
+            + i * ring_stride(t->ring_size));
+}
+
+int hashpipe_trace_enable(int instance_id, int num_rings, int ring_size)
+{
+    uint32_t size = 1;
+
+    while(size < ring_size) {
+        size <<= 1;
+    }
+
+    // Replaces any previous segment, which may have a different size
+    trace = hashpipe_auxshm_create(instance_id, HASHPIPE_AUXSHM_TRACE,
+            sizeof(hashpipe_trace_t) + num_rings * ring_stride(size));
+    if(!trace) {
+        return HASHPIPE_ERR_SYS;
+    }
+
+    // Newly created segments are zeroed
+    trace->num_rings = num_rings;
+    trace->ring_size = size;
+
+    return HASHPIPE_OK;
+}
+
+int hashpipe_trace_thread_start(const char *name, int ring)
+{
+    uint32_t used;
+
+    if(!trace) {
+        return HASHPIPE_OK;
+    }
+    if(ring < 0 || ring >= trace->num_rings) {
+        hashpipe_error(__FUNCTION__, "no trace ring %d for thread %s", ring,
+                name);
+        return HASHPIPE_ERR_GEN;
+    }
+    thread_ring = hashpipe_trace_ring(trace, ring);
+    memset(thread_ring->name, 0, HASHPIPE_TRACE_NAME_SIZE);
+    strncpy(thread_ring->name, name, HASHPIPE_TRACE_NAME_SIZE-1);
+    thread_ring->tid = syscall(SYS_gettid);
+
+    // Let readers know how many rings may be in use
+    used = __atomic_load_n(&trace->used, __ATOMIC_RELAXED);
+    while(used < ring + 1 && !__atomic_compare_exchange_n(&trace->used,
+                &used, ring + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return HASHPIPE_OK;
+}
+
+void hashpipe_trace_event(int type, int phase, int semid, int block_id)
+{
+    hashpipe_trace_ring_t *r = thread_ring;
+    hashpipe_trace_record_t *rec;
+    struct timespec ts;
+    uint64_t head;
+
+    if(!r) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    head = r->head;
+    rec = &ring_records(r)[head & (trace->ring_size - 1)];
+    rec->time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    rec->semid = semid;
+    rec->block_id = block_id;
+    rec->type = type;
+    rec->phase = phase;
+    // Publish record to readers
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int hashpipe_trace_read(hashpipe_trace_t *t, int i,
+        hashpipe_trace_record_t *recs)
+{
+    hashpipe_trace_ring_t *r = hashpipe_trace_ring(t, i);
+    uint64_t first, head, j;
+    int n = 0;
+
+    // Once the ring is full, the writer may be overwriting the oldest record
+    // (in the slot of record head) at any time, so that one is never kept
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    first = head >= t->ring_size ? head - t->ring_size + 1 : 0;
+    for(j=first; j<head; j++) {
+        recs[n++] = ring_records(r)[j & (t->ring_size - 1)];
+    }
+
+    // Drop records that the writer may have overwritten while copying
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if(head >= t->ring_size && head - t->ring_size + 1 > first) {
+        j = head - t->ring_size + 1 - first;
+        if(j >= n) {
+            return 0;
+        }
+        memmove(recs, recs + j, (n - j) * sizeof(hashpipe_trace_record_t));
+        n -= j;
+    }
+    return n;
+}
+
+hashpipe_trace_t *hashpipe_trace_attach(int instance_id)
+{
+    return hashpipe_auxshm_attach(instance_id, HASHPIPE_AUXSHM_TRACE, 1);
+}
+
+int hashpipe_trace_detach(hashpipe_trace_t *t)
+{
+    return hashpipe_auxshm_detach(t);
+}
+
+int hashpipe_trace_delete(int instance_id)
+{
+    return hashpipe_auxshm_delete(instance_id, HASHPIPE_AUXSHM_TRACE);
+}
@@ -0,0 +1,121 @@
+/* hashpipe_trace.h
+ *
+ * Routines dealing with the hashpipe event trace shared memory segment.
+ * When event tracing is enabled, every pipeline thread gets its own ring of
+ * time stamped event records in the trace segment.  The databuf wait and set
+ * functions and the status buffer lock functions record an event into the
+ * calling thread's ring (waits and locks as a begin/end pair, sets as a
+ * single event), so a timeline of what each thread was doing can be
+ * reconstructed without adding printf statements.  Each ring has a single
+ * writer and is written without locking; any process can read the rings
+ * while they are being written (see hashpipe_trace_read).
+ * hashpipe_dump_trace converts the rings to Chrome trace JSON, which can be
+ * viewed with chrome://tracing or https://ui.perfetto.dev.  The trace
+ * segment is an auxiliary segment (see hashpipe_auxshm.h).
+ */
+#ifndef _HASHPIPE_TRACE_H
+#define _HASHPIPE_TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "hashpipe_auxshm.h"
+
+// Default number of records per ring (rounded up to a power of two)
+#define HASHPIPE_TRACE_DEFAULT_RECORDS 65536
+#define HASHPIPE_TRACE_NAME_SIZE 32
+
+// Event types
+enum {
+    HASHPIPE_TRACE_WAIT_FILLED, // Waiting for a filled block
+    HASHPIPE_TRACE_WAIT_FREE,   // Waiting for a free block
+    HASHPIPE_TRACE_SET_FILLED,  // Block set filled
+    HASHPIPE_TRACE_SET_FREE,    // Block set free
+    HASHPIPE_TRACE_STATUS_LOCK, // Waiting for the status buffer lock
+    HASHPIPE_TRACE_STATUS_HELD, // Holding the status buffer lock
+    HASHPIPE_TRACE_NUM_TYPES
+};
+
+// Event phases
+enum {
+    HASHPIPE_TRACE_BEGIN,
+    HASHPIPE_TRACE_END,
+    HASHPIPE_TRACE_INSTANT
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One trace record */
+typedef struct {
+    uint64_t time_ns; /* CLOCK_MONOTONIC time of event */
+    int32_t semid;    /* semid of databuf, -1 for status buffer events */
+    int16_t block_id; /* Databuf block, 0 for status buffer events */
+    uint8_t type;     /* HASHPIPE_TRACE_* event type */
+    uint8_t phase;    /* HASHPIPE_TRACE_* event phase */
+} hashpipe_trace_record_t;
+
+/* Per-thread ring of records.  The records follow the ring header. */
+typedef struct {
+    char name[HASHPIPE_TRACE_NAME_SIZE]; /* Name of thread */
+    pid_t tid;        /* Linux thread id of thread */
+    uint32_t unused;
+    uint64_t head;    /* Number of records ever written to the ring */
+} hashpipe_trace_ring_t;
+
+/* Header of trace segment.  The rings follow the header. */
+typedef struct {
+    hashpipe_auxshm_hdr_t hdr; /* hdr.pid is the process that created it */
+    uint32_t num_rings; /* Number of rings in segment */
+    uint32_t ring_size; /* Number of records per ring (a power of two) */
+    uint32_t used;      /* One more than highest ring used by a thread */
+    uint32_t unused;
+} hashpipe_trace_t;
+
+/* Create (or re-create) the trace segment for instance_id with num_rings
+ * rings of at least ring_size records each and enable event tracing in this
+ * process.  Returns HASHPIPE_OK on success.
+ */
+int hashpipe_trace_enable(int instance_id, int num_rings, int ring_size);
+
+/* Use ring number ring for the calling thread, naming it name.  Each thread
+ * has a ring of its own (e.g. its index among the threads of the pipeline),
+ * so a thread that is restarted continues its previous ring.  Does nothing
+ * if event tracing is not enabled.  Returns HASHPIPE_OK on success (or if
+ * tracing is not enabled), HASHPIPE_ERR_GEN if there is no such ring.
+ */
+int hashpipe_trace_thread_start(const char *name, int ring);
+
+/* Record an event in the calling thread's ring (if it has one) */
+void hashpipe_trace_event(int type, int phase, int semid, int block_id);
+
+/* Attach to an existing trace segment.  Returns pointer to segment or NULL
+ * if no trace segment exists for instance_id.
+ */
+hashpipe_trace_t *hashpipe_trace_attach(int instance_id);
+
+/* Detach from trace segment */
+int hashpipe_trace_detach(hashpipe_trace_t *t);
+
+/* Delete the trace segment for instance_id (if any).  Returns HASHPIPE_OK if
+ * deleted, HASHPIPE_ERR_KEY if it did not exist, HASHPIPE_ERR_SYS on error.
+ */
+int hashpipe_trace_delete(int instance_id);
+
+/* Returns pointer to ring i of trace segment t */
+hashpipe_trace_ring_t *hashpipe_trace_ring(hashpipe_trace_t *t, int i);
+
+/* Copy the records currently in ring i of trace segment t, oldest first, to
+ * recs (which must hold ring_size records).  Records that are overwritten
+ * while being copied are dropped, as is the oldest record of a full ring
+ * (which the writer may be overwriting).  Returns number of records copied.
+ */
+int hashpipe_trace_read(hashpipe_trace_t *t, int i,
+        hashpipe_trace_record_t *recs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _HASHPIPE_TRACE_H
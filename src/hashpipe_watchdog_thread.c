@@ -0,0 +1,233 @@
+/*
+ * hashpipe_watchdog_thread.c
+ *
+ * Framework thread that watches the progress of the pipeline threads.  The
+ * databuf functions count the blocks each pipeline thread fills or frees
+ * and note which block a thread is waiting for (see hashpipe_databuf.h).  A
+ * thread whose count has not changed for the stall time is considered
+ * stalled.  For every thread the watchdog stores in the status buffer
+ *
+ *   <PREFIX>STAL  seconds the thread has been stalled (0 if not stalled)
+ *
+ * and, when a thread becomes stalled, a snapshot of what it is stuck on:
+ *
+ *   <PREFIX>WAIT  databuf and block the thread is waiting for (and whether
+ *                 for it to be filled or freed), or "none" if it is not
+ *                 waiting in a databuf function
+ *   <PREFIX>IOCC  filled/total blocks of each of its input databufs
+ *   <PREFIX>OOCC  filled/total blocks of each of its output databufs
+ *
+ * where <PREFIX> is derived from the thread's skey (see
+ * hashpipe_thread_status_key).  WDSTALL lists the names of all currently
+ * stalled threads.  A thread waiting for filled input blocks while its
+ * output databufs have free blocks is starved by an upstream bottleneck; a
+ * thread waiting for free output blocks is held up by a downstream one.
+ *
+ * It is started by the hashpipe executable when the --watchdog option is
+ * given.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hashpipe.h"
+#include "hashpipe_thread_args.h"
+
+#define WATCHDOG_STR_SIZE 72
+
+// Format filled/total blocks of the n databufs in ids into str
+static void
+format_occupancy(hashpipe_databuf_t **db, const int *ids, int n, char *str)
+{
+    int i, l = 0;
+
+    strcpy(str, n ? "" : "-");
+    for(i=0; i<n && l<WATCHDOG_STR_SIZE; i++) {
+        if(db[ids[i]]) {
+            l += snprintf(str+l, WATCHDOG_STR_SIZE-l, "%s%d/%d", i ? "," : "",
+                    hashpipe_databuf_total_status(db[ids[i]]),
+                    db[ids[i]]->n_block);
+        } else {
+            l += snprintf(str+l, WATCHDOG_STR_SIZE-l, "%s?", i ? "," : "");
+        }
+    }
+}
+
+// Describe the databuf block args is waiting for in str
+static void
+format_wait(hashpipe_databuf_t **db, hashpipe_thread_args_t *args, char *str)
+{
+    int id, semid = __atomic_load_n(&args->wait_semid, __ATOMIC_ACQUIRE);
+
+    if(semid == -1) {
+        strcpy(str, "none");
+        return;
+    }
+    for(id=0; id<=HASHPIPE_MAX_DATABUFS; id++) {
+        if(db[id] && db[id]->semid == semid) {
+            snprintf(str, WATCHDOG_STR_SIZE, "db %d block %d %s", id,
+                    args->wait_block, args->wait_filled ? "filled" : "free");
+            return;
+        }
+    }
+    snprintf(str, WATCHDOG_STR_SIZE, "semid %d block %d %s", semid,
+            args->wait_block, args->wait_filled ? "filled" : "free");
+}
+
+// Name of thread (with replica index for replicas) in str
+static void
+format_name(hashpipe_thread_args_t *args, char *str)
+{
+    if(args->num_replicas > 1) {
+        snprintf(str, WATCHDOG_STR_SIZE, "%s[%d]", args->thread_desc->name,
+                args->replica);
+    } else {
+        snprintf(str, WATCHDOG_STR_SIZE, "%s", args->thread_desc->name);
+    }
+}
+
+void *hashpipe_watchdog_thread_run(void *vp_args)
+{
+    hashpipe_watchdog_args_t *wargs = (hashpipe_watchdog_args_t *)vp_args;
+    hashpipe_thread_args_t *args;
+    hashpipe_databuf_t *db[HASHPIPE_MAX_DATABUFS+1] = {0};
+    hashpipe_status_t st;
+    struct timespec ts;
+    double interval = wargs->stall_time / 4;
+    long interval_ns;
+    double now;
+    int i, j, n = wargs->num_threads;
+    uint64_t progress;
+    uint64_t last_progress[n];
+    double last_change[n];
+    int stalled[n];
+    int changed;
+    char key[9];
+    char wait[WATCHDOG_STR_SIZE];
+    char iocc[WATCHDOG_STR_SIZE];
+    char oocc[WATCHDOG_STR_SIZE];
+    char name[WATCHDOG_STR_SIZE];
+    char names[WATCHDOG_STR_SIZE];
+
+    if(hashpipe_status_attach(wargs->instance_id, &st) != HASHPIPE_OK) {
+        hashpipe_error(__FUNCTION__,
+                "Error attaching to status shared memory.");
+        return THREAD_ERROR;
+    }
+
+    // Check often enough to notice stalls promptly, but not too often
+    if(interval < 0.05) {
+        interval = 0.05;
+    } else if(interval > 1) {
+        interval = 1;
+    }
+    interval_ns = interval * 1e9;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ts.tv_sec + 1e-9 * ts.tv_nsec;
+    for(i=0; i<n; i++) {
+        last_progress[i] = 0;
+        last_change[i] = now;
+        stalled[i] = 0;
+    }
+
+    while(run_threads()) {
+        // Sleep until next check
+        ts.tv_sec  += interval_ns / 1000000000;
+        ts.tv_nsec += interval_ns % 1000000000;
+        if(ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        now = ts.tv_sec + 1e-9 * ts.tv_nsec;
+
+        names[0] = '\0';
+        for(i=0; i<n; i++) {
+            args = &wargs->args[i];
+
+            // Attach to any of the thread's databufs that exist by now
+            for(j=0; j<args->num_inputs; j++) {
+                if(!db[args->input_buffers[j]]) {
+                    db[args->input_buffers[j]] = hashpipe_databuf_attach(
+                            wargs->instance_id, args->input_buffers[j]);
+                }
+            }
+            for(j=0; j<args->num_outputs; j++) {
+                if(!db[args->output_buffers[j]]) {
+                    db[args->output_buffers[j]] = hashpipe_databuf_attach(
+                            wargs->instance_id, args->output_buffers[j]);
+                }
+            }
+
+            progress = __atomic_load_n(&args->progress, __ATOMIC_RELAXED);
+            if(progress != last_progress[i]
+            || hashpipe_thread_finished(args, 0)) {
+                last_progress[i] = progress;
+                last_change[i] = now;
+                stalled[i] = 0;
+            }
+
+            hashpipe_thread_status_key(args, "STAL", key);
+            if(now - last_change[i] < wargs->stall_time) {
+                hashpipe_status_lock_safe(&st);
+                changed = hashpipe_status_putnr8_changed(&st, key, 1, 0.0);
+                hashpipe_status_unlock_changed_safe(&st, changed);
+                continue;
+            }
+
+            // Thread is stalled
+            format_name(args, name);
+            if(strlen(names) + strlen(name) + 2 <= WATCHDOG_STR_SIZE) {
+                if(names[0]) {
+                    strcat(names, ",");
+                }
+                strcat(names, name);
+            }
+            hashpipe_status_lock_safe(&st);
+            hputnr8(st.buf, key, 1, now - last_change[i]);
+            hashpipe_status_unlock_safe(&st);
+            if(stalled[i]) {
+                continue;
+            }
+
+            // Newly stalled, so record what it is stuck on
+            stalled[i] = 1;
+            format_wait(db, args, wait);
+            format_occupancy(db, args->input_buffers, args->num_inputs, iocc);
+            format_occupancy(db, args->output_buffers, args->num_outputs,
+                    oocc);
+            hashpipe_status_lock_safe(&st);
+            hashpipe_thread_status_key(args, "WAIT", key);
+            hputs(st.buf, key, wait);
+            hashpipe_thread_status_key(args, "IOCC", key);
+            hputs(st.buf, key, iocc);
+            hashpipe_thread_status_key(args, "OOCC", key);
+            hputs(st.buf, key, oocc);
+            hashpipe_status_unlock_safe(&st);
+
+            if(wargs->log) {
+                hashpipe_warn(__FUNCTION__, "thread '%s' made no progress "
+                        "for %g seconds, waiting for: %s, "
+                        "input blocks filled: %s, output blocks filled: %s",
+                        name, wargs->stall_time,
+                        wait, iocc, oocc);
+            }
+        }
+
+        hashpipe_status_lock_safe(&st);
+        changed = hashpipe_status_puts_changed(&st, "WDSTALL",
+                names[0] ? names : "none");
+        hashpipe_status_unlock_changed_safe(&st, changed);
+    }
+
+    for(i=0; i<=HASHPIPE_MAX_DATABUFS; i++) {
+        hashpipe_databuf_detach(db[i]);
+    }
+    hashpipe_status_detach(&st);
+
+    return THREAD_OK;
+}
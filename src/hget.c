@@ -97,6 +97,44 @@ const static int multiline = 0;
 //static int lhead0 = 0;  /* Length of header string */
 const static int lhead0 = 0;  /* Length of header string */
 
+/* A single global length does not work with several header buffers (e.g.
+ * status buffers of different sizes) in one process, so instead hlength()
+ * registers the allocated length of each header buffer in a small table.
+ * Searches are bounded by the registered length of the buffer containing
+ * the string being searched (see hmaxlength()), and hput*() will not grow a
+ * header past it.  A negative length just unregisters the header buffer.
+ * Status buffers are registered when attached and unregistered when
+ * detached.
+ */
+#define MAX_HLENGTH 256
+static struct {
+    const char *header;
+    int lhead;
+} hlength_table[MAX_HLENGTH];
+static int nhlength = 0;         /* High water mark of hlength_table */
+static int hlength_busy = 0;     /* Spin lock for updating hlength_table */
+
+/* Return number of bytes from hstring to end of the registered header buffer
+ * containing it, or 0 if hstring is not in a registered header buffer.
+ */
+int
+hmaxlength (hstring)
+const char *hstring;
+{
+    int i, l;
+    const char *h;
+
+    for (i = 0; i < nhlength; i++) {
+        h = hlength_table[i].header;
+        if (h != NULL && hstring >= h) {
+            l = hlength_table[i].lhead;
+            if (hstring < h + l)
+                return (h + l - hstring);
+            }
+        }
+    return (0);
+}
+
 /* Set the length of the header string, if not terminated by NULL */
 int
 hlength (header, lhead)
@@ -104,17 +142,40 @@ const char *header; /* FITS header */
 int     lhead;  /* Maximum length of FITS header */
 {
     char *hend;
-#if 0 
-    if (lhead0 > 0)
-        lhead0 = lhead;
-    else {
-        lhead0 = 0;
-        hend = ksearch (header,"END");
-        lhead0 = hend + 80 - header;
+    int i, slot = -1;
+
+    /* Zero length just computes the length of the header */
+    if (lhead != 0) {
+        while (__sync_lock_test_and_set (&hlength_busy, 1))
+            ;
+        for (i = 0; i < nhlength; i++) {
+            if (hlength_table[i].header == header) {
+                /* Unregister, possibly to re-register below */
+                hlength_table[i].header = NULL;
+                __sync_synchronize ();
+                }
+            if (slot < 0 && hlength_table[i].header == NULL)
+                slot = i;
+            }
+        if (lhead > 0) {
+            if (slot < 0 && nhlength < MAX_HLENGTH)
+                slot = nhlength;
+            if (slot >= 0) {
+                hlength_table[slot].lhead = lhead;
+                __sync_synchronize ();
+                hlength_table[slot].header = header;
+                if (slot == nhlength)
+                    nhlength++;
+                }
+            }
+        __sync_lock_release (&hlength_busy);
+        return (lhead);
         }
-#endif
-    /* Always return header length based on END.  --PBD*/
+
+    /* Otherwise return header length based on END.  --PBD*/
     hend = ksearch (header,"END");
+    if (hend == NULL)
+        return (0);
     return (hend + 80 - header);
 }
 
@@ -1234,42 +1295,68 @@ const char *keyword0;   /* character string containing the name of the keyword
 }
 
 
-/* Find beginning of fillable blank line before FITS header keyword line */
+/* ksearch() and blsearch() both look for the first line of a header (up to
+ * headlast) that starts with keyword, ignoring case and up to 7 leading
+ * blanks, where the keyword is followed by '=', a blank or a non-printing
+ * character.  The scalar version does this with strncsrch(), which looks at
+ * every byte of the header.  On x86 CPUs with SSE4.2 or AVX2, the SIMD
+ * versions compare the first 8 bytes of 2 or 4 header lines at a time and
+ * only check the candidate lines in detail, which gives the same results in
+ * a fraction of the time.  The version to use is picked at runtime (see
+ * hsetsimd()).
+ */
 
-char *
-blsearch (hstring,keyword)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HGET_SIMD
+#include <immintrin.h>
+#endif
 
-/* Find entry for keyword keyword in FITS header string hstring.
-   (the keyword may have a maximum of eight letters)
-   NULL is returned if the keyword is not found */
+/* Levels for hsetsimd() */
+#define HGET_SIMD_NONE  0
+#define HGET_SIMD_SSE42 1
+#define HGET_SIMD_AVX2  2
 
-const char *hstring;    /* character string containing fits-style header
-                information in the format <keyword>= <value> {/ <comment>}
-                the default is that each entry is 80 characters long;
-                however, lines may be of arbitrary length terminated by
-                nulls, carriage returns or linefeeds, if packed is true.  */
-const char *keyword;    /* character string containing the name of the variable
-                to be returned.  ksearch searches for a line beginning
-                with this string.  The string may be a character
-                literal or a character variable terminated by a null
-                or '$'.  it is truncated to 8 characters. */
+static int hsimd_level = -1;
+
+/* Set the SIMD level used by ksearch(), blsearch() and strnsrch() to level
+ * (0 for scalar code, 1 for SSE4.2, 2 for AVX2, or -1 for the best level the
+ * CPU supports), limited to the levels the CPU supports.  Returns the level
+ * in use.
+ */
+int
+hsetsimd (level)
+int level;      /* Requested SIMD level */
 {
-    const char *headlast;
-    char *loc, *headnext, *pval, *lc, *line;
-    char *bval;
-    int icol, nextchar, lkey, nleft, lhstr;
+    int maxlevel = HGET_SIMD_NONE;
+
+#ifdef HGET_SIMD
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+        maxlevel = HGET_SIMD_AVX2;
+    else if (__builtin_cpu_supports ("sse4.2"))
+        maxlevel = HGET_SIMD_SSE42;
+#endif
+    if (level < 0 || level > maxlevel)
+        level = maxlevel;
+    hsimd_level = level;
+    return (level);
+}
 
-    pval = 0;
+/* Return the SIMD level in use, picking the best one on first use */
+static inline int
+hgetsimd (void)
+{
+    if (hsimd_level < 0)
+        return (hsetsimd (-1));
+    return (hsimd_level);
+}
+
+static char *
+kfind_scalar (const char *hstring, const char *headlast, const char *keyword)
+{
+    char *loc, *headnext, *pval, *lc, *line;
+    int icol, nextchar, lkey, nleft;
 
-    /* Search header string for variable name */
-    if (lhead0)
-        lhstr = lhead0;
-    else {
-        lhstr = 0;
-        while (lhstr < 256000 && hstring[lhstr] != 0)
-            lhstr++;
-        }
-    headlast = hstring + lhstr;
     headnext = (char *) hstring;
     pval = NULL;
     while (headnext < headlast) {
@@ -1309,6 +1396,215 @@ const char *keyword;    /* character string containing the name of the variable
             }
         }
 
+    return (pval);
+}
+
+#ifdef HGET_SIMD
+
+/* Return c with the opposite case if it is a letter, as strncsrch() does */
+static inline char
+kcase (char c)
+{
+    if (c > 96 && c < 123)
+        return (c - 32);
+    else if (c > 64 && c < 91)
+        return (c + 32);
+    else
+        return (c);
+}
+
+/* Return line if it is a match for keyword (of length lkey), else NULL.
+ * Because keyword does not start with a blank, it can only match right after
+ * the leading blanks of the line.
+ */
+static char *
+kline (const char *line, const char *headlast, const char *keyword, int lkey)
+{
+    const char *loc = line;
+    int i, nextchar;
+
+    while (loc < line + 8 && loc < headlast && *loc == ' ')
+        loc++;
+    if (loc > line + 7 || loc + lkey > headlast)
+        return (NULL);
+    for (i = 0; i < lkey; i++) {
+        if (loc[i] != keyword[i] && loc[i] != kcase (keyword[i]))
+            return (NULL);
+        }
+    nextchar = (int) loc[lkey];
+    if (nextchar != 61 && nextchar > 32 && nextchar < 127)
+        return (NULL);
+    return ((char *) line);
+}
+
+/* Check each remaining line starting at line */
+static char *
+klines (const char *line, const char *headlast, const char *keyword, int lkey)
+{
+    for (; line < headlast; line += 80) {
+        if (kline (line, headlast, keyword, lkey))
+            return ((char *) line);
+        }
+    return (NULL);
+}
+
+/* Set up the 8-byte pattern and mask that the first 8 bytes of a line, with
+ * the 0x20 bit set in every byte, must match to be a candidate line.  Setting
+ * the 0x20 bit makes letters lower case, so no match is missed; anything
+ * else it lets through is weeded out by kline().  Lines starting with a
+ * blank are always candidates.
+ */
+static void
+kpattern (const char *keyword, int lkey, long long *pattern, long long *mask)
+{
+    unsigned char p[8], m[8];
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        p[i] = i < lkey ? keyword[i] | 0x20 : 0;
+        m[i] = i < lkey ? 0xff : 0;
+        }
+    memcpy (pattern, p, 8);
+    memcpy (mask, m, 8);
+}
+
+static inline long long
+kload (const char *p)
+{
+    long long v;
+    memcpy (&v, p, 8);
+    return (v);
+}
+
+__attribute__ ((target ("sse4.2")))
+static char *
+kfind_sse42 (const char *hstring, const char *headlast, const char *keyword)
+{
+    const char *line = hstring;
+    int lkey = strlen (keyword);
+    long long pattern, mask;
+    __m128i vpat, vmask, vblank, v, hit;
+    int m;
+
+    if (lkey == 0 || keyword[0] == ' ')
+        return (kfind_scalar (hstring, headlast, keyword));
+
+    kpattern (keyword, lkey, &pattern, &mask);
+    vpat = _mm_set1_epi64x (pattern);
+    vmask = _mm_set1_epi64x (mask);
+    vblank = _mm_set1_epi8 (' ');
+
+    /* Two lines at a time while the first 8 bytes of both are in range */
+    for (; line + 88 <= headlast; line += 160) {
+        v = _mm_set_epi64x (kload (line + 80), kload (line));
+        hit = _mm_cmpeq_epi64 (_mm_and_si128 (_mm_or_si128 (v, vblank), vmask),
+                               vpat);
+        m = _mm_movemask_epi8 (hit) | _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, vblank));
+        if (m & 0x0101) {
+            if ((m & 0x0001) && kline (line, headlast, keyword, lkey))
+                return ((char *) line);
+            if ((m & 0x0100) && kline (line + 80, headlast, keyword, lkey))
+                return ((char *) line + 80);
+            }
+        }
+
+    return (klines (line, headlast, keyword, lkey));
+}
+
+__attribute__ ((target ("avx2")))
+static char *
+kfind_avx2 (const char *hstring, const char *headlast, const char *keyword)
+{
+    const char *line = hstring;
+    int lkey = strlen (keyword);
+    long long pattern, mask;
+    __m256i vpat, vmask, vblank, vidx, v, hit;
+    unsigned int m;
+    int i;
+
+    if (lkey == 0 || keyword[0] == ' ')
+        return (kfind_scalar (hstring, headlast, keyword));
+
+    kpattern (keyword, lkey, &pattern, &mask);
+    vpat = _mm256_set1_epi64x (pattern);
+    vmask = _mm256_set1_epi64x (mask);
+    vblank = _mm256_set1_epi8 (' ');
+    vidx = _mm256_set_epi64x (240, 160, 80, 0);
+
+    /* Four lines at a time while the first 8 bytes of all are in range */
+    for (; line + 248 <= headlast; line += 320) {
+        v = _mm256_i64gather_epi64 ((const long long *) line, vidx, 1);
+        hit = _mm256_cmpeq_epi64 (_mm256_and_si256 (_mm256_or_si256 (v, vblank),
+                                                    vmask), vpat);
+        m = _mm256_movemask_epi8 (hit)
+          | _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, vblank));
+        m &= 0x01010101;
+        for (i = 0; m; i++, m >>= 8) {
+            if ((m & 1) && kline (line + 80 * i, headlast, keyword, lkey))
+                return ((char *) line + 80 * i);
+            }
+        }
+
+    return (klines (line, headlast, keyword, lkey));
+}
+
+#endif /* HGET_SIMD */
+
+/* Find first line of hstring (up to headlast) starting with keyword */
+static char *
+kfind (const char *hstring, const char *headlast, const char *keyword)
+{
+#ifdef HGET_SIMD
+    switch (hgetsimd ()) {
+    case HGET_SIMD_AVX2:
+        return (kfind_avx2 (hstring, headlast, keyword));
+    case HGET_SIMD_SSE42:
+        return (kfind_sse42 (hstring, headlast, keyword));
+    }
+#endif
+    return (kfind_scalar (hstring, headlast, keyword));
+}
+
+
+/* Find beginning of fillable blank line before FITS header keyword line */
+
+char *
+blsearch (hstring,keyword)
+
+/* Find entry for keyword keyword in FITS header string hstring.
+   (the keyword may have a maximum of eight letters)
+   NULL is returned if the keyword is not found */
+
+const char *hstring;    /* character string containing fits-style header
+                information in the format <keyword>= <value> {/ <comment>}
+                the default is that each entry is 80 characters long;
+                however, lines may be of arbitrary length terminated by
+                nulls, carriage returns or linefeeds, if packed is true.  */
+const char *keyword;    /* character string containing the name of the variable
+                to be returned.  ksearch searches for a line beginning
+                with this string.  The string may be a character
+                literal or a character variable terminated by a null
+                or '$'.  it is truncated to 8 characters. */
+{
+    const char *headlast, *hend;
+    char *pval;
+    char *bval;
+    int lhstr, lmax;
+
+    pval = 0;
+
+    /* Search header string for variable name */
+    if (lhead0)
+        lhstr = lhead0;
+    else {
+        if ((lmax = hmaxlength (hstring)) == 0)
+            lmax = 256000;
+        hend = memchr (hstring, 0, lmax);
+        lhstr = hend ? hend - hstring : lmax;
+        }
+    headlast = hstring + lhstr;
+    pval = kfind (hstring, headlast, keyword);
+
     /* Return NULL to calling program if keyword is not found */
     if (pval == NULL)
         return (pval);
@@ -1351,9 +1647,9 @@ const char *keyword;    /* character string containing the name of the variable
                 literal or a character variable terminated by a null
                 or '$'.  it is truncated to 8 characters. */
 {
-    const char *headlast;
-    char *loc, *headnext, *pval, *lc, *line;
-    int icol, nextchar, lkey, nleft, lhead, lmax;
+    const char *headlast, *hend;
+    char *pval;
+    int lhead, lmax;
 
 #ifdef USE_SAOLIB
         int iel=1, ip=1, nel, np, ier;
@@ -1367,53 +1663,14 @@ const char *keyword;    /* character string containing the name of the variable
 /* Find current length of header string */
     if (lhead0)
         lmax = lhead0;
-    else
+    else if ((lmax = hmaxlength (hstring)) == 0)
         lmax = 256000;
-    for (lhead = 0; lhead < lmax; lhead++) {
-        if (hstring[lhead] == (char) 0)
-            break;
-        }
+    hend = memchr (hstring, 0, lmax);
+    lhead = hend ? hend - hstring : lmax;
 
 /* Search header string for variable name */
     headlast = hstring + lhead;
-    headnext = (char *) hstring;
-    pval = NULL;
-    while (headnext < headlast) {
-        nleft = headlast - headnext;
-        loc = strncsrch (headnext, keyword, nleft);
-
-        /* Exit if keyword is not found */
-        if (loc == NULL) {
-            break;
-            }
-
-        icol = (loc - hstring) % 80;
-        lkey = strlen (keyword);
-        nextchar = (int) *(loc + lkey);
-
-        /* If this is not in the first 8 characters of a line, keep searching */
-        if (icol > 7)
-            headnext = loc + 1;
-
-        /* If parameter name in header is longer, keep searching */
-        else if (nextchar != 61 && nextchar > 32 && nextchar < 127)
-            headnext = loc + 1;
-
-        /* If preceeding characters in line are not blanks, keep searching */
-        else {
-            line = loc - icol;
-            for (lc = line; lc < loc; lc++) {
-                if (*lc != ' ')
-                    headnext = loc + 1;
-                }
-
-        /* Return pointer to start of line if match */
-            if (loc >= headnext) {
-                pval = line;
-                break;
-                }
-            }
-        }
+    pval = kfind (hstring, headlast, keyword);
 
 /* Return pointer to calling program */
         return (pval);
@@ -1549,6 +1806,76 @@ const char *s2; /* String to look for */
 }
 
 
+static char *strnsrch_scalar ();
+
+#ifdef HGET_SIMD
+
+/* SIMD versions of strnsrch() for ls2 > 0 and ls1 >= ls2.  They search
+ * 16 or 32 positions at a time and finish off with the scalar code.
+ */
+
+/* SSE4.2 string compare in "equal ordered" (i.e. substring) mode finds the
+ * first position of s2 in a 16 byte block, including partial matches at the
+ * end of the block, for patterns up to 16 bytes long.
+ */
+__attribute__ ((target ("sse4.2")))
+static char *
+strnsrch_sse42 (const char *s1, const char *s2, int ls1, int ls2)
+{
+    const char *s = s1, *s1end = s1 + ls1;
+    char p[16] = {0};
+    __m128i v2;
+    int i;
+
+    if (ls2 > 16)
+        return (strnsrch_scalar (s1, s2, ls1));
+
+    memcpy (p, s2, ls2);
+    v2 = _mm_loadu_si128 ((const __m128i *) p);
+    while (s + 16 <= s1end) {
+        i = _mm_cmpestri (v2, ls2, _mm_loadu_si128 ((const __m128i *) s), 16,
+                          _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ORDERED);
+        if (i == 16)
+            s += 16;
+        else if (i + ls2 <= 16)
+            return ((char *) s + i);
+        else
+            /* Partial match at end of block, so look again from there */
+            s += i;
+        }
+    return (strnsrch_scalar (s, s2, s1end - s));
+}
+
+/* Compare first and last bytes of s2 at 32 positions at once and check the
+ * rest of s2 only where both match.
+ */
+__attribute__ ((target ("avx2")))
+static char *
+strnsrch_avx2 (const char *s1, const char *s2, int ls1, int ls2)
+{
+    const char *s = s1, *s1e = s1 + ls1 - ls2 + 1;
+    const __m256i vfirst = _mm256_set1_epi8 (s2[0]);
+    const __m256i vlast = _mm256_set1_epi8 (s2[ls2-1]);
+    __m256i v;
+    unsigned int m;
+    int i;
+
+    for (; s + 32 <= s1e; s += 32) {
+        v = _mm256_and_si256 (
+                _mm256_cmpeq_epi8 (vfirst, _mm256_loadu_si256 ((const __m256i *) s)),
+                _mm256_cmpeq_epi8 (vlast, _mm256_loadu_si256 ((const __m256i *) (s + ls2 - 1))));
+        for (m = _mm256_movemask_epi8 (v); m; m &= m - 1) {
+            i = __builtin_ctz (m);
+            if (ls2 < 3 || !memcmp (s + i + 1, s2 + 1, ls2 - 2))
+                return ((char *) s + i);
+            }
+        }
+    return (strnsrch_scalar (s, s2, s1 + ls1 - s));
+}
+
+#endif /* HGET_SIMD */
+
+
 /* Find string s2 within string s1 */
 
 char *
@@ -1558,6 +1885,30 @@ const char *s1; /* String to search */
 const char *s2; /* String to look for */
 const int ls1;  /* Length of string being searched */
 
+{
+#ifdef HGET_SIMD
+    int ls2;
+
+    if (s1 != NULL && s2 != NULL && (ls2 = strlen (s2)) > 0 && ls1 >= ls2) {
+        switch (hgetsimd ()) {
+        case HGET_SIMD_AVX2:
+            return (strnsrch_avx2 (s1, s2, ls1, ls2));
+        case HGET_SIMD_SSE42:
+            return (strnsrch_sse42 (s1, s2, ls1, ls2));
+        }
+        }
+#endif
+    return (strnsrch_scalar (s1, s2, ls1));
+}
+
+
+static char *
+strnsrch_scalar (s1, s2, ls1)
+
+const char *s1; /* String to search */
+const char *s2; /* String to look for */
+const int ls1;  /* Length of string being searched */
+
 {
     char *s,*s1e;
     char cfirst,clast;
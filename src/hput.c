@@ -455,7 +455,7 @@ const char *value; /* character string containing the value for variable
     char line[100];
     char newcom[50];
     char *vp, *v1, *v2, *q1, *q2, *c1, *ve;
-    int lkeyword, lcom, lval, lc, lv1, lhead, lblank, ln, nc, i;
+    int lkeyword, lcom, lval, lc, lv1, lhead, lmax, lblank, ln, nc, i;
 
     /* Find length of keyword, value, and header */
     lkeyword = (int) strlen (keyword);
@@ -487,6 +487,11 @@ const char *value; /* character string containing the value for variable
                 return (-1);
                 }
 
+            /* END moves to v2, so it must fit in registered buffer */
+            if ((lmax = hmaxlength (hstring)) > 0 && v2 + 80 - hstring > lmax) {
+                return (-1);
+                }
+
             /* Move END down 80 characters */
             strncpy (v2, v1, 80);
             }
@@ -537,6 +542,11 @@ const char *value; /* character string containing the value for variable
                 return (-1);
                 }
 
+            /* END moves to v2, so it must fit in registered buffer */
+            if ((lmax = hmaxlength (hstring)) > 0 && v2 + 80 - hstring > lmax) {
+                return (-1);
+                }
+
             strncpy (v2, ve, 80);
             }
         else
@@ -649,7 +659,7 @@ hputcom (hstring,keyword,comment)
 {
     char squot, slash, space;
     char line[100];
-    int lkeyword, lcom, lhead, i, lblank, ln, nc, lc;
+    int lkeyword, lcom, lhead, lmax, i, lblank, ln, nc, lc;
     char *vp, *v1, *v2, *c0, *c1, *q1, *q2=NULL;
 
     squot = (char) 39;
@@ -680,6 +690,11 @@ hputcom (hstring,keyword,comment)
             return (-1);
             }
 
+        /* END moves to v2, so it must fit in registered buffer */
+        if ((lmax = hmaxlength (hstring)) > 0 && v2 + 80 - hstring > lmax) {
+            return (-1);
+            }
+
         /* Move END down 80 characters */
         strncpy (v2, v1, 80);
 
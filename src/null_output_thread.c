@@ -12,11 +12,19 @@
 
 #include "hashpipe.h"
 
+// Note current input block and release it
+static int process(hashpipe_thread_args_t *args,
+        char *in, int in_block, char *out, int out_block)
+{
+    hashpipe_status_lock_safe(&args->st);
+    hputi4(args->st.buf, "NULBLKIN", in_block);
+    hashpipe_status_unlock_safe(&args->st);
+    return HASHPIPE_OK;
+}
+
 static void *run(hashpipe_thread_args_t * args)
 {
     hashpipe_databuf_t *db;
-    hashpipe_status_t st = args->st;
-    const char * status_key = args->thread_desc->skey;
 
     // Attach to databuf as a low-level hashpipe databuf.  Since
     // null_output_thread can attach to any kind of databuf, we cannot create
@@ -38,53 +46,20 @@ static void *run(hashpipe_thread_args_t * args)
         hashpipe_error(__FUNCTION__, msg);
         return THREAD_ERROR;
     }
-    pthread_cleanup_push((void (*)(void *))hashpipe_databuf_detach, db);
-
-    /* Main loop */
-    int rv;
-    int block_idx = 0;
-    while (run_threads()) {
-
-        hashpipe_status_lock_safe(&st);
-        hputs(st.buf, status_key, "waiting");
-        hashpipe_status_unlock_safe(&st);
 
-        // Wait for new block to be filled
-        while ((rv=hashpipe_databuf_wait_filled(db, block_idx)) != HASHPIPE_OK) {
-            if (rv==HASHPIPE_TIMEOUT) {
-                hashpipe_status_lock_safe(&st);
-                hputs(st.buf, status_key, "blocked");
-                hashpipe_status_unlock_safe(&st);
-                continue;
-            } else {
-                hashpipe_error(__FUNCTION__, "error waiting for filled databuf");
-                pthread_exit(NULL);
-                break;
-            }
-        }
+    // Use it as the thread's input databuf, which the framework detaches
+    // when the thread exits
+    args->ibufs[0] = args->ibuf = db;
 
-        // Note processing status, current input block
-        hashpipe_status_lock_safe(&st);
-        hputs(st.buf, status_key, "processing");
-        hputi4(st.buf, "NULBLKIN", block_idx);
-        hashpipe_status_unlock_safe(&st);
-
-        // Mark block as free
-        hashpipe_databuf_set_free(db, block_idx);
-
-        // Setup for next block
-        block_idx = (block_idx + 1) % db->n_block;
-
-        /* Will exit if thread has been cancelled */
-        pthread_testcancel();
+    // Replicas take turns at the blocks (see hashpipe_thread_next_block())
+    if(db->n_block % args->num_replicas) {
+        hashpipe_error(__FUNCTION__, "databuf %d has %d blocks, which is not "
+                "a multiple of the %d replicas", args->input_buffer,
+                db->n_block, args->num_replicas);
+        return THREAD_ERROR;
     }
 
-    // Detach from databuf
-    hashpipe_databuf_detach(db);
-    pthread_cleanup_pop(0); // databuf detach
-
-    // Thread success!
-    return THREAD_OK;
+    return hashpipe_stage_run(args, process);
 }
 
 static hashpipe_thread_desc_t null_thread = {
@@ -93,7 +68,8 @@ static hashpipe_thread_desc_t null_thread = {
     init: NULL,
     run:  run,
     ibuf_desc: {NULL},
-    obuf_desc: {NULL}
+    obuf_desc: {NULL},
+    flags: HASHPIPE_THREAD_REPLICABLE
 };
 
 static __attribute__((constructor)) void ctor()